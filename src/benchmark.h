@@ -0,0 +1,121 @@
+#pragma once
+#include "globals.h"
+#ifndef ESP_PLATFORM
+#include <time.h>
+#endif
+
+// ============================================================================
+// Microbenchmarks
+// ============================================================================
+// Timing harness for the hot-path benchmarks in main.cpp, compiled only into
+// BENCHMARK=1 builds ([env:bench] in platformio.ini, tools/sim/bench.cpp on
+// the host).
+//
+// On the device time is the CPU cycle counter; on the host it is
+// CLOCK_MONOTONIC in nanoseconds. Every case is run BATCHES times after one
+// warm-up call, and the median and best batch are reported, so a batch hit
+// by an interrupt or a WiFi burst does not move the result. Results go to
+// the serial port as one JSON object per line:
+//
+//   {"bench":"rx_led_state","platform":"esp32","iterations":500,"ns_per_op":14250.3,"min_ns_per_op":14102.8,"cycles_per_op":3420}
+//
+// cycles_per_op is only present on the device. tools/benchcmp.py compares
+// two runs.
+
+#ifndef BENCHMARK
+#define BENCHMARK 0
+#endif
+
+#if BENCHMARK
+namespace benchmark {
+
+  const uint8_t BATCHES = 5;
+
+  typedef void (*Operation)(uint32_t iteration);
+
+  /**
+   * Free-running tick counter. Differences are valid across one wrap:
+   * 17 s at 240 MHz on the device, 4.2 s on the host.
+   */
+  inline uint32_t ticks() {
+#ifdef ESP_PLATFORM
+    return ESP.getCycleCount();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+  }
+
+  inline uint32_t ticksPerUs() {
+#ifdef ESP_PLATFORM
+    return ESP.getCpuFreqMHz();
+#else
+    return 1000;
+#endif
+  }
+
+  static void report(const char *name, uint32_t iterations, uint32_t *batchTicks) {
+    // Insertion sort, BATCHES is tiny
+    for (uint8_t i = 1; i < BATCHES; i++) {
+      uint32_t value = batchTicks[i];
+      uint8_t j = i;
+      for (; j > 0 && batchTicks[j - 1] > value; j--) {
+        batchTicks[j] = batchTicks[j - 1];
+      }
+      batchTicks[j] = value;
+    }
+
+    double perOp = (double)batchTicks[BATCHES / 2] / iterations;
+    double bestPerOp = (double)batchTicks[0] / iterations;
+    double nsPerTick = 1000.0 / ticksPerUs();
+#ifdef ESP_PLATFORM
+    Serial.printf("{\"bench\":\"%s\",\"platform\":\"esp32\",\"iterations\":%lu,\"ns_per_op\":%.1f,"
+                  "\"min_ns_per_op\":%.1f,\"cycles_per_op\":%lu}\n",
+                  name, (unsigned long)iterations, perOp * nsPerTick, bestPerOp * nsPerTick,
+                  (unsigned long)(perOp + 0.5));
+#else
+    Serial.printf("{\"bench\":\"%s\",\"platform\":\"host\",\"iterations\":%lu,\"ns_per_op\":%.1f,"
+                  "\"min_ns_per_op\":%.1f}\n",
+                  name, (unsigned long)iterations, perOp * nsPerTick, bestPerOp * nsPerTick);
+#endif
+  }
+
+  /**
+   * Time iterations back-to-back calls of op per batch
+   */
+  inline void run(const char *name, uint32_t iterations, Operation op) {
+    uint32_t batchTicks[BATCHES];
+    op(0);
+    for (uint8_t b = 0; b < BATCHES; b++) {
+      uint32_t start = ticks();
+      for (uint32_t i = 0; i < iterations; i++) {
+        op(i);
+      }
+      batchTicks[b] = ticks() - start;
+    }
+    report(name, iterations, batchTicks);
+  }
+
+  /**
+   * Time each call on its own with gapMs between calls, for operations that
+   * cannot run back-to-back (queueing a CAN frame would only measure a full
+   * queue). Includes one ticks() read per call.
+   */
+  inline void runSpaced(const char *name, uint32_t iterations, uint32_t gapMs, Operation op) {
+    uint32_t batchTicks[BATCHES];
+    op(0);
+    delay(gapMs);
+    for (uint8_t b = 0; b < BATCHES; b++) {
+      batchTicks[b] = 0;
+      for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t start = ticks();
+        op(i);
+        batchTicks[b] += ticks() - start;
+        delay(gapMs);
+      }
+    }
+    report(name, iterations, batchTicks);
+  }
+}
+#endif
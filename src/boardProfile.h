@@ -0,0 +1,216 @@
+#pragma once
+#include <Arduino.h>
+#ifdef ESP_PLATFORM
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#endif
+
+// ============================================================================
+// Board Profiles
+// ============================================================================
+// Button and backlight pins of the 4-, 6- and 8-button panels. The profile
+// is chosen at compile time (platformio.ini build flags):
+//   build_flags = -DBOARD_BUTTONS=6
+//
+// Every profile is checked against the ESP32 pin capabilities when it is
+// compiled, so a pin table that would build and then misbehave on the bench
+// fails the build instead: a button on a pin without an internal pull-up
+// (GPIO 34-39) and no external one declared, an LED on an input-only pin,
+// anything on the SPI flash or console UART pins, a pin used twice, or a
+// pull-up that would change the boot mode.
+//
+// The button and LED pin masks are generated from the tables, so a button
+// scan is one read of each GPIO input register and a backlight update is a
+// handful of set/clear register writes, whatever the button count.
+
+#ifndef BOARD_BUTTONS
+#define BOARD_BUTTONS 8
+#endif
+
+namespace board {
+
+  // ESP32 pin capabilities
+  const uint8_t PIN_IN = 0x01;
+  const uint8_t PIN_OUT = 0x02;
+  const uint8_t PIN_PULLUP = 0x04;          // Internal pull-up available
+  const uint8_t PIN_RESERVED = 0x08;        // SPI flash (6-11) or console UART (1, 3)
+  const uint8_t PIN_IO = PIN_IN | PIN_OUT | PIN_PULLUP;
+
+  const uint8_t PIN_COUNT = 40;
+  constexpr uint8_t PIN_CAPS[PIN_COUNT] = {
+    PIN_IO, PIN_IO | PIN_RESERVED, PIN_IO, PIN_IO | PIN_RESERVED,            // 0-3
+    PIN_IO, PIN_IO, PIN_IO | PIN_RESERVED, PIN_IO | PIN_RESERVED,            // 4-7
+    PIN_IO | PIN_RESERVED, PIN_IO | PIN_RESERVED, PIN_IO | PIN_RESERVED,     // 8-10
+    PIN_IO | PIN_RESERVED, PIN_IO, PIN_IO, PIN_IO, PIN_IO,                   // 11-15
+    PIN_IO, PIN_IO, PIN_IO, PIN_IO, 0, PIN_IO, PIN_IO, PIN_IO,               // 16-23 (no 20)
+    0, PIN_IO, PIN_IO, PIN_IO, 0, 0, 0, 0,                                   // 24-31 (no 24, 28-31)
+    PIN_IO, PIN_IO, PIN_IN, PIN_IN, PIN_IN, PIN_IN, PIN_IN, PIN_IN           // 32-39, 34+ input only
+  };
+
+  // Strapping pins sampled at reset: GPIO 2 and 12 must not be pulled high
+  // (download mode / 1.8 V flash), GPIO 0 must not be pulled low (download mode)
+  const uint64_t STRAP_KEEP_LOW = (1ULL << 2) | (1ULL << 12);
+  const uint64_t STRAP_KEEP_HIGH = 1ULL << 0;
+
+  // CAN transceiver, shared by all profiles
+  const uint8_t CAN_TX_GPIO = 15;
+  const uint8_t CAN_RX_GPIO = 13;
+
+  constexpr uint64_t bit(uint8_t pin) {
+    return 1ULL << pin;
+  }
+
+  constexpr uint64_t maskOf(const uint8_t *pins, uint8_t count) {
+    return count == 0 ? 0 : bit(pins[count - 1]) | maskOf(pins, count - 1);
+  }
+
+  constexpr uint8_t countBits(uint64_t mask) {
+    return mask == 0 ? 0 : (uint8_t)(mask & 1) + countBits(mask >> 1);
+  }
+
+  /**
+   * True if every pin exists and has all of the required capabilities and
+   * none of the forbidden ones
+   */
+  constexpr bool allPins(const uint8_t *pins, uint8_t count, uint8_t required, uint8_t forbidden) {
+    return count == 0 ||
+           (pins[count - 1] < PIN_COUNT &&
+            (PIN_CAPS[pins[count - 1]] & required) == required &&
+            (PIN_CAPS[pins[count - 1]] & forbidden) == 0 &&
+            allPins(pins, count - 1, required, forbidden));
+  }
+
+  /**
+   * True if every button pin has a pull-up, internal or declared external
+   */
+  constexpr bool allPulledUp(const uint8_t *pins, uint8_t count, uint64_t externalPullups) {
+    return count == 0 ||
+           (((PIN_CAPS[pins[count - 1]] & PIN_PULLUP) || (externalPullups & bit(pins[count - 1]))) &&
+            allPulledUp(pins, count - 1, externalPullups));
+  }
+
+  // --------------------------------------------------------------------------
+  // Profiles. BUTTONS buttons, each with the backlight at the same index;
+  // externalPullups lists button pins pulled up on the PCB (set to INPUT
+  // rather than INPUT_PULLUP).
+  // --------------------------------------------------------------------------
+  template <uint8_t BUTTONS> struct Profile;
+
+  // trailer-switch-panel-eight-buttons (EDA/). Button 1 is on GPIO 34, which
+  // has no internal pull-up: it needs a pull-up resistor on the PCB.
+  template <> struct Profile<8> {
+    static constexpr uint8_t BUTTONS = 8;
+    static constexpr uint8_t buttonPins[BUTTONS] = {34, 25, 27, 12, 16, 22, 21, 18};
+    static constexpr uint8_t ledPins[BUTTONS] = {32, 33, 26, 14, 4, 23, 19, 17};
+    static constexpr uint64_t externalPullups = 1ULL << 34;
+  };
+  constexpr uint8_t Profile<8>::buttonPins[];
+  constexpr uint8_t Profile<8>::ledPins[];
+
+  // Six buttons: the eight-button layout without buttons 1 and 4, so no
+  // button needs an external pull-up or sits on a strapping pin
+  template <> struct Profile<6> {
+    static constexpr uint8_t BUTTONS = 6;
+    static constexpr uint8_t buttonPins[BUTTONS] = {25, 27, 16, 22, 21, 18};
+    static constexpr uint8_t ledPins[BUTTONS] = {33, 26, 4, 23, 19, 17};
+    static constexpr uint64_t externalPullups = 0;
+  };
+  constexpr uint8_t Profile<6>::buttonPins[];
+  constexpr uint8_t Profile<6>::ledPins[];
+
+  // Four buttons: one row of the six-button layout
+  template <> struct Profile<4> {
+    static constexpr uint8_t BUTTONS = 4;
+    static constexpr uint8_t buttonPins[BUTTONS] = {25, 27, 22, 21};
+    static constexpr uint8_t ledPins[BUTTONS] = {33, 26, 23, 19};
+    static constexpr uint64_t externalPullups = 0;
+  };
+  constexpr uint8_t Profile<4>::buttonPins[];
+  constexpr uint8_t Profile<4>::ledPins[];
+
+  /**
+   * A profile validated against the ESP32 pin rules, with its generated masks
+   */
+  template <class P> struct Checked : P {
+    static constexpr uint64_t BUTTON_MASK = maskOf(P::buttonPins, P::BUTTONS);
+    static constexpr uint64_t LED_MASK = maskOf(P::ledPins, P::BUTTONS);
+    static constexpr uint64_t CAN_MASK = bit(CAN_TX_GPIO) | bit(CAN_RX_GPIO);
+
+    // Masks for the batched register access: GPIO 0-31 and GPIO 32-39
+    static constexpr uint32_t BUTTON_MASK_LOW = (uint32_t)BUTTON_MASK;
+    static constexpr uint32_t BUTTON_MASK_HIGH = (uint32_t)(BUTTON_MASK >> 32);
+    static constexpr uint32_t LED_MASK_LOW = (uint32_t)LED_MASK;
+    static constexpr uint32_t LED_MASK_HIGH = (uint32_t)(LED_MASK >> 32);
+
+    static_assert(P::BUTTONS >= 1 && P::BUTTONS <= 8, "A profile has 1 to 8 buttons (one LED state frame)");
+    static_assert(allPins(P::buttonPins, P::BUTTONS, PIN_IN, PIN_RESERVED),
+                  "Button pin does not exist or is reserved for SPI flash (6-11) / console UART (1, 3)");
+    static_assert(allPins(P::ledPins, P::BUTTONS, PIN_OUT, PIN_RESERVED),
+                  "LED pin is input-only (34-39), does not exist or is reserved for SPI flash / console UART");
+    static_assert(allPulledUp(P::buttonPins, P::BUTTONS, P::externalPullups),
+                  "Button pin has no internal pull-up (34-39) and no external pull-up is declared");
+    static_assert((P::externalPullups & ~BUTTON_MASK) == 0, "External pull-up declared on a pin that is not a button");
+    static_assert(countBits(BUTTON_MASK) == P::BUTTONS, "Button pin used twice");
+    static_assert(countBits(LED_MASK) == P::BUTTONS, "LED pin used twice");
+    static_assert((BUTTON_MASK & LED_MASK) == 0, "Pin used as both button and LED");
+    static_assert(((BUTTON_MASK | LED_MASK) & CAN_MASK) == 0, "Pin conflicts with the CAN transceiver (13, 15)");
+    static_assert((P::externalPullups & STRAP_KEEP_LOW) == 0,
+                  "External pull-up on GPIO 2 or 12 changes the boot mode / flash voltage");
+    static_assert((LED_MASK & STRAP_KEEP_HIGH) == 0, "LED on GPIO 0 holds it low at reset (download mode)");
+
+    /**
+     * Arduino pin mode for a button pin
+     */
+    static constexpr uint8_t buttonMode(uint8_t pin) {
+      return (P::externalPullups & bit(pin)) ? INPUT : INPUT_PULLUP;
+    }
+  };
+
+  typedef Checked<Profile<BOARD_BUTTONS> > Active;
+  const uint8_t BUTTONS = Active::BUTTONS;
+
+  /**
+   * Levels of the button pins (bit N = GPIO N), read in one access per
+   * GPIO input register
+   */
+  inline uint64_t readButtonLevels() {
+#ifdef ESP_PLATFORM
+    uint64_t levels = 0;
+    if (Active::BUTTON_MASK_LOW != 0) {
+      levels |= REG_READ(GPIO_IN_REG) & Active::BUTTON_MASK_LOW;
+    }
+    if (Active::BUTTON_MASK_HIGH != 0) {
+      levels |= (uint64_t)(REG_READ(GPIO_IN1_REG) & Active::BUTTON_MASK_HIGH) << 32;
+    }
+    return levels;
+#else
+    uint64_t levels = 0;
+    for (uint8_t i = 0; i < BUTTONS; i++) {
+      if (digitalRead(Active::buttonPins[i]) == HIGH) {
+        levels |= bit(Active::buttonPins[i]);
+      }
+    }
+    return levels;
+#endif
+  }
+
+  /**
+   * Drive the LED pins: pins in on go high, the other LED pins go low
+   */
+  inline void writeLeds(uint64_t on) {
+#ifdef ESP_PLATFORM
+    if (Active::LED_MASK_LOW != 0) {
+      REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)on & Active::LED_MASK_LOW);
+      REG_WRITE(GPIO_OUT_W1TC_REG, ~(uint32_t)on & Active::LED_MASK_LOW);
+    }
+    if (Active::LED_MASK_HIGH != 0) {
+      REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(on >> 32) & Active::LED_MASK_HIGH);
+      REG_WRITE(GPIO_OUT1_W1TC_REG, ~(uint32_t)(on >> 32) & Active::LED_MASK_HIGH);
+    }
+#else
+    for (uint8_t i = 0; i < BUTTONS; i++) {
+      digitalWrite(Active::ledPins[i], (on & bit(Active::ledPins[i])) ? HIGH : LOW);
+    }
+#endif
+  }
+}
@@ -0,0 +1,236 @@
+#pragma once
+#include "globals.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+
+// ============================================================================
+// Bulk Transfer
+// ============================================================================
+// Streams a large blob (flight log, core dump) to a host over classic CAN
+// using windowed go-back-N flow control. One stream at a time.
+//
+// Frames on the bulk CAN ID (identifier set by the caller's send function):
+//   START  [0x80, stream, length LE32, window frames, 0]
+//   DATA   [seq, 7 data bytes]    seq = (offset / 7) & 0x7F, offset implied
+//   END    [0x81, stream, CRC-32 LE32 of the whole blob, 0, 0]
+//
+// The host acknowledges with the number of contiguous bytes it holds
+// (ack()). The sender stops after each window of WINDOW_FRAMES data frames
+// until acked, resends from the acked offset on a short ack or after
+// ACK_TIMEOUT_MS, and finishes when the host acks the full length after END.
+// CRC-32 is the zlib/IEEE polynomial (esp_rom_crc32_le, zlib.crc32 on the host).
+
+namespace bulk {
+
+  typedef bool (*ReadFn)(uint32_t offset, uint8_t *buf, size_t len);
+  typedef void (*DoneFn)(bool confirmed);
+  typedef bool (*SendFn)(twai_message_t &msg);
+
+  const uint8_t FRAME_START = 0x80;
+  const uint8_t FRAME_END = 0x81;
+  const uint8_t BYTES_PER_FRAME = 7;
+  const uint8_t WINDOW_FRAMES = 64;           // 448 bytes per ack
+  const uint32_t ACK_TIMEOUT_MS = 500;
+  const uint8_t MAX_RETRIES = 5;
+  const uint32_t ABORT_OFFSET = 0xFFFFFF;     // Host ack value that cancels the stream
+  const uint32_t IDLE = 0xFFFFFFFF;           // service(): nothing to do
+
+  enum Phase : uint8_t {
+    PHASE_IDLE = 0,
+    PHASE_START,                // START frame pending
+    PHASE_DATA,                 // Sending the current window
+    PHASE_END,                  // END frame pending
+    PHASE_WAIT_ACK              // Window or END sent, waiting for the host
+  };
+
+  static Phase phase = PHASE_IDLE;
+  static uint8_t streamId = 0;
+  static uint32_t totalLength = 0;
+  static uint32_t ackedOffset = 0;            // Bytes the host has confirmed
+  static uint32_t nextOffset = 0;             // Next byte to send
+  static uint32_t windowEnd = 0;
+  static uint32_t crc = 0;
+  static uint32_t crcOffset = 0;              // Bytes folded into crc so far
+  static uint32_t waitingSince = 0;
+  static uint8_t retries = 0;
+  static ReadFn readFn = NULL;
+  static DoneFn doneFn = NULL;
+
+  static volatile bool ackPending = false;    // Set from the RX task
+  static volatile uint32_t ackValue = 0;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  inline bool isActive() {
+    return phase != PHASE_IDLE;
+  }
+
+  /**
+   * Start streaming length bytes supplied by read. done is called once with
+   * confirmed = true after the host acked everything, false on abort/timeout.
+   * Returns false if a stream is already running.
+   */
+  inline bool start(uint8_t stream, uint32_t length, ReadFn read, DoneFn done) {
+    if (isActive()) {
+      return false;
+    }
+    streamId = stream;
+    totalLength = length;
+    ackedOffset = 0;
+    nextOffset = 0;
+    windowEnd = 0;
+    crc = 0;
+    crcOffset = 0;
+    retries = 0;
+    readFn = read;
+    doneFn = done;
+    ackPending = false;
+    phase = PHASE_START;
+    debugf("[BULK] Stream %d: %lu bytes\n", stream, (unsigned long)length);
+    return true;
+  }
+
+  /**
+   * Host acknowledgement (any task). offset = contiguous bytes received.
+   */
+  inline void ack(uint8_t stream, uint32_t offset) {
+    if (!isActive() || stream != streamId) {
+      return;
+    }
+    portENTER_CRITICAL(&lock);
+    ackValue = offset;
+    ackPending = true;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  static void finish(bool confirmed) {
+    phase = PHASE_IDLE;
+    debugf("[BULK] Stream %d %s\n", streamId, confirmed ? "confirmed" : "aborted");
+    if (doneFn != NULL) {
+      doneFn(confirmed);
+    }
+  }
+
+  static void openWindow(uint32_t from) {
+    nextOffset = from;
+    windowEnd = from + (uint32_t)WINDOW_FRAMES * BYTES_PER_FRAME;
+    if (windowEnd > totalLength) {
+      windowEnd = totalLength;
+    }
+    phase = nextOffset < totalLength ? PHASE_DATA : PHASE_END;
+  }
+
+  /**
+   * Send what the flow control allows. Call from one task, and again as soon
+   * as an ack arrives; returns the delay in ms until the next call is needed
+   * (1 while the TX queue is full), or IDLE when no stream is running.
+   */
+  inline uint32_t service(SendFn send, uint32_t nowMs) {
+    if (phase == PHASE_IDLE) {
+      return IDLE;
+    }
+
+    // Apply a pending host ack
+    bool acked = false;
+    uint32_t offset = 0;
+    portENTER_CRITICAL(&lock);
+    if (ackPending) {
+      acked = true;
+      offset = ackValue;
+      ackPending = false;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (acked && phase != PHASE_START) {
+      if (offset == ABORT_OFFSET) {
+        finish(false);
+        return IDLE;
+      }
+      if (offset >= totalLength && phase == PHASE_WAIT_ACK && nextOffset >= totalLength) {
+        finish(true);
+        return IDLE;
+      }
+      if (offset < totalLength) {
+        offset -= offset % BYTES_PER_FRAME;   // Keep resends frame-aligned
+      }
+      if (offset > ackedOffset && offset <= totalLength) {
+        ackedOffset = offset;
+        retries = 0;
+      }
+      openWindow(ackedOffset);
+    }
+
+    if (phase == PHASE_WAIT_ACK) {
+      if (nowMs - waitingSince < ACK_TIMEOUT_MS) {
+        return ACK_TIMEOUT_MS - (nowMs - waitingSince);
+      }
+      if (++retries > MAX_RETRIES) {
+        finish(false);
+        return IDLE;
+      }
+      openWindow(ackedOffset);
+    }
+
+    twai_message_t msg;
+    msg.flags = 0;
+    msg.data_length_code = 8;
+
+    if (phase == PHASE_START) {
+      msg.data[0] = FRAME_START;
+      msg.data[1] = streamId;
+      memcpy(&msg.data[2], &totalLength, sizeof(totalLength));
+      msg.data[6] = WINDOW_FRAMES;
+      msg.data[7] = 0;
+      if (!send(msg)) {
+        return 1;
+      }
+      openWindow(0);
+    }
+
+    while (phase == PHASE_DATA) {
+      uint32_t len = windowEnd - nextOffset;
+      if (len > BYTES_PER_FRAME) {
+        len = BYTES_PER_FRAME;
+      }
+      msg.data[0] = (nextOffset / BYTES_PER_FRAME) & 0x7F;
+      memset(&msg.data[1], 0, BYTES_PER_FRAME);
+      if (!readFn(nextOffset, &msg.data[1], len)) {
+        debugf("[BULK] Read failed at %lu\n", (unsigned long)nextOffset);
+        finish(false);
+        return IDLE;
+      }
+      msg.data_length_code = 1 + len;
+      if (!send(msg)) {
+        return 1;                             // TX queue full, try again shortly
+      }
+      if (nextOffset == crcOffset) {
+        crc = esp_rom_crc32_le(crc, &msg.data[1], len);
+        crcOffset += len;
+      }
+      nextOffset += len;
+      if (nextOffset >= windowEnd) {
+        if (nextOffset >= totalLength) {
+          phase = PHASE_END;
+        } else {
+          phase = PHASE_WAIT_ACK;
+          waitingSince = nowMs;
+        }
+      }
+    }
+
+    if (phase == PHASE_END) {
+      msg.data_length_code = 8;
+      msg.data[0] = FRAME_END;
+      msg.data[1] = streamId;
+      memcpy(&msg.data[2], &crc, sizeof(crc));
+      msg.data[6] = 0;
+      msg.data[7] = 0;
+      if (!send(msg)) {
+        return 1;
+      }
+      phase = PHASE_WAIT_ACK;
+      waitingSince = nowMs;
+    }
+
+    return ACK_TIMEOUT_MS;
+  }
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include "globals.h"
+#include "driver/twai.h"
+#include "canHelper.h"
+
+// ============================================================================
+// Bus Load Estimate and Throttling
+// ============================================================================
+// The panel estimates bus utilization from the frames it sees and sends
+// (nominal bit length per frame, without stuff bits) plus the error frames
+// counted by the TWAI controller, over windows of WINDOW_MS. Above the
+// configured limit (config key 21, percent, 0 = never throttle) it steps
+// through three throttle levels that thin out its low-priority traffic:
+//
+//   - brightness streams send every 2nd / 4th / 8th step (the ramp speed and
+//     the value sent on release are unchanged)
+//   - telemetry (task statistics frames, core dump adverts) is spaced 2x /
+//     4x / 8x further apart
+//   - bulk transfers wait BULK_BACKOFF_MS << (level - 1) between windows
+//
+// Toggles, scenes, time sync and configuration replies are never delayed.
+// An error-passive or bus-off controller forces the highest level.
+//
+// The loop task calls update() on every wake-up; a window closes once it has
+// run for WINDOW_MS, so no timer of its own keeps an idle panel awake.
+
+namespace busLoad {
+
+  const uint8_t FRAME_TYPE = 0x05;            // Diagnostic frame type: bus load report
+  const uint32_t WINDOW_MS = 250;
+  const uint8_t LEVEL_MAX = 3;
+  const uint8_t HYSTERESIS_PERCENT = 5;       // Below a threshold by this much to step down
+  const uint8_t MAX_LIMIT_PERCENT = 95;       // Highest accepted value for config key 21
+  const uint16_t ERROR_FRAME_BITS = 23;       // Flag, echo flag, delimiter, intermission
+  const uint32_t BULK_BACKOFF_MS = 10;
+  const uint8_t ERROR_PASSIVE_COUNT = 128;
+
+  struct Stats {
+    uint8_t level;                            // 0 = not throttling
+    uint8_t loadPercent;                      // Last complete window
+    uint8_t peakPercent;                      // Highest window since the last report
+    uint32_t busErrors;                       // Controller bus error count
+    uint32_t arbitrationLost;                 // Lost arbitrations of our own frames
+    uint32_t throttledFrames;                 // Brightness steps not sent
+  };
+
+  static uint32_t bitsPerMs = 500;            // Bus bitrate / 1000
+  static uint32_t windowBits = 0;             // Frame bits seen in the current window
+  static uint32_t windowStartMs = 0;
+  static uint32_t lastBusErrors = 0;
+  static Stats counters = {0, 0, 0, 0, 0, 0};
+  static volatile uint8_t currentLevel = 0;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  inline void begin(uint32_t bitrate) {
+    bitsPerMs = bitrate / 1000;
+    windowStartMs = millis();
+  }
+
+  /**
+   * Nominal length of a frame in bits, SOF to the end of intermission
+   */
+  inline uint16_t frameBits(const twai_message_t &msg) {
+    uint8_t dataBytes = msg.rtr ? 0 : (msg.data_length_code > 8 ? 8 : msg.data_length_code);
+    return (msg.extd ? 67 : 47) + dataBytes * 8;
+  }
+
+  /**
+   * Count a frame received or queued by this panel (any task)
+   */
+  inline void noteFrame(const twai_message_t &msg) {
+    uint16_t bits = frameBits(msg);
+    portENTER_CRITICAL(&lock);
+    windowBits += bits;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  /**
+   * Percent thresholds of the throttle levels above limitPercent
+   */
+  inline uint8_t threshold(uint8_t level, uint8_t limitPercent) {
+    return limitPercent + (100 - limitPercent) * (level - 1) / LEVEL_MAX;
+  }
+
+  /**
+   * Close the current window if it has run for WINDOW_MS and move the
+   * throttle level. Call from the loop task; returns the level.
+   */
+  inline uint8_t update(uint8_t limitPercent) {
+    uint32_t nowMs = millis();
+    uint32_t elapsedMs = nowMs - windowStartMs;
+    if (elapsedMs < WINDOW_MS) {
+      return currentLevel;
+    }
+
+    twai_status_info_t status;
+    bool statusOk = canHelper::readStatus(status);
+
+    portENTER_CRITICAL(&lock);
+    uint32_t bits = windowBits;
+    windowBits = 0;
+    portEXIT_CRITICAL(&lock);
+    windowStartMs = nowMs;
+
+    bool unhealthy = false;
+    if (statusOk) {
+      bits += (status.bus_error_count - lastBusErrors) * ERROR_FRAME_BITS;
+      lastBusErrors = status.bus_error_count;
+      unhealthy = status.state != TWAI_STATE_RUNNING || status.tx_error_counter >= ERROR_PASSIVE_COUNT;
+    }
+
+    uint32_t percent = (uint32_t)((uint64_t)bits * 100 / ((uint64_t)bitsPerMs * elapsedMs));
+    if (percent > 100) {
+      percent = 100;
+    }
+
+    uint8_t level = currentLevel;
+    if (limitPercent == 0) {
+      level = 0;
+    } else if (unhealthy) {
+      level = LEVEL_MAX;
+    } else {
+      while (level < LEVEL_MAX && percent >= threshold(level + 1, limitPercent)) {
+        level++;
+      }
+      while (level > 0 && percent + HYSTERESIS_PERCENT < threshold(level, limitPercent)) {
+        level--;
+      }
+    }
+
+    portENTER_CRITICAL(&lock);
+    counters.loadPercent = (uint8_t)percent;
+    if (percent > counters.peakPercent) {
+      counters.peakPercent = (uint8_t)percent;
+    }
+    if (statusOk) {
+      counters.busErrors = status.bus_error_count;
+      counters.arbitrationLost = status.arb_lost_count;
+    }
+    counters.level = level;
+    portEXIT_CRITICAL(&lock);
+
+    if (level != currentLevel) {
+      debugf("[BUS] Load %lu%% - throttle level %d\n", (unsigned long)percent, level);
+      currentLevel = level;
+    }
+    return level;
+  }
+
+  /**
+   * Level as of the last update (any task)
+   */
+  inline uint8_t level() {
+    return currentLevel;
+  }
+
+  /**
+   * True if step number step of a stream should be sent at the current level
+   */
+  inline bool admitStep(uint32_t step) {
+    if ((step & ((1UL << currentLevel) - 1)) == 0) {
+      return true;
+    }
+    portENTER_CRITICAL(&lock);
+    counters.throttledFrames++;
+    portEXIT_CRITICAL(&lock);
+    return false;
+  }
+
+  /**
+   * A telemetry interval stretched for the current level
+   */
+  inline uint32_t stretch(uint32_t ms) {
+    return ms << currentLevel;
+  }
+
+  /**
+   * Extra wait between bulk transfer windows at the current level
+   */
+  inline uint32_t bulkBackoffMs() {
+    return currentLevel == 0 ? 0 : BULK_BACKOFF_MS << (currentLevel - 1);
+  }
+
+  /**
+   * Copy of the statistics; clears the peak when resetPeak is set
+   */
+  inline Stats stats(bool resetPeak = false) {
+    portENTER_CRITICAL(&lock);
+    Stats copy = counters;
+    if (resetPeak) {
+      counters.peakPercent = counters.loadPercent;
+    }
+    portEXIT_CRITICAL(&lock);
+    return copy;
+  }
+
+  /**
+   * Fill a bus load report (identifier set by the caller):
+   * [type, mac0, mac1, mac2, level, load %, peak %, throttled steps (saturating)]
+   */
+  inline void buildReport(twai_message_t &msg, const uint8_t *macSuffix) {
+    Stats s = stats(true);
+    msg.flags = 0;
+    msg.data_length_code = 8;
+    msg.data[0] = FRAME_TYPE;
+    memcpy(&msg.data[1], macSuffix, 3);
+    msg.data[4] = s.level;
+    msg.data[5] = s.loadPercent;
+    msg.data[6] = s.peakPercent;
+    msg.data[7] = s.throttledFrames > 255 ? 255 : (uint8_t)s.throttledFrames;
+  }
+}
@@ -1,222 +1,291 @@
 #pragma once
 #include "globals.h"
 #include "driver/twai.h"
-#define CAN_RX 13
-#define CAN_TX 15
-#define POLLING_RATE_MS 33
-#define CAN_SEND_MESSAGE_IDENTIFIER 0x18;
-static bool driver_installed = false;
+
+// ============================================================================
+// Bitrate Auto-Detection
+// ============================================================================
+// Set CAN_BITRATE_AUTODETECT here or via platformio.ini build flags:
+//   build_flags = -DCAN_BITRATE_AUTODETECT=0
+//
+// When enabled and no bitrate is stored in NVS, the panel listens on each
+// candidate bitrate in listen-only mode (it never ACKs or sends error frames,
+// so a wrong guess cannot disturb the bus) and locks onto the first one that
+// delivers clean frames. The result is saved in the config store
+// (KEY_CAN_BITRATE, NVS "can"/"bitrate").
+#ifndef CAN_BITRATE_AUTODETECT
+#define CAN_BITRATE_AUTODETECT 1
+#endif
+#define CAN_DEFAULT_BITRATE 500000
+#define BITRATE_PROBE_WINDOW_MS 300      // Max listen time per candidate
+#define BITRATE_PROBE_MIN_FRAMES 3       // Clean frames needed to lock on
+#define BITRATE_PROBE_ROUNDS 3           // Passes over the candidate list while traffic is seen
 
 namespace canHelper
 {
-  void canSetup()
+  // Most likely first: the TrailCurrent default, then J1939 rates
+  static const uint32_t candidateBitrates[] = {500000, 250000, 1000000, 125000};
+  static const int candidateBitrateCount = sizeof(candidateBitrates) / sizeof(candidateBitrates[0]);
+
+  static bool timingForBitrate(uint32_t bitrate, twai_timing_config_t &timing)
   {
-    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)CAN_TX, (gpio_num_t)CAN_RX, TWAI_MODE_NO_ACK);
-    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS(); // Look in the api-reference for other speed sets.
-    twai_filter_config_t f_config = {
-        .acceptance_code = (0x1B << 21),
-        .acceptance_mask = 0x1FFFFFFF,
-        .single_filter = true};
-    // Install TWAI driver
-    if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK)
-    {
-      debugln("Driver installed");
-    }
-    else
+    switch (bitrate)
     {
-      debugln("Failed to install driver");
-      return;
+    case 125000: { twai_timing_config_t t = TWAI_TIMING_CONFIG_125KBITS(); timing = t; return true; }
+    case 250000: { twai_timing_config_t t = TWAI_TIMING_CONFIG_250KBITS(); timing = t; return true; }
+    case 500000: { twai_timing_config_t t = TWAI_TIMING_CONFIG_500KBITS(); timing = t; return true; }
+    case 1000000: { twai_timing_config_t t = TWAI_TIMING_CONFIG_1MBITS(); timing = t; return true; }
     }
+    return false;
+  }
 
-    // Start TWAI driver
-    if (twai_start() == ESP_OK)
+  static bool isCandidateBitrate(uint32_t bitrate)
+  {
+    for (int i = 0; i < candidateBitrateCount; i++)
     {
-      debugln("Driver started");
+      if (candidateBitrates[i] == bitrate)
+      {
+        return true;
+      }
     }
-    else
+    return false;
+  }
+
+  enum ProbeResult
+  {
+    PROBE_LOCKED,                   // Enough clean frames: this is the bitrate
+    PROBE_SILENT,                   // Neither frames nor errors in the window
+    PROBE_FAILED                    // Bus errors, too few frames, or driver trouble
+  };
+
+  /**
+   * Listen on one bitrate in listen-only mode.
+   * Locks once BITRATE_PROBE_MIN_FRAMES frames arrive without a single bus
+   * error. A wrong bitrate normally fails on the first frame seen, so the
+   * full window is only spent on a silent bus.
+   */
+  static ProbeResult probeBitrate(uint32_t bitrate)
+  {
+    twai_timing_config_t t_config;
+    if (!timingForBitrate(bitrate, t_config))
     {
-      debugln("Failed to start driver");
-      return;
+      return PROBE_FAILED;
     }
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)board::CAN_TX_GPIO, (gpio_num_t)board::CAN_RX_GPIO, TWAI_MODE_LISTEN_ONLY);
+    g_config.alerts_enabled = TWAI_ALERT_RX_DATA | TWAI_ALERT_BUS_ERROR;
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
-    // Reconfigure alerts to detect frame receive, Bus-Off error and RX queue full states
-    uint32_t alerts_to_enable = TWAI_ALERT_RX_DATA | TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_ERROR | TWAI_ALERT_RX_QUEUE_FULL;
-    if (twai_reconfigure_alerts(alerts_to_enable, NULL) == ESP_OK)
+    if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK)
     {
-      debugln("CAN Alerts reconfigured");
+      debugln("[CAN] Probe: failed to install driver");
+      return PROBE_FAILED;
     }
-    else
+    if (twai_start() != ESP_OK)
     {
-      debugln("Failed to reconfigure alerts");
-      return;
+      debugln("[CAN] Probe: failed to start driver");
+      twai_driver_uninstall();
+      return PROBE_FAILED;
     }
 
-    // TWAI driver is now successfully installed and started
-    driver_installed = true;
-  }
-
-  static void send_message(int btn)
-  {
-    // Send message
-    int aryLightValues[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-    aryLightValues[btn - 1] = 255;
-    // Configure message to transmit
-    twai_message_t message;
-    message.identifier = CAN_SEND_MESSAGE_IDENTIFIER;
-    message.extd = false; // Using CAN 2.0 extended id allowing up to 536870911 identifiers
-    message.rtr = false;
-    message.data_length_code = 1;
-    message.data[0] = (btn - 1);
-
-    // Queue message for transmission
-    if (twai_transmit(&message, pdMS_TO_TICKS(10)) == ESP_OK)
+    unsigned long start = millis();
+    int frames = 0;
+    int errors = 0;
+    while (errors == 0 && frames < BITRATE_PROBE_MIN_FRAMES)
     {
-      debugln("Message queued for transmission");
+      unsigned long elapsed = millis() - start;
+      if (elapsed >= BITRATE_PROBE_WINDOW_MS)
+      {
+        break;
+      }
+
+      uint32_t alerts_triggered = 0;
+      if (twai_read_alerts(&alerts_triggered, pdMS_TO_TICKS(BITRATE_PROBE_WINDOW_MS - elapsed)) != ESP_OK)
+      {
+        continue;
+      }
+      if (alerts_triggered & TWAI_ALERT_BUS_ERROR)
+      {
+        errors++;
+      }
+      if (alerts_triggered & TWAI_ALERT_RX_DATA)
+      {
+        twai_message_t message;
+        while (twai_receive(&message, 0) == ESP_OK)
+        {
+          frames++;
+        }
+      }
     }
-    else
+
+    twai_stop();
+    twai_driver_uninstall();
+
+    debugf("[CAN] Probe %lu bps: %d frames, %d errors in %lu ms\n",
+           (unsigned long)bitrate, frames, errors, millis() - start);
+    if (errors == 0 && frames >= BITRATE_PROBE_MIN_FRAMES)
     {
-      debugln("Failed to queue message for transmission");
+      return PROBE_LOCKED;
     }
+    return (errors == 0 && frames == 0) ? PROBE_SILENT : PROBE_FAILED;
   }
 
-  static void handle_rx_message(twai_message_t &message)
+  /**
+   * Cycle through the candidate bitrates until one yields clean frames.
+   * Returns the detected bitrate, or 0 if the bus stayed silent or noisy.
+   * Further rounds only help when something was heard without locking on
+   * (sparse traffic, a burst of errors); a pass on which every candidate
+   * was silent ends the probe, so a quiet bus costs one pass
+   * (candidateBitrateCount x BITRATE_PROBE_WINDOW_MS, 1.2s) instead of
+   * BITRATE_PROBE_ROUNDS of them.
+   */
+  inline uint32_t detectBitrate()
   {
-    // Process received message
-    if (message.extd)
-    {
-      debugln("Message is in Extended Format");
-    }
-    else
-    {
-      debugln("Message is in Standard Format");
-    }
-    debugf("ID: %lx\nByte:", message.identifier);
-    if (message.identifier == 27)
+    for (int round = 0; round < BITRATE_PROBE_ROUNDS; round++)
     {
-      if (!(message.rtr))
+      bool heard = false;
+      for (int i = 0; i < candidateBitrateCount; i++)
       {
-        if (message.data[0] == 00)
+        ProbeResult result = probeBitrate(candidateBitrates[i]);
+        if (result == PROBE_LOCKED)
         {
-          digitalWrite(LED1_PIN, LOW);
+          return candidateBitrates[i];
         }
-        else
+        if (result != PROBE_SILENT)
         {
-          digitalWrite(LED1_PIN, HIGH);
+          heard = true;
         }
+      }
+      if (!heard)
+      {
+        debugln("[CAN] Probe: bus silent on every candidate");
+        break;
+      }
+    }
+    return 0;
+  }
 
-        if (message.data[1] == 00)
-        {
-          digitalWrite(LED2_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED2_PIN, HIGH);
-        }
+  /**
+   * Pick the bitrate to run at: stored (the config store's KEY_CAN_BITRATE)
+   * if it is a candidate, or a freshly detected one when nothing is stored
+   * (or forceProbe is set). detected is set when the result came from the
+   * probe and should be persisted; the default is not, so the next boot
+   * probes again.
+   */
+  inline uint32_t selectBitrate(uint32_t stored, bool forceProbe, bool &detected)
+  {
+    detected = false;
+    if (!forceProbe && isCandidateBitrate(stored))
+    {
+      debugf("[CAN] Using stored bitrate %lu bps\n", (unsigned long)stored);
+      return stored;
+    }
 
-        if (message.data[2] == 00)
-        {
-          digitalWrite(LED3_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED3_PIN, HIGH);
-        }
+#if CAN_BITRATE_AUTODETECT
+    debugln("[CAN] Detecting bitrate (listen-only)...");
+    unsigned long start = millis();
+    uint32_t bitrate = detectBitrate();
+    if (bitrate != 0)
+    {
+      detected = true;
+      debugf("[CAN] Detected %lu bps in %lu ms\n", (unsigned long)bitrate, millis() - start);
+      return bitrate;
+    }
+    debugf("[CAN] No clean traffic after %lu ms - falling back to default\n", millis() - start);
+    (void)start;                      // Only read by the debug output
+#endif
 
-        if (message.data[3] == 00)
-        {
-          digitalWrite(LED4_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED4_PIN, HIGH);
-        }
+    return CAN_DEFAULT_BITRATE;
+  }
 
-        if (message.data[4] == 00)
-        {
-          digitalWrite(LED5_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED5_PIN, HIGH);
-        }
+  // ==========================================================================
+  // Received frames
+  // ==========================================================================
+  // The TwaiTaskBased library receives in its own task and calls the panel's
+  // RX callback once per frame, so there is no polling loop. Handlers get a
+  // FrameView: the legacy 11-bit identifier plus pointers into the frame the
+  // library delivered. Its fields are named like twai_message_t's, and in
+  // J1939 mode the translated identifier lives only in the view, so the
+  // frame is never copied.
 
-        if (message.data[5] == 00)
-        {
-          digitalWrite(LED6_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED6_PIN, HIGH);
-        }
+  struct FrameView
+  {
+    uint32_t identifier;            // Legacy identifier (translated in J1939 mode)
+    uint8_t data_length_code;
+    const uint8_t *data;            // The delivered frame's payload
+  };
 
-        if (message.data[6] == 00)
-        {
-          digitalWrite(LED7_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED7_PIN, HIGH);
-        }
+  inline FrameView viewOf(const twai_message_t &msg)
+  {
+    FrameView view = {msg.identifier, msg.data_length_code, msg.data};
+    return view;
+  }
 
-        if (message.data[7] == 00)
-        {
-          digitalWrite(LED8_PIN, LOW);
-        }
-        else
-        {
-          digitalWrite(LED8_PIN, HIGH);
-        }
+  // ==========================================================================
+  // Controller status
+  // ==========================================================================
+  // The library owns the driver and its alerts; reading alerts here as well
+  // would take them away from it. Controller health is read with
+  // twai_get_status_info() instead, once per bus load window
+  // (busLoad::update() on the loop task), and changes are logged as the
+  // alerts used to be.
 
-        for (int i = 0; i < message.data_length_code; i++)
-        {
-          debugg(" %d = %02x,", i, message.data[i]);
-        }
-        debugln("");
-      }
+  static twai_status_info_t lastStatus = {};
+
+  inline const char *stateName(twai_state_t state)
+  {
+    switch (state)
+    {
+    case TWAI_STATE_STOPPED: return "stopped";
+    case TWAI_STATE_RUNNING: return "running";
+    case TWAI_STATE_BUS_OFF: return "bus-off";
+    case TWAI_STATE_RECOVERING: return "recovering";
     }
+    return "unknown";
   }
 
-  void canLoop()
+  /**
+   * Read the controller status and log what changed since the last read:
+   * state, error passive, bus errors and frames lost to a full RX queue
+   */
+  inline bool readStatus(twai_status_info_t &status)
   {
-    if (!driver_installed)
+    if (twai_get_status_info(&status) != ESP_OK)
     {
-      // Driver not installed
-      delay(1000);
-      return;
+      return false;
     }
-    // Check if alert happened
-    uint32_t alerts_triggered;
-    twai_read_alerts(&alerts_triggered, pdMS_TO_TICKS(POLLING_RATE_MS));
-    twai_status_info_t twaistatus;
-    twai_get_status_info(&twaistatus);
-
-    // Handle alerts
-    if (alerts_triggered & TWAI_ALERT_ERR_PASS)
+    if (status.state != lastStatus.state)
     {
-      debugln("Alert: TWAI controller has become error passive.");
+      debugf("[CAN] Controller %s\n", stateName(status.state));
     }
-    if (alerts_triggered & TWAI_ALERT_BUS_ERROR)
+    bool passive = status.tx_error_counter >= 128 || status.rx_error_counter >= 128;
+    bool wasPassive = lastStatus.tx_error_counter >= 128 || lastStatus.rx_error_counter >= 128;
+    if (passive != wasPassive)
     {
-      debugln("Alert: A (Bit, Stuff, CRC, Form, ACK) error has occurred on the bus.");
-      debugf("Bus error count: %lu\n", twaistatus.bus_error_count);
+      debugf("[CAN] Controller %s error passive (TEC %lu, REC %lu)\n", passive ? "became" : "left",
+             (unsigned long)status.tx_error_counter, (unsigned long)status.rx_error_counter);
     }
-    if (alerts_triggered & TWAI_ALERT_RX_QUEUE_FULL)
+    if (status.bus_error_count != lastStatus.bus_error_count)
     {
-      debugln("Alert: The RX queue is full causing a received frame to be lost.");
-      debugf("RX buffered: %lu\t", twaistatus.msgs_to_rx);
-      debugf("RX missed: %lu\t", twaistatus.rx_missed_count);
-      debugf("RX overrun %lu\n", twaistatus.rx_overrun_count);
+      debugf("[CAN] %lu bus errors (bit, stuff, CRC, form, ACK), %lu total\n",
+             (unsigned long)(status.bus_error_count - lastStatus.bus_error_count),
+             (unsigned long)status.bus_error_count);
     }
-
-    // Check if message is received
-    if (alerts_triggered & TWAI_ALERT_RX_DATA)
+    if (status.rx_missed_count != lastStatus.rx_missed_count ||
+        status.rx_overrun_count != lastStatus.rx_overrun_count)
     {
-      // One or more messages received. Handle all.
-      twai_message_t message;
-      while (twai_receive(&message, 0) == ESP_OK)
-      {
-        handle_rx_message(message);
-      }
+      debugf("[CAN] RX queue full: %lu missed, %lu overrun in total\n",
+             (unsigned long)status.rx_missed_count, (unsigned long)status.rx_overrun_count);
     }
+    lastStatus = status;
+    return true;
+  }
+
+  /**
+   * True while the last status read found the controller bus-off or
+   * recovering from it
+   */
+  inline bool busOff()
+  {
+    return lastStatus.state == TWAI_STATE_BUS_OFF || lastStatus.state == TWAI_STATE_RECOVERING;
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,564 @@
+#pragma once
+#include "globals.h"
+#include <stddef.h>
+#include "nvs.h"
+#include "scheduler.h"
+#include "canHelper.h"
+#include "idleSleep.h"
+#include "busLoad.h"
+#include "watchdog.h"
+
+// ============================================================================
+// Runtime Configuration Store
+// ============================================================================
+// All tunables live in one RAM mirror that is loaded from NVS once at boot.
+// Writes (CAN RX task) and reads (any task) hold a spinlock: get() returns a
+// copy, so a reader never sees a half-written string or ID set. Writes update
+// RAM immediately, mark the key dirty and are flushed to NVS in one batch
+// (one nvs_commit per namespace) by a scheduler timer once no further change
+// has arrived for CONFIG_COMMIT_DELAY_MS.
+// Writing a value that equals the current one is a no-op, so repeated
+// configuration frames cost no flash wear.
+//
+// Remote updates use CAN ID 0x02 (see handleConfigMessage() in main.cpp):
+//   data[0..2]: last three MAC bytes of the target panel (FF FF FF = all)
+//   data[3]:    key (ConfigKey)
+//   data[4..7]: value, little-endian
+#define CONFIG_COMMIT_DELAY_MS 2000
+
+namespace config {
+
+  const uint8_t NUM_BUTTONS = 8;
+  const uint8_t MAX_PAGES = 4;          // Up to 32 devices per panel
+  const uint8_t MAX_SCENES = 4;
+  const uint8_t MAX_SCENE_STEPS = 12;
+
+  // buttonDevice values with this bit set fire scene (value & 0x7F)
+  const uint8_t BUTTON_SCENE_FLAG = 0x80;
+
+  // One scene step, packed into two bytes exactly as it goes on the wire:
+  //   op:    action in bits 7-6, device index (0-63) in bits 5-0; 0xFF = unused
+  //   value: brightness for SCENE_BRIGHTNESS, ignored otherwise
+  enum SceneAction : uint8_t {
+    SCENE_OFF = 0,
+    SCENE_ON = 1,
+    SCENE_BRIGHTNESS = 2
+  };
+  const uint8_t SCENE_STEP_UNUSED = 0xFF;
+  const uint8_t NO_SCENE = 0xFF;
+
+  struct SceneStep {
+    uint8_t op;
+    uint8_t value;
+  };
+
+  inline uint8_t sceneOp(SceneAction action, uint8_t device) {
+    return (uint8_t)((action << 6) | (device & 0x3F));
+  }
+
+  struct PanelConfig {
+    uint16_t debounceMs;              // Press must last this long before a toggle is sent
+    uint16_t holdThresholdMs;         // Hold time that enters brightness mode
+    uint16_t brightnessIncrementMs;   // Interval between brightness steps while held
+    uint8_t buttonDevice[NUM_BUTTONS];// Device slot (0-7) within the active page for each button
+    uint16_t canIdOtaTrigger;
+    uint16_t canIdWifiConfig;
+    uint16_t canIdBrightness;
+    uint16_t canIdButton;
+    uint16_t canIdLedState;           // Page P listens on canIdLedState + P
+    uint32_t canBitrate;              // 0 = not detected yet
+    char wifiSsid[33];
+    char wifiPassword[64];
+    uint16_t pageCount;               // Device pages (1 = single page of 8)
+    SceneStep scenes[MAX_SCENES][MAX_SCENE_STEPS];
+    uint16_t canIdScene;
+    uint8_t doubleTapScene[NUM_BUTTONS];  // Scene fired by a double-tap, NO_SCENE = none
+    uint16_t doubleTapWindowMs;       // Max release-to-press gap of a double-tap
+    uint16_t chordWindowMs;           // Max spread between the presses of a chord
+    uint16_t timeSyncMaster;          // 1 = this panel sends the time sync beacon
+    uint16_t idleSleepMs;             // Quiet time before light sleep, 0 = never sleep
+    uint16_t serialBridge;            // 1 = serial port is an SLCAN adapter, 0 = debug console
+    uint16_t busLoadLimit;            // Bus load (%) above which low-priority TX is throttled, 0 = never
+    uint16_t scanSlaMs;               // Longest gap between button scans, 0 = not checked
+    uint16_t rxSlaMs;                 // Longest CAN RX callback, 0 = not checked
+  };
+
+  // Key numbers are part of the CAN protocol - append only
+  enum ConfigKey : uint8_t {
+    KEY_DEBOUNCE_MS = 0,
+    KEY_HOLD_THRESHOLD_MS,
+    KEY_BRIGHTNESS_INCREMENT_MS,
+    KEY_BUTTON_DEVICE,                // value: [button index, device index]
+    KEY_CAN_ID_OTA_TRIGGER,
+    KEY_CAN_ID_WIFI_CONFIG,
+    KEY_CAN_ID_BRIGHTNESS,
+    KEY_CAN_ID_BUTTON,
+    KEY_CAN_ID_LED_STATE,
+    KEY_CAN_BITRATE,
+    KEY_WIFI_SSID,                    // Set by the WiFi credential protocol only
+    KEY_WIFI_PASSWORD,                // Set by the WiFi credential protocol only
+    KEY_PAGE_COUNT,
+    KEY_SCENE_STEP,                   // value: [scene, step, op, value]
+    KEY_CAN_ID_SCENE,
+    KEY_DOUBLE_TAP_SCENE,             // value: [button index, scene or 0xFF]
+    KEY_DOUBLE_TAP_WINDOW_MS,
+    KEY_CHORD_WINDOW_MS,
+    KEY_TIME_SYNC_MASTER,
+    KEY_IDLE_SLEEP_MS,
+    KEY_SERIAL_BRIDGE,
+    KEY_BUS_LOAD_LIMIT,
+    KEY_SCAN_SLA_MS,
+    KEY_RX_SLA_MS,
+    KEY_COUNT
+  };
+
+  enum EntryType : uint8_t { TYPE_U16, TYPE_U32, TYPE_BLOB, TYPE_STR };
+
+  struct Entry {
+    const char *nvsNamespace;
+    const char *nvsKey;
+    EntryType type;
+    uint16_t offset;
+    uint16_t size;
+  };
+
+  // WiFi credentials and the bitrate keep the namespaces and keys they had
+  // before the store existed, so existing panels keep their settings.
+  static const Entry entries[KEY_COUNT] = {
+    {"config", "debounce",  TYPE_U16,  offsetof(PanelConfig, debounceMs),            sizeof(uint16_t)},
+    {"config", "hold",      TYPE_U16,  offsetof(PanelConfig, holdThresholdMs),       sizeof(uint16_t)},
+    {"config", "brightInc", TYPE_U16,  offsetof(PanelConfig, brightnessIncrementMs), sizeof(uint16_t)},
+    {"config", "btnDevice", TYPE_BLOB, offsetof(PanelConfig, buttonDevice),          NUM_BUTTONS},
+    {"config", "idOta",     TYPE_U16,  offsetof(PanelConfig, canIdOtaTrigger),       sizeof(uint16_t)},
+    {"config", "idWifi",    TYPE_U16,  offsetof(PanelConfig, canIdWifiConfig),       sizeof(uint16_t)},
+    {"config", "idBright",  TYPE_U16,  offsetof(PanelConfig, canIdBrightness),       sizeof(uint16_t)},
+    {"config", "idButton",  TYPE_U16,  offsetof(PanelConfig, canIdButton),           sizeof(uint16_t)},
+    {"config", "idLed",     TYPE_U16,  offsetof(PanelConfig, canIdLedState),         sizeof(uint16_t)},
+    {"can",    "bitrate",   TYPE_U32,  offsetof(PanelConfig, canBitrate),            sizeof(uint32_t)},
+    {"wifi",   "ssid",      TYPE_STR,  offsetof(PanelConfig, wifiSsid),              sizeof(PanelConfig::wifiSsid)},
+    {"wifi",   "password",  TYPE_STR,  offsetof(PanelConfig, wifiPassword),          sizeof(PanelConfig::wifiPassword)},
+    {"config", "pages",     TYPE_U16,  offsetof(PanelConfig, pageCount),             sizeof(uint16_t)},
+    {"config", "scenes",    TYPE_BLOB, offsetof(PanelConfig, scenes),                sizeof(PanelConfig::scenes)},
+    {"config", "idScene",   TYPE_U16,  offsetof(PanelConfig, canIdScene),            sizeof(uint16_t)},
+    {"config", "dblTapScn", TYPE_BLOB, offsetof(PanelConfig, doubleTapScene),        NUM_BUTTONS},
+    {"config", "dblTapWin", TYPE_U16,  offsetof(PanelConfig, doubleTapWindowMs),     sizeof(uint16_t)},
+    {"config", "chordWin",  TYPE_U16,  offsetof(PanelConfig, chordWindowMs),         sizeof(uint16_t)},
+    {"config", "timeMaster",TYPE_U16,  offsetof(PanelConfig, timeSyncMaster),        sizeof(uint16_t)},
+    {"config", "idleSleep", TYPE_U16,  offsetof(PanelConfig, idleSleepMs),           sizeof(uint16_t)},
+    {"config", "serialMode",TYPE_U16,  offsetof(PanelConfig, serialBridge),          sizeof(uint16_t)},
+    {"config", "busLoad",   TYPE_U16,  offsetof(PanelConfig, busLoadLimit),          sizeof(uint16_t)},
+    {"config", "scanSla",   TYPE_U16,  offsetof(PanelConfig, scanSlaMs),             sizeof(uint16_t)},
+    {"config", "rxSla",     TYPE_U16,  offsetof(PanelConfig, rxSlaMs),               sizeof(uint16_t)},
+  };
+
+  // Fixed protocol IDs for remote configuration and diagnostics frames
+  const uint16_t CAN_ID_CONFIG = 0x02;
+  const uint16_t CAN_ID_DIAG_REQUEST = 0x03;
+  const uint16_t CAN_ID_DIAG = 0x1F;
+  const uint16_t CAN_ID_BULK = 0x20;
+  const uint16_t CAN_ID_TIME_SYNC = 0x21;
+  static const uint16_t FIXED_CAN_IDS[] = {CAN_ID_CONFIG, CAN_ID_DIAG_REQUEST, CAN_ID_DIAG, CAN_ID_BULK, CAN_ID_TIME_SYNC};
+
+  // Highest configurable CAN ID. J1939 builds carry the legacy ID in the
+  // one-byte group extension of the Proprietary B PGN (see j1939.h).
+#if defined(J1939_MODE) && J1939_MODE
+  const uint16_t MAX_CAN_ID = 0xFF;
+#else
+  const uint16_t MAX_CAN_ID = 0x7FF;
+#endif
+
+  // Keys holding a configurable CAN ID. The LED state key covers MAX_PAGES
+  // IDs, one per possible page, so a page count change cannot create overlaps.
+  static const ConfigKey CAN_ID_KEYS[] = {
+    KEY_CAN_ID_OTA_TRIGGER, KEY_CAN_ID_WIFI_CONFIG, KEY_CAN_ID_BRIGHTNESS,
+    KEY_CAN_ID_BUTTON, KEY_CAN_ID_LED_STATE, KEY_CAN_ID_SCENE
+  };
+  const uint8_t CAN_ID_KEY_COUNT = sizeof(CAN_ID_KEYS) / sizeof(CAN_ID_KEYS[0]);
+
+  static PanelConfig current;
+  static uint32_t dirtyKeys = 0;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  static void applyDefaults(PanelConfig &cfg) {
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.debounceMs = 200;
+    cfg.holdThresholdMs = 700;
+    cfg.brightnessIncrementMs = 100;
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      cfg.buttonDevice[i] = i;
+    }
+    cfg.canIdOtaTrigger = 0x00;
+    cfg.canIdWifiConfig = 0x01;
+    cfg.canIdBrightness = 0x15;
+    cfg.canIdButton = 0x18;
+    cfg.canIdLedState = 0x1B;
+    cfg.canBitrate = 0;
+    cfg.pageCount = 1;
+    memset(cfg.scenes, SCENE_STEP_UNUSED, sizeof(cfg.scenes));
+    cfg.canIdScene = 0x16;
+    memset(cfg.doubleTapScene, NO_SCENE, sizeof(cfg.doubleTapScene));
+    cfg.doubleTapWindowMs = 300;
+    cfg.chordWindowMs = 300;
+    cfg.timeSyncMaster = 0;
+    cfg.idleSleepMs = 0;
+    cfg.serialBridge = 0;
+    cfg.busLoadLimit = 60;
+    cfg.scanSlaMs = 50;
+    cfg.rxSlaMs = 20;
+  }
+
+  static uint8_t *fieldOf(PanelConfig &cfg, ConfigKey key) {
+    return (uint8_t *)&cfg + entries[key].offset;
+  }
+
+  static void restoreDefault(PanelConfig &cfg, PanelConfig &defaults, ConfigKey key) {
+    memcpy(fieldOf(cfg, key), fieldOf(defaults, key), entries[key].size);
+  }
+
+  // --------------------------------------------------------------------------
+  // Value checks: isValid() runs in set() for every update and in load(), so
+  // a value refused over CAN is also refused from NVS
+  // --------------------------------------------------------------------------
+
+  /**
+   * A press must be debounced before it can become a hold
+   */
+  inline bool isValidPressTiming(uint16_t debounceMs, uint16_t holdThresholdMs) {
+    return debounceMs > 0 && holdThresholdMs > debounceMs;
+  }
+
+  static uint16_t canIdOf(const PanelConfig &cfg, ConfigKey key) {
+    uint16_t id;
+    memcpy(&id, (const uint8_t *)&cfg + entries[key].offset, sizeof(id));
+    return id;
+  }
+
+  inline bool isCanIdKey(ConfigKey key) {
+    for (uint8_t i = 0; i < CAN_ID_KEY_COUNT; i++) {
+      if (CAN_ID_KEYS[i] == key) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline uint16_t canIdSpan(ConfigKey key) {
+    return key == KEY_CAN_ID_LED_STATE ? MAX_PAGES : 1;
+  }
+
+  /**
+   * True if id may be used for the CAN ID key in cfg: within MAX_CAN_ID,
+   * clear of the fixed protocol IDs and of every other configurable ID
+   */
+  inline bool isValidCanId(const PanelConfig &cfg, ConfigKey key, uint16_t id) {
+    uint16_t last = id + canIdSpan(key) - 1;
+    if (last > MAX_CAN_ID) {
+      return false;
+    }
+    for (uint8_t i = 0; i < sizeof(FIXED_CAN_IDS) / sizeof(FIXED_CAN_IDS[0]); i++) {
+      if (FIXED_CAN_IDS[i] >= id && FIXED_CAN_IDS[i] <= last) {
+        return false;
+      }
+    }
+    for (uint8_t i = 0; i < CAN_ID_KEY_COUNT; i++) {
+      ConfigKey other = CAN_ID_KEYS[i];
+      if (other == key) {
+        continue;
+      }
+      uint16_t otherFirst = canIdOf(cfg, other);
+      uint16_t otherLast = otherFirst + canIdSpan(other) - 1;
+      if (id <= otherLast && otherFirst <= last) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * True for an 11-bit ID the panel sends or handles: the fixed protocol IDs
+   * and the configured ones (LED state: one per active page). These are also
+   * the IDs that have a Proprietary B mapping in J1939 builds.
+   */
+  inline bool isPanelId(const PanelConfig &cfg, uint16_t id) {
+    for (uint8_t i = 0; i < sizeof(FIXED_CAN_IDS) / sizeof(FIXED_CAN_IDS[0]); i++) {
+      if (FIXED_CAN_IDS[i] == id) {
+        return true;
+      }
+    }
+    return id == cfg.canIdOtaTrigger || id == cfg.canIdWifiConfig ||
+           id == cfg.canIdBrightness || id == cfg.canIdButton || id == cfg.canIdScene ||
+           (id >= cfg.canIdLedState && id < cfg.canIdLedState + cfg.pageCount);
+  }
+
+  /**
+   * A button maps to a device slot (0-7) or to a scene (BUTTON_SCENE_FLAG | n)
+   */
+  inline bool isValidButtonDevice(uint8_t value) {
+    if (value & BUTTON_SCENE_FLAG) {
+      return (value & ~BUTTON_SCENE_FLAG) < MAX_SCENES;
+    }
+    return value < NUM_BUTTONS;
+  }
+
+  /**
+   * True if the value of key in cfg is acceptable, given the other keys it
+   * depends on. set() refuses a value that fails, load() replaces it with
+   * the default.
+   */
+  inline bool isValid(const PanelConfig &cfg, ConfigKey key) {
+    switch (key) {
+      case KEY_DEBOUNCE_MS:
+      case KEY_HOLD_THRESHOLD_MS:
+        return isValidPressTiming(cfg.debounceMs, cfg.holdThresholdMs);
+      case KEY_BRIGHTNESS_INCREMENT_MS:
+        return cfg.brightnessIncrementMs != 0;   // A zero step would re-fire at once
+      case KEY_DOUBLE_TAP_WINDOW_MS:
+        return cfg.doubleTapWindowMs != 0;
+      case KEY_CHORD_WINDOW_MS:
+        return cfg.chordWindowMs != 0;
+      case KEY_BUTTON_DEVICE:
+        for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+          if (!isValidButtonDevice(cfg.buttonDevice[i])) {
+            return false;
+          }
+        }
+        return true;
+      case KEY_DOUBLE_TAP_SCENE:
+        for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+          if (cfg.doubleTapScene[i] >= MAX_SCENES && cfg.doubleTapScene[i] != NO_SCENE) {
+            return false;
+          }
+        }
+        return true;
+      case KEY_CAN_ID_OTA_TRIGGER:
+      case KEY_CAN_ID_WIFI_CONFIG:
+      case KEY_CAN_ID_BRIGHTNESS:
+      case KEY_CAN_ID_BUTTON:
+      case KEY_CAN_ID_LED_STATE:
+      case KEY_CAN_ID_SCENE:
+        return isValidCanId(cfg, key, canIdOf(cfg, key));
+      case KEY_CAN_BITRATE:
+        return cfg.canBitrate == 0 || canHelper::isCandidateBitrate(cfg.canBitrate);
+      case KEY_WIFI_SSID:
+        return memchr(cfg.wifiSsid, '\0', sizeof(cfg.wifiSsid)) != NULL;
+      case KEY_WIFI_PASSWORD:
+        return memchr(cfg.wifiPassword, '\0', sizeof(cfg.wifiPassword)) != NULL;
+      case KEY_PAGE_COUNT:
+        return cfg.pageCount >= 1 && cfg.pageCount <= MAX_PAGES;   // Indexes the LED cache
+      case KEY_SCENE_STEP:
+        return true;                          // Unknown actions are skipped when played
+      case KEY_TIME_SYNC_MASTER:
+        return cfg.timeSyncMaster <= 1;
+      case KEY_IDLE_SLEEP_MS:
+        return cfg.idleSleepMs == 0 || cfg.idleSleepMs >= idleSleep::MIN_QUIET_MS;
+      case KEY_SERIAL_BRIDGE:
+        return cfg.serialBridge <= 1;
+      case KEY_BUS_LOAD_LIMIT:
+        return cfg.busLoadLimit <= busLoad::MAX_LIMIT_PERCENT;
+      case KEY_SCAN_SLA_MS:
+        return cfg.scanSlaMs <= watchdog::MAX_SLA_MS &&
+               (cfg.scanSlaMs == 0 || cfg.scanSlaMs >= watchdog::MIN_SCAN_SLA_MS);
+      case KEY_RX_SLA_MS:
+        return cfg.rxSlaMs <= watchdog::MAX_SLA_MS;
+      default:
+        return false;
+    }
+  }
+
+  /**
+   * Consistent snapshot of the RAM mirror (about 250 bytes). Take it once
+   * per handler and read the fields from the copy.
+   */
+  inline PanelConfig get() {
+    PanelConfig copy;
+    portENTER_CRITICAL(&lock);
+    memcpy(&copy, &current, sizeof(copy));
+    portEXIT_CRITICAL(&lock);
+    return copy;
+  }
+
+  /**
+   * Load every key from NVS into RAM. Missing keys keep their defaults.
+   * Call once in setup() before anything reads the configuration.
+   */
+  inline void load() {
+    applyDefaults(current);
+
+    for (uint8_t k = 0; k < KEY_COUNT; k++) {
+      const Entry &e = entries[k];
+      nvs_handle_t handle;
+      if (nvs_open(e.nvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+        continue;   // Namespace never written
+      }
+
+      uint8_t *field = fieldOf(current, (ConfigKey)k);
+      size_t len = e.size;
+      switch (e.type) {
+        case TYPE_U16: nvs_get_u16(handle, e.nvsKey, (uint16_t *)field); break;
+        case TYPE_U32: nvs_get_u32(handle, e.nvsKey, (uint32_t *)field); break;
+        case TYPE_BLOB: nvs_get_blob(handle, e.nvsKey, field, &len); break;
+        case TYPE_STR:
+          if (nvs_get_str(handle, e.nvsKey, (char *)field, &len) != ESP_OK) {
+            field[0] = '\0';
+          }
+          break;
+      }
+      nvs_close(handle);
+    }
+
+    // A stored value that fails its check falls back to the default. The
+    // CAN IDs fall back as a set: the defaults never collide, a mix of stored
+    // and default IDs might.
+    PanelConfig defaults;
+    applyDefaults(defaults);
+    for (uint8_t k = 0; k < KEY_COUNT; k++) {
+      ConfigKey key = (ConfigKey)k;
+      if (isValid(current, key)) {
+        continue;
+      }
+      debugf("[CFG] Stored key %d invalid - using the default\n", key);
+      if (isCanIdKey(key)) {
+        for (uint8_t i = 0; i < CAN_ID_KEY_COUNT; i++) {
+          restoreDefault(current, defaults, CAN_ID_KEYS[i]);
+        }
+      } else if (key == KEY_DEBOUNCE_MS || key == KEY_HOLD_THRESHOLD_MS) {
+        restoreDefault(current, defaults, KEY_DEBOUNCE_MS);
+        restoreDefault(current, defaults, KEY_HOLD_THRESHOLD_MS);
+      } else {
+        restoreDefault(current, defaults, key);
+      }
+    }
+
+    debugf("[CFG] Loaded: debounce=%u hold=%u brightInc=%u bitrate=%lu\n",
+           current.debounceMs, current.holdThresholdMs, current.brightnessIncrementMs,
+           (unsigned long)current.canBitrate);
+  }
+
+  void commit();
+
+  /**
+   * Write len bytes at byteOffset within a key's field, if the result passes
+   * isValid(). Returns true if the stored value changed (and an NVS write
+   * is pending).
+   */
+  inline bool set(ConfigKey key, const void *value, size_t len, size_t byteOffset = 0) {
+    if (key >= KEY_COUNT || byteOffset + len > entries[key].size) {
+      return false;
+    }
+
+    bool changed = false;
+    bool valid = true;
+    portENTER_CRITICAL(&lock);
+    uint8_t *field = fieldOf(current, key) + byteOffset;
+    if (memcmp(field, value, len) != 0) {
+      PanelConfig candidate;
+      memcpy(&candidate, &current, sizeof(candidate));
+      memcpy(fieldOf(candidate, key) + byteOffset, value, len);
+      valid = isValid(candidate, key);
+      if (valid) {
+        memcpy(field, value, len);
+        dirtyKeys |= (1UL << key);
+        changed = true;
+      }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (!valid) {
+      debugf("[CFG] Key %d: value refused\n", key);
+    }
+
+    // Every change pushes the commit back, so a burst becomes one flash write
+    if (changed) {
+      scheduler::schedule(scheduler::TIMER_CONFIG_COMMIT, CONFIG_COMMIT_DELAY_MS, commit);
+    }
+    return changed;
+  }
+
+  inline bool setU16(ConfigKey key, uint16_t value) { return set(key, &value, sizeof(value)); }
+  inline bool setU32(ConfigKey key, uint32_t value) { return set(key, &value, sizeof(value)); }
+
+  /**
+   * Store a NUL-terminated string. Longer values are rejected, not truncated.
+   */
+  inline bool setString(ConfigKey key, const char *value) {
+    size_t len = strlen(value) + 1;
+    if (entries[key].type != TYPE_STR || len > entries[key].size) {
+      return false;
+    }
+    return set(key, value, len);
+  }
+
+  /**
+   * Flush all dirty keys to NVS now: one open/commit/close per namespace.
+   * Keys that fail to write stay dirty and are retried after
+   * CONFIG_COMMIT_DELAY_MS.
+   */
+  inline void commit() {
+    PanelConfig snapshot;
+    uint32_t pending;
+    portENTER_CRITICAL(&lock);
+    pending = dirtyKeys;
+    dirtyKeys = 0;
+    memcpy(&snapshot, &current, sizeof(snapshot));
+    portEXIT_CRITICAL(&lock);
+
+    uint32_t failed = 0;
+    while (pending) {
+      const char *ns = entries[__builtin_ctz(pending)].nvsNamespace;
+      uint32_t inNamespace = 0;
+      for (uint8_t k = 0; k < KEY_COUNT; k++) {
+        if ((pending & (1UL << k)) && strcmp(entries[k].nvsNamespace, ns) == 0) {
+          inNamespace |= (1UL << k);
+        }
+      }
+      pending &= ~inNamespace;
+
+      nvs_handle_t handle;
+      if (nvs_open(ns, NVS_READWRITE, &handle) != ESP_OK) {
+        debugf("[CFG] ERROR: cannot open NVS namespace %s\n", ns);
+        failed |= inNamespace;
+        continue;
+      }
+
+      uint32_t written = 0;
+      for (uint8_t k = 0; k < KEY_COUNT; k++) {
+        if (!(inNamespace & (1UL << k))) {
+          continue;
+        }
+        const Entry &e = entries[k];
+        const uint8_t *field = fieldOf(snapshot, (ConfigKey)k);
+        esp_err_t err = ESP_FAIL;
+        switch (e.type) {
+          case TYPE_U16: err = nvs_set_u16(handle, e.nvsKey, *(const uint16_t *)field); break;
+          case TYPE_U32: err = nvs_set_u32(handle, e.nvsKey, *(const uint32_t *)field); break;
+          case TYPE_BLOB: err = nvs_set_blob(handle, e.nvsKey, field, e.size); break;
+          case TYPE_STR: err = nvs_set_str(handle, e.nvsKey, (const char *)field); break;
+        }
+        if (err == ESP_OK) {
+          written |= (1UL << k);
+        } else {
+          debugf("[CFG] ERROR: cannot write key %s: %d\n", e.nvsKey, err);
+          failed |= (1UL << k);
+        }
+      }
+
+      if (nvs_commit(handle) != ESP_OK) {
+        debugf("[CFG] ERROR: commit failed in NVS namespace %s\n", ns);
+        failed |= written;
+        written = 0;
+      }
+      nvs_close(handle);
+      if (written != 0) {
+        debugf("[CFG] Committed %d key(s) to NVS namespace %s\n", __builtin_popcount(written), ns);
+      }
+    }
+
+    if (failed != 0) {
+      // Keys changed again since the snapshot are dirty already; re-mark the rest
+      portENTER_CRITICAL(&lock);
+      dirtyKeys |= failed;
+      portEXIT_CRITICAL(&lock);
+      scheduler::schedule(scheduler::TIMER_CONFIG_COMMIT, CONFIG_COMMIT_DELAY_MS, commit);
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "globals.h"
+#include "esp_partition.h"
+
+// ============================================================================
+// Core Dump Retrieval
+// ============================================================================
+// After a crash the panic handler writes a core dump to the "coredump"
+// partition. At boot we check for one, advertise it on the diagnostics ID,
+// and hand it to the bulk transport on request. The dump is erased only
+// after the host has acknowledged the complete transfer.
+//
+// Only the dump header is checked here (total length in the first word, as
+// written by the ESP-IDF flash core dump). The host verifies the checksum
+// when decoding it with espcoredump.py.
+
+namespace coredump {
+
+  const uint8_t FRAME_TYPE = 0x03;                // Diagnostic frame type: core dump available
+  const uint32_t ADVERTISE_INTERVAL_MS = 60000;   // Repeat until fetched
+  const uint32_t HEADER_SECTOR = 4096;
+
+  static const esp_partition_t *partition = NULL;
+  static uint32_t imageSize = 0;                  // 0 = no dump stored
+
+  /**
+   * Find the partition and check for a stored dump. Returns true if one exists.
+   */
+  inline bool begin() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+    if (partition == NULL) {
+      debugln("[CORE] No coredump partition");
+      return false;
+    }
+
+    uint32_t length = 0;
+    if (esp_partition_read(partition, 0, &length, sizeof(length)) != ESP_OK) {
+      return false;
+    }
+    // Erased flash reads 0xFFFFFFFF; anything larger than the partition is not a dump
+    imageSize = (length > sizeof(length) && length <= partition->size) ? length : 0;
+    if (imageSize > 0) {
+      debugf("[CORE] Core dump stored: %lu bytes\n", (unsigned long)imageSize);
+    }
+    return imageSize > 0;
+  }
+
+  inline bool available() {
+    return imageSize > 0;
+  }
+
+  inline uint32_t size() {
+    return imageSize;
+  }
+
+  /**
+   * bulk::ReadFn over the stored image
+   */
+  inline bool read(uint32_t offset, uint8_t *buf, size_t len) {
+    return partition != NULL && offset + len <= imageSize &&
+           esp_partition_read(partition, offset, buf, len) == ESP_OK;
+  }
+
+  /**
+   * Invalidate the stored dump. Erasing the first sector clears the length
+   * word; the panic handler erases whatever it needs before the next dump.
+   */
+  inline void erase() {
+    if (partition == NULL || imageSize == 0) {
+      return;
+    }
+    if (esp_partition_erase_range(partition, 0, HEADER_SECTOR) == ESP_OK) {
+      imageSize = 0;
+      debugln("[CORE] Core dump erased");
+    } else {
+      debugln("[CORE] ERROR: Failed to erase core dump");
+    }
+  }
+
+  /**
+   * Fill the advertisement frame (identifier set by the caller):
+   * [type, mac0, mac1, mac2, size LE32]
+   */
+  inline void buildAdvertFrame(twai_message_t &msg, const uint8_t *macSuffix) {
+    msg.flags = 0;
+    msg.data_length_code = 8;
+    msg.data[0] = FRAME_TYPE;
+    memcpy(&msg.data[1], macSuffix, 3);
+    memcpy(&msg.data[4], &imageSize, sizeof(imageSize));
+  }
+}
@@ -30,6 +30,12 @@
 #define DEBUG 1  // Can be overridden via compiler flags or platformio.ini
 #endif
 
+/**
+ * Runtime mute, set while the serial port carries something other than the
+ * debug console (the SLCAN bridge). Every output macro below checks it.
+ */
+static volatile bool debugMuted = false;
+
 // ============================================================================
 // CORE DEBUG MACROS
 // ============================================================================
@@ -40,42 +46,43 @@
  * Print single value (no newline)
  * Supports: char, int, float, String, const char*, etc.
  */
-#define debug(x) Serial.print(x)
+#define debug(x) (debugMuted ? (void)0 : (void)Serial.print(x))
 
 /**
  * Print single value with newline
  */
-#define debugln(x) Serial.println(x)
+#define debugln(x) (debugMuted ? (void)0 : (void)Serial.println(x))
 
 /**
  * Printf-style formatted output with variadic arguments
  * Supports any number of format arguments
  * Example: debugf("X=%d, Y=%d", x, y)
  */
-#define debugf(...) Serial.printf(__VA_ARGS__)
+#define debugf(...) (debugMuted ? (void)0 : (void)Serial.printf(__VA_ARGS__))
 
 /**
  * Printf-style with newline
  */
-#define debugfln(fmt, ...) do { Serial.printf(fmt, ##__VA_ARGS__); Serial.println(); } while(0)
+#define debugfln(fmt, ...) do { if (!debugMuted) { Serial.printf(fmt, ##__VA_ARGS__); Serial.println(); } } while(0)
 
 /**
  * Print hex value with optional prefix
  * Example: debug_hex(0xFF) outputs "FF"
  */
-#define debug_hex(val) Serial.printf("%02X", (uint32_t)(val))
+#define debug_hex(val) debugf("%02X", (uint32_t)(val))
 
 /**
  * Print binary value
  * Example: debug_bin(0b1010) outputs "1010"
  */
-#define debug_bin(val) Serial.printf("%b", (uint32_t)(val))
+#define debug_bin(val) debugf("%b", (uint32_t)(val))
 
 /**
  * Print memory dump of byte array
  * Example: debug_array(buffer, 16) - prints 16 bytes in hex
  */
 #define debug_array(data, len) do { \
+  if (debugMuted) break; \
   for (size_t _i = 0; _i < (len); _i++) { \
     Serial.printf("%02X ", ((uint8_t*)(data))[_i]); \
     if ((_i + 1) % 16 == 0) Serial.println(); \
@@ -87,20 +94,20 @@
  * Print labeled value for debugging
  * Example: debug_val("count", count) outputs "count=42"
  */
-#define debug_val(name, val) Serial.printf("%s=%d\n", name, (int)(val))
+#define debug_val(name, val) debugf("%s=%d\n", name, (int)(val))
 
 /**
  * Print with category prefix
  * Example: debug_tag("[CAN]", "Message received")
  */
-#define debug_tag(tag, msg) Serial.printf("%s %s\n", tag, msg)
+#define debug_tag(tag, msg) debugf("%s %s\n", tag, msg)
 
 /**
  * Conditional debug output
  * Example: debug_if(error, "Error occurred: %d", error_code)
  */
 #define debug_if(condition, ...) do { \
-  if (condition) { Serial.printf(__VA_ARGS__); Serial.println(); } \
+  if ((condition) && !debugMuted) { Serial.printf(__VA_ARGS__); Serial.println(); } \
 } while(0)
 
 /**
@@ -109,7 +116,7 @@
  */
 #define debug_assert(condition, msg) do { \
   if (!(condition)) { \
-    Serial.printf("[ASSERT] %s\n", msg); \
+    debugf("[ASSERT] %s\n", msg); \
     while(1);  /* Halt for debugging */ \
   } \
 } while(0)
@@ -125,16 +132,15 @@
  */
 #define debug_elapsed(start_time, label) do { \
   unsigned long elapsed = micros() - (start_time); \
-  Serial.printf("[PERF] %s: %lu µs\n", label, elapsed); \
+  debugf("[PERF] %s: %lu µs\n", label, elapsed); \
 } while(0)
 
 /**
- * Stack usage estimation
+ * Stack high-water mark of the calling task (least free stack ever, in bytes)
  */
 #define debug_stack() do { \
-  extern int __bss_end, __data_start; \
-  int stack_ptr; \
-  Serial.printf("[STACK] ~%d bytes free\n", (int)&stack_ptr - __bss_end); \
+  debugf("[STACK] %s: %u bytes never used\n", pcTaskGetTaskName(NULL), \
+                (unsigned)uxTaskGetStackHighWaterMark(NULL)); \
 } while(0)
 
 #else  // DEBUG == 0 - All debug output compiled away
@@ -162,7 +168,7 @@
 // ============================================================================
 
 #if DEBUG == 1
-  #define debugg(x, y, z) Serial.printf(x, y, z)
+  #define debugg(x, y, z) debugf(x, y, z)
 #else
   #define debugg(x, y, z) (void)0
 #endif
@@ -0,0 +1,392 @@
+#pragma once
+#include "globals.h"
+#include "taskPlan.h"
+#include "timeSync.h"
+#include "canHelper.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+// ============================================================================
+// Flight Recorder
+// ============================================================================
+// Ring-buffered binary log of recent CAN frames, button events and health
+// counters in the otherwise unused "spiffs" data partition (548 KB, about
+// 35,000 entries).
+//
+// Producers (CAN RX/TX, buttons) only copy a 16-byte entry into a queue;
+// if the queue is full the entry is dropped and counted. The logger task
+// (core 0, lowest priority) batches entries into 256-byte pages and writes
+// each page once it is full, or whatever has accumulated after
+// FLUSH_IDLE_MS without new entries.
+//
+// Flash cost: while the SPI flash is erased or written, the cache is off on
+// both cores, so every task not running from IRAM stalls - the CAN RX task
+// and the loop task included. A page write stalls them for well under a
+// millisecond. A 4 KB sector erase stalls them for about 45 ms (up to a few
+// hundred ms on a worn chip), once every 255 entries; frames arriving
+// meanwhile wait in the controller's 64-byte RX FIFO and can overrun it on
+// a busy bus. To keep that stall off busy moments, the logger erases the
+// next sector ahead of time once nothing has been queued for FLUSH_IDLE_MS.
+// Only a bus that is never quiet that long gets the erase when a sector
+// fills. The loop and CAN RX SLAs (watchdog.h) count the stalls that land
+// on them.
+//
+// Layout: each 4 KB sector starts with a 16-byte header (magic, sequence
+// number, time) followed by 255 entries. Sectors are written strictly in order and
+// the log wraps to the first sector at the end of the partition, so every
+// sector is erased exactly once per pass - that is the wear leveling. At
+// boot the sector with the highest sequence number is found and logging
+// resumes at its first unwritten slot.
+//
+// A readout streams the raw partition, so the log is frozen for its
+// duration: the logger writes its partial page, then stops writing until
+// thaw(). Entries queued meanwhile wait (QUEUE_LENGTH of them) or are
+// dropped and counted. Without the freeze, sectors erased mid-stream would
+// tear the snapshot and resends would re-read bytes that changed since the
+// CRC covered them.
+//
+// Erased flash reads as 0xFF, so an entry whose type byte is 0xFF marks the
+// end of a sector's data.
+//
+// Times are in the shared timebase (timeSync::now()), so logs from several
+// panels line up. Entries keep only the low 32 bits of the microsecond time;
+// the full time is in every sector header and in an ENTRY_TIME anchor
+// written whenever the timebase may have jumped (timeSync::epoch()). The
+// decoder extends each entry relative to the latest anchor - health entries
+// every 10s keep that distance far below the 71-minute wrap.
+
+namespace flightRecorder {
+
+  enum EntryType : uint8_t {
+    ENTRY_BOOT = 0x01,          // id = esp_reset_reason()
+    ENTRY_CAN_RX = 0x02,        // id = CAN ID, length = DLC, data = payload
+    ENTRY_CAN_TX = 0x03,        // id = CAN ID, length = DLC, data = payload
+    ENTRY_BUTTON = 0x04,        // id = gesture event type, data = [button, mask, held, page]
+    ENTRY_HEALTH = 0x05,        // data = [rx LE16, tx failed LE16, dropped LE16, free heap KB LE16]
+    ENTRY_LED = 0x06,           // Backlights updated: id = page, data = LED states
+    ENTRY_TIME = 0x07,          // Timebase anchor: id = epoch, data = time us LE64
+    ENTRY_WAKE = 0xFE,          // Queue-only marker: wakes the logger, never written
+    ENTRY_FREE = 0xFF           // Erased slot
+  };
+
+  struct Entry {
+    uint32_t timeUs;            // Low 32 bits of timeSync::now() at the event
+    uint8_t type;               // EntryType
+    uint8_t length;             // Valid bytes in data (LENGTH_MASK) | FLAG_SYNCED
+    uint16_t id;
+    uint8_t data[8];
+  };
+  static_assert(sizeof(Entry) == 16, "flight recorder entries must stay 16 bytes");
+
+  struct SectorHeader {
+    uint32_t magic;
+    uint32_t sequence;          // Increases by one per sector written, never wraps in practice
+    uint64_t timeUs;            // timeSync::now() when opened | TIME_SYNCED
+  };
+  static_assert(sizeof(SectorHeader) == sizeof(Entry), "sector header occupies one entry slot");
+
+  const uint32_t MAGIC = 0x324C5246;                // "FRL2" (FRL1 logs had millisecond times)
+  const uint8_t LENGTH_MASK = 0x0F;
+  const uint8_t FLAG_SYNCED = 0x80;                 // Time is in the master's timebase
+  const uint64_t TIME_SYNCED = 1ULL << 63;
+  const uint32_t SECTOR_SIZE = 4096;
+  const uint32_t PAGE_SIZE = 256;
+  const uint8_t QUEUE_LENGTH = 64;
+  const uint32_t FLUSH_IDLE_MS = 1000;              // Write a partial page after this much quiet
+  const uint32_t HEALTH_INTERVAL_MS = 10000;
+
+  // Health counters, updated by the producers
+  struct Counters {
+    uint32_t rxFrames;
+    uint32_t txFailures;
+    uint32_t dropped;           // Entries lost to a full queue
+  };
+
+  static const esp_partition_t *partition = NULL;
+  static QueueHandle_t queue = NULL;
+  static TaskHandle_t loggerTask = NULL;
+  static Counters counters = {0, 0, 0};
+
+  // Write position (logger task only)
+  static uint32_t sectorCount = 0;
+  static uint32_t sequence = 0;                     // Sequence of the current sector
+  static uint32_t writeOffset = 0;                  // Next free byte in the partition
+  static uint8_t page[PAGE_SIZE];
+  static uint32_t pageBase = 0;                     // Partition offset of page[0]
+  static uint16_t pageFill = 0;                     // Bytes buffered in page
+  static uint16_t pageFlushed = 0;                  // Bytes of page already in flash
+  static const uint32_t NO_SECTOR = 0xFFFFFFFF;
+  static uint32_t preErasedOffset = NO_SECTOR;      // Next sector, erased while idle
+  static volatile bool freezeRequested = false;    // A readout wants the log frozen
+  static volatile bool frozen = false;              // Logger has flushed and stopped writing
+  static volatile uint16_t anchoredEpoch = 0xFFFF;  // timeSync::epoch() of the last ENTRY_TIME
+
+  static void fill(Entry &e, EntryType type, uint16_t id, const uint8_t *data, uint8_t length, int64_t timeUs) {
+    e.timeUs = (uint32_t)timeUs;
+    e.type = type;
+    e.length = length > sizeof(e.data) ? sizeof(e.data) : length;
+    e.id = id;
+    memset(e.data, 0, sizeof(e.data));
+    if (e.length > 0) {
+      memcpy(e.data, data, e.length);
+    }
+    if (timeSync::isSynced()) {
+      e.length |= FLAG_SYNCED;
+    }
+  }
+
+  static void enqueue(const Entry &e) {
+    if (xQueueSend(queue, &e, 0) != pdTRUE) {
+      counters.dropped++;
+    }
+  }
+
+  /**
+   * Queue an entry. Never blocks; safe from any task.
+   */
+  inline void record(EntryType type, uint16_t id, const uint8_t *data, uint8_t length) {
+    if (queue == NULL) {
+      return;
+    }
+    Entry e;
+    int64_t now = timeSync::now();
+    uint16_t epoch = timeSync::epoch();
+    if (epoch != anchoredEpoch) {
+      anchoredEpoch = epoch;
+      fill(e, ENTRY_TIME, epoch, (const uint8_t *)&now, sizeof(now), now);
+      enqueue(e);
+    }
+    fill(e, type, id, data, length, now);
+    enqueue(e);
+  }
+
+  inline void recordFrame(EntryType type, const twai_message_t &msg) {
+    record(type, (uint16_t)msg.identifier, msg.data, msg.data_length_code);
+  }
+
+  inline void recordFrame(EntryType type, const canHelper::FrameView &msg) {
+    record(type, (uint16_t)msg.identifier, msg.data, msg.data_length_code);
+  }
+
+  // ==========================================================================
+  // Logger task
+  // ==========================================================================
+
+  static bool flushPage() {
+    if (pageFill == pageFlushed) {
+      return true;
+    }
+    esp_err_t err = esp_partition_write(partition, pageBase + pageFlushed,
+                                        &page[pageFlushed], pageFill - pageFlushed);
+    pageFlushed = pageFill;
+    if (err != ESP_OK) {
+      debugf("[FLOG] Write failed at 0x%lX: %d\n", (unsigned long)pageBase, err);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Erase the sector at writeOffset and stamp its header
+   */
+  static void openSector() {
+    sequence++;
+    if (writeOffset != preErasedOffset &&
+        esp_partition_erase_range(partition, writeOffset, SECTOR_SIZE) != ESP_OK) {
+      debugf("[FLOG] Erase failed at 0x%lX\n", (unsigned long)writeOffset);
+    }
+    preErasedOffset = NO_SECTOR;
+    uint64_t now = (uint64_t)timeSync::now();
+    SectorHeader header = {MAGIC, sequence, timeSync::isSynced() ? now | TIME_SYNCED : now};
+    pageBase = writeOffset;
+    memcpy(page, &header, sizeof(header));
+    pageFill = sizeof(header);
+    pageFlushed = 0;
+    writeOffset += sizeof(header);
+  }
+
+  static void append(const Entry &e) {
+    if (writeOffset % SECTOR_SIZE == 0) {
+      openSector();
+    }
+    memcpy(&page[pageFill], &e, sizeof(e));
+    pageFill += sizeof(e);
+    writeOffset += sizeof(e);
+
+    if (pageFill == PAGE_SIZE) {
+      flushPage();
+      pageBase += PAGE_SIZE;
+      pageFill = 0;
+      pageFlushed = 0;
+      if (writeOffset >= partition->size) {
+        writeOffset = 0;                    // Wrap to the oldest sector
+      }
+    }
+  }
+
+  /**
+   * Erase the sector the log continues in, while nothing is waiting to be
+   * logged. Gives up the oldest sector's entries a little early.
+   */
+  static void preEraseNextSector() {
+    uint32_t next = (writeOffset + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    if (next >= partition->size) {
+      next = 0;
+    }
+    if (next == preErasedOffset) {
+      return;
+    }
+    if (esp_partition_erase_range(partition, next, SECTOR_SIZE) == ESP_OK) {
+      preErasedOffset = next;
+    } else {
+      debugf("[FLOG] Erase failed at 0x%lX\n", (unsigned long)next);
+    }
+  }
+
+  // Queued like any other entry so it gets a timebase anchor when needed
+  static void recordHealth() {
+    uint16_t values[4] = {
+      (uint16_t)counters.rxFrames, (uint16_t)counters.txFailures,
+      (uint16_t)counters.dropped, (uint16_t)(ESP.getFreeHeap() / 1024)
+    };
+    record(ENTRY_HEALTH, 0, (const uint8_t *)values, sizeof(values));
+  }
+
+  static void loggerTaskMain(void *arg) {
+    uint32_t lastHealthAt = millis();
+    for (;;) {
+      // Checked on every pass, so a freeze never depends on a queue slot
+      if (freezeRequested) {
+        flushPage();
+        frozen = true;
+        while (freezeRequested) {
+          ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_IDLE_MS));
+        }
+        frozen = false;
+        continue;
+      }
+
+      Entry e;
+      bool received = xQueueReceive(queue, &e, pdMS_TO_TICKS(FLUSH_IDLE_MS)) == pdTRUE;
+      if (received && e.type != ENTRY_WAKE) {
+        append(e);
+      }
+      if (millis() - lastHealthAt >= HEALTH_INTERVAL_MS) {
+        lastHealthAt = millis();
+        recordHealth();
+      }
+      if (!received) {
+        flushPage();
+        preEraseNextSector();
+      }
+    }
+  }
+
+  /**
+   * Find where the previous boot stopped: the sector with the highest
+   * sequence number, at its first free slot
+   */
+  static void findWritePosition() {
+    uint32_t newestSector = 0;
+    sequence = 0;
+    for (uint32_t s = 0; s < sectorCount; s++) {
+      SectorHeader header;
+      if (esp_partition_read(partition, s * SECTOR_SIZE, &header, sizeof(header)) == ESP_OK &&
+          header.magic == MAGIC && header.sequence != 0xFFFFFFFF && header.sequence > sequence) {
+        sequence = header.sequence;
+        newestSector = s;
+      }
+    }
+    if (sequence == 0) {
+      writeOffset = 0;                      // Empty (or foreign) partition: start fresh
+      return;
+    }
+
+    // First free slot of the newest sector; a full sector continues in the next one
+    uint32_t base = newestSector * SECTOR_SIZE;
+    writeOffset = base + SECTOR_SIZE;
+    for (uint32_t slot = sizeof(SectorHeader); slot < SECTOR_SIZE; slot += sizeof(Entry)) {
+      uint8_t type = ENTRY_CAN_RX;
+      if (esp_partition_read(partition, base + slot + offsetof(Entry, type), &type, 1) == ESP_OK &&
+          type == ENTRY_FREE) {
+        writeOffset = base + slot;
+        break;
+      }
+    }
+    if (writeOffset >= partition->size) {
+      writeOffset = 0;
+    }
+
+    // Resume mid-page: keep the page buffer aligned to flash pages
+    if (writeOffset % SECTOR_SIZE != 0) {
+      pageBase = writeOffset - writeOffset % PAGE_SIZE;
+      pageFill = writeOffset % PAGE_SIZE;
+      pageFlushed = pageFill;
+    }
+  }
+
+  /**
+   * Locate the partition, resume the log and start the logger task
+   */
+  inline bool begin() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+    if (partition == NULL) {
+      debugln("[FLOG] ERROR: No spiffs partition - flight recorder disabled");
+      return false;
+    }
+    sectorCount = partition->size / SECTOR_SIZE;
+    findWritePosition();
+
+    queue = xQueueCreate(QUEUE_LENGTH, sizeof(Entry));
+    if (queue == NULL || xTaskCreatePinnedToCore(loggerTaskMain, "logger", taskPlan::STACK_LOGGER, NULL,
+                                                 taskPlan::PRIORITY_LOGGER, &loggerTask,
+                                                 taskPlan::CORE_SYSTEM) != pdPASS) {
+      debugln("[FLOG] ERROR: Failed to start logger task");
+      queue = NULL;
+      return false;
+    }
+
+    record(ENTRY_BOOT, (uint16_t)esp_reset_reason(), NULL, 0);
+    debugf("[FLOG] %lu KB log, sector seq %lu, resuming at 0x%lX\n",
+           (unsigned long)(partition->size / 1024), (unsigned long)sequence, (unsigned long)writeOffset);
+    return true;
+  }
+
+  /**
+   * Ask the logger to write its partial page and stop writing (before a
+   * readout). isFrozen() turns true once it has; thaw() resumes logging.
+   */
+  inline void freeze() {
+    freezeRequested = true;
+    if (queue != NULL) {
+      Entry wake;
+      fill(wake, ENTRY_WAKE, 0, NULL, 0, 0);
+      xQueueSend(queue, &wake, 0);          // Only shortens the wait; the logger also wakes on its own
+    }
+  }
+
+  inline bool isFrozen() {
+    return frozen || queue == NULL;
+  }
+
+  inline void thaw() {
+    freezeRequested = false;
+    if (loggerTask != NULL) {
+      xTaskNotifyGive(loggerTask);
+    }
+  }
+
+  inline uint32_t size() {
+    return partition != NULL ? partition->size : 0;
+  }
+
+  /**
+   * bulk::ReadFn over the raw partition (the host orders sectors by sequence)
+   */
+  inline bool read(uint32_t offset, uint8_t *buf, size_t len) {
+    return partition != NULL && esp_partition_read(partition, offset, buf, len) == ESP_OK;
+  }
+}
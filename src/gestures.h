@@ -0,0 +1,238 @@
+#pragma once
+#include <stdint.h>
+
+// ============================================================================
+// Gesture Recognizer
+// ============================================================================
+// Turns the 8-bit "buttons pressed" mask into tap, double-tap, chord and hold
+// events. Nothing is allocated and nothing waits: a single tap is reported as
+// soon as the press has lasted the debounce time, exactly as before. Richer
+// gestures are resolved afterwards - if the tap turns out to be the first half
+// of a bound double-tap or part of a bound chord, a TAP_CANCEL is reported
+// for it first so the caller can send a correction.
+//
+// Only gestures that are bound (Bindings) are recognized, so buttons without
+// a double-tap or chord binding never see a correction.
+//
+// update() only needs to run when the mask changes or when nextDeadline()
+// says a time-based event (tap, hold, tick) is due.
+//
+// Pure C++ with no Arduino dependencies, so the same code can run off-target.
+
+namespace gestures {
+
+  const uint8_t NUM_BUTTONS = 8;
+  const uint8_t MAX_CHORDS = 4;
+
+  enum EventType : uint8_t {
+    EVENT_TAP,          // Speculative single tap (press lasted the debounce time)
+    EVENT_TAP_CANCEL,   // An earlier TAP on this button is retracted
+    EVENT_DOUBLE_TAP,   // Second tap within the double-tap window
+    EVENT_CHORD,        // All buttons of a bound chord pressed together (mask)
+    EVENT_HOLD_START,   // Press reached the hold threshold
+    EVENT_HOLD_TICK,    // Periodic tick while held
+    EVENT_RELEASE       // Button released (held = true if it was in hold)
+  };
+
+  struct Event {
+    EventType type;
+    uint8_t button;     // Button index, or lowest button of a chord
+    uint8_t mask;       // Chord buttons (EVENT_CHORD)
+    bool held;          // EVENT_RELEASE: the press had reached the hold threshold
+  };
+
+  typedef void (*EventHandler)(const Event &event);
+
+  struct Timing {
+    uint16_t debounceMs;
+    uint16_t holdThresholdMs;
+    uint16_t holdTickMs;
+    uint16_t doubleTapWindowMs;   // Release-to-press gap that counts as double-tap
+    uint16_t chordWindowMs;       // Max spread between the presses of a chord
+  };
+
+  struct Bindings {
+    uint8_t doubleTapMask;        // Buttons with a double-tap action
+    uint8_t chords[MAX_CHORDS];   // Bound chord masks (0 = unused)
+  };
+
+  enum TrackFlags : uint8_t {
+    FLAG_TAPPED = 0x01,           // TAP reported for the current press
+    FLAG_HOLDING = 0x02,          // HOLD_START reported for the current press
+    FLAG_SUPPRESSED = 0x04,       // Consumed by a chord/double-tap until release
+    FLAG_LAST_WAS_TAP = 0x08      // Previous press ended as a plain tap
+  };
+
+  struct ButtonTrack {
+    uint32_t pressedAt;
+    uint32_t releasedAt;
+    uint32_t lastTickAt;
+    uint8_t flags;
+  };
+
+  struct Recognizer {
+    ButtonTrack tracks[NUM_BUTTONS];
+    uint8_t pressedMask;
+  };
+
+  inline void reset(Recognizer &r) {
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      r.tracks[i].pressedAt = 0;
+      r.tracks[i].releasedAt = 0;
+      r.tracks[i].lastTickAt = 0;
+      r.tracks[i].flags = 0;
+    }
+    r.pressedMask = 0;
+  }
+
+  inline void emit(EventHandler handler, EventType type, uint8_t button, uint8_t mask = 0, bool held = false) {
+    Event e;
+    e.type = type;
+    e.button = button;
+    e.mask = mask;
+    e.held = held;
+    handler(e);
+  }
+
+  /**
+   * Check bound chords after a press edge. A chord fires when all of its
+   * buttons are down, none is already consumed or holding, and their presses
+   * all fall within chordWindowMs.
+   */
+  inline void checkChords(Recognizer &r, const Timing &t, const Bindings &b, EventHandler handler) {
+    for (uint8_t c = 0; c < MAX_CHORDS; c++) {
+      uint8_t chord = b.chords[c];
+      if (chord == 0 || (r.pressedMask & chord) != chord) {
+        continue;
+      }
+
+      uint32_t first = 0xFFFFFFFF;
+      uint32_t last = 0;
+      bool available = true;
+      for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+        if (!(chord & (1 << i))) continue;
+        const ButtonTrack &tr = r.tracks[i];
+        if (tr.flags & (FLAG_SUPPRESSED | FLAG_HOLDING)) {
+          available = false;
+          break;
+        }
+        if (tr.pressedAt < first) first = tr.pressedAt;
+        if (tr.pressedAt > last) last = tr.pressedAt;
+      }
+      if (!available || (last - first) > t.chordWindowMs) {
+        continue;
+      }
+
+      // Retract speculative taps first, then report the chord
+      uint8_t lowest = NUM_BUTTONS;
+      for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+        if (!(chord & (1 << i))) continue;
+        if (lowest == NUM_BUTTONS) lowest = i;
+        ButtonTrack &tr = r.tracks[i];
+        if (tr.flags & FLAG_TAPPED) {
+          emit(handler, EVENT_TAP_CANCEL, i);
+        }
+        tr.flags = (tr.flags & ~FLAG_TAPPED) | FLAG_SUPPRESSED;
+      }
+      emit(handler, EVENT_CHORD, lowest, chord);
+    }
+  }
+
+  /**
+   * Feed the current pressed mask (bit N = button N down). Call when the mask
+   * changes and when nextDeadline() expires; calling more often is harmless.
+   * Events are delivered synchronously through handler.
+   */
+  inline void update(Recognizer &r, uint8_t pressedMask, uint32_t nowMs,
+                     const Timing &t, const Bindings &b, EventHandler handler) {
+    uint8_t pressedEdges = pressedMask & ~r.pressedMask;
+    uint8_t releasedEdges = r.pressedMask & ~pressedMask;
+    r.pressedMask = pressedMask;
+
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      uint8_t bit = 1 << i;
+      ButtonTrack &tr = r.tracks[i];
+
+      if (releasedEdges & bit) {
+        bool plainTap = (tr.flags & FLAG_TAPPED) && !(tr.flags & (FLAG_HOLDING | FLAG_SUPPRESSED));
+        emit(handler, EVENT_RELEASE, i, 0, (tr.flags & FLAG_HOLDING) != 0);
+        tr.releasedAt = nowMs;
+        tr.flags = plainTap ? FLAG_LAST_WAS_TAP : 0;
+      }
+
+      if (pressedEdges & bit) {
+        tr.pressedAt = nowMs;
+        tr.flags &= FLAG_LAST_WAS_TAP;
+      }
+    }
+
+    if (pressedEdges) {
+      checkChords(r, t, b, handler);
+    }
+
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      uint8_t bit = 1 << i;
+      ButtonTrack &tr = r.tracks[i];
+      if (!(pressedMask & bit) || (tr.flags & FLAG_SUPPRESSED)) {
+        continue;
+      }
+
+      uint32_t held = nowMs - tr.pressedAt;
+
+      // Tap (or second tap) once the debounce time has passed
+      if (!(tr.flags & (FLAG_TAPPED | FLAG_HOLDING)) && held >= t.debounceMs && held < t.holdThresholdMs) {
+        bool doubleTap = (b.doubleTapMask & bit) && (tr.flags & FLAG_LAST_WAS_TAP) &&
+                         (tr.pressedAt - tr.releasedAt) <= t.doubleTapWindowMs;
+        if (doubleTap) {
+          emit(handler, EVENT_TAP_CANCEL, i);
+          emit(handler, EVENT_DOUBLE_TAP, i);
+          tr.flags = FLAG_SUPPRESSED;
+          continue;
+        }
+        tr.flags = (tr.flags & ~FLAG_LAST_WAS_TAP) | FLAG_TAPPED;
+        emit(handler, EVENT_TAP, i);
+      }
+
+      // Hold, then periodic ticks while held
+      if (!(tr.flags & FLAG_HOLDING) && held >= t.holdThresholdMs) {
+        tr.flags |= FLAG_HOLDING;
+        tr.lastTickAt = nowMs;
+        emit(handler, EVENT_HOLD_START, i);
+      } else if ((tr.flags & FLAG_HOLDING) && (nowMs - tr.lastTickAt) >= t.holdTickMs) {
+        tr.lastTickAt = nowMs;
+        emit(handler, EVENT_HOLD_TICK, i);
+      }
+    }
+  }
+
+  const uint32_t NO_DEADLINE = 0xFFFFFFFF;
+
+  /**
+   * Milliseconds from nowMs until update() would report a time-based event
+   * with an unchanged mask, or NO_DEADLINE if nothing is pending.
+   */
+  inline uint32_t nextDeadline(const Recognizer &r, uint32_t nowMs, const Timing &t) {
+    uint32_t next = NO_DEADLINE;
+    for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+      const ButtonTrack &tr = r.tracks[i];
+      if (!(r.pressedMask & (1 << i)) || (tr.flags & FLAG_SUPPRESSED)) {
+        continue;
+      }
+
+      uint32_t held = nowMs - tr.pressedAt;
+      uint32_t due;
+      if (tr.flags & FLAG_HOLDING) {
+        uint32_t sinceTick = nowMs - tr.lastTickAt;
+        due = sinceTick >= t.holdTickMs ? 0 : t.holdTickMs - sinceTick;
+      } else if (!(tr.flags & FLAG_TAPPED) && held < t.debounceMs) {
+        due = t.debounceMs - held;
+      } else {
+        due = held >= t.holdThresholdMs ? 0 : t.holdThresholdMs - held;
+      }
+      if (due < next) {
+        next = due;
+      }
+    }
+    return next;
+  }
+}
@@ -3,16 +3,10 @@
 #include "debug.h"
 
 // ============================================================================
-// LED Pin Definitions
+// Pin Definitions
 // ============================================================================
-#define LED1_PIN 32
-#define LED2_PIN 33
-#define LED3_PIN 26
-#define LED4_PIN 14
-#define LED5_PIN 4
-#define LED6_PIN 23
-#define LED7_PIN 19
-#define LED8_PIN 17
+// Button, LED and CAN pins come from the board profile (BOARD_BUTTONS)
+#include "boardProfile.h"
 
 // ============================================================================
 // Debug Configuration
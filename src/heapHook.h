@@ -0,0 +1,67 @@
+#pragma once
+#include <stdlib.h>
+#include "globals.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ============================================================================
+// Heap Hook (debug builds)
+// ============================================================================
+// Counts heap allocations made while a task is inside a hot path that is
+// meant to be allocation-free (the CAN RX callback). Enabled with
+// -DDEBUG_HEAP_HOOK=1 together with the linker wraps in platformio.ini:
+//
+//   -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+//
+// Every malloc/calloc/realloc in the firmware and the prebuilt libraries
+// (String, operator new, ...) then goes through the __wrap_ functions in
+// main.cpp.
+// Without DEBUG_HEAP_HOOK, enter()/exit() compile to nothing.
+
+#ifndef DEBUG_HEAP_HOOK
+#define DEBUG_HEAP_HOOK 0
+#endif
+
+namespace heapHook {
+
+  struct Stats {
+    uint32_t hotAllocations;        // Allocations made inside a hot path
+    uint32_t lastSize;              // Size of the most recent one
+  };
+
+#if DEBUG_HEAP_HOOK
+  static volatile TaskHandle_t hotTask = NULL;
+  static volatile uint32_t hotAllocations = 0;
+  static volatile uint32_t lastSize = 0;
+
+  /**
+   * The calling task enters an allocation-free section
+   */
+  inline void enter() {
+    hotTask = xTaskGetCurrentTaskHandle();
+  }
+
+  inline void exit() {
+    hotTask = NULL;
+  }
+
+  inline void count(size_t size) {
+    if (hotTask != NULL && xTaskGetCurrentTaskHandle() == hotTask) {
+      hotAllocations++;
+      lastSize = size;
+    }
+  }
+
+  inline Stats stats() {
+    Stats s = {hotAllocations, lastSize};
+    return s;
+  }
+#else
+  inline void enter() {}
+  inline void exit() {}
+  inline Stats stats() {
+    Stats s = {0, 0};
+    return s;
+  }
+#endif
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include "globals.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/twai.h"
+#include "soc/gpio_reg.h"
+
+// ============================================================================
+// Idle Light Sleep
+// ============================================================================
+// For battery installs: a panel with nothing to do light-sleeps instead of
+// waking every 5 ms to scan buttons (config key 19: quiet time before
+// sleeping, 0 = never sleep). The loop task decides when (see
+// mayLightSleep() in main.cpp) and sleeps until the next scheduler deadline,
+// a button press or CAN activity. Buttons and CAN both wake on a low level:
+// buttons are active low and a dominant bit on CAN RX is low.
+//
+// Light sleep gates the APB clock and with it the TWAI controller. A
+// controller frozen mid-frame would wake up out of step with the bus and
+// flag errors into other nodes' frames, so it is stopped before sleeping
+// and restarted after; it rejoins the bus after 11 recessive bits. A wake
+// on CAN RX therefore only means bus activity, and that frame is not
+// received. After a CAN wake the panel sends a wake notice on the
+// diagnostics ID so the controller can repeat its LED state, and stays
+// awake for the quiet time. Button presses are not lost: the wake-up is far
+// shorter than the debounce.
+//
+// The wake source is taken from the GPIO interrupt status bits, which latch
+// the low level of a wake-enabled pin, not from the pin levels after the
+// wake-up: a tap can be released by then.
+//
+// Automatic light sleep (esp_pm with tickless idle) would keep the RTOS in
+// charge, but the Arduino core is built without tickless idle and the TWAI
+// driver holds an APB lock for as long as it is installed.
+
+namespace idleSleep {
+
+  const uint8_t FRAME_TYPE = 0x04;            // Diagnostic frame type: woke on CAN activity
+  const uint16_t MIN_QUIET_MS = 500;          // Floor for config key 19
+  const int64_t MIN_SLEEP_US = 3000;          // Shorter gaps are not worth a wake-up
+
+  enum WakeSource : uint8_t {
+    WAKE_NONE = 0,                            // Did not sleep
+    WAKE_TIMER,                               // Scheduler deadline
+    WAKE_BUTTON,
+    WAKE_CAN
+  };
+
+  struct Stats {
+    uint32_t sleeps;
+    uint32_t buttonWakes;
+    uint32_t canWakes;
+    uint64_t asleepUs;
+    uint32_t lastWakeToFrameUs;               // CAN wake to the first frame received
+    uint32_t maxWakeToFrameUs;
+  };
+
+  static Stats counters = {0, 0, 0, 0, 0, 0};
+  static volatile uint32_t lastActivityMs = 0;
+  static volatile bool awaitingFrame = false;   // CAN wake, first frame not seen yet
+  static int64_t wokeAtUs = 0;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  /**
+   * Button change or frame sent: restart the quiet time
+   */
+  inline void noteActivity() {
+    lastActivityMs = millis();
+  }
+
+  /**
+   * Frame received (CAN RX task, rxAtUs from the top of the callback)
+   */
+  inline void noteRx(int64_t rxAtUs) {
+    lastActivityMs = millis();
+    if (awaitingFrame) {
+      portENTER_CRITICAL(&lock);
+      uint32_t latency = (uint32_t)(rxAtUs - wokeAtUs);
+      counters.lastWakeToFrameUs = latency;
+      if (latency > counters.maxWakeToFrameUs) {
+        counters.maxWakeToFrameUs = latency;
+      }
+      awaitingFrame = false;
+      portEXIT_CRITICAL(&lock);
+    }
+  }
+
+  inline bool quietFor(uint16_t ms) {
+    return (uint32_t)(millis() - lastActivityMs) >= (ms < MIN_QUIET_MS ? MIN_QUIET_MS : ms);
+  }
+
+  /**
+   * True while the TWAI driver still has frames to send
+   */
+  inline bool txPending() {
+    twai_status_info_t status;
+    return twai_get_status_info(&status) != ESP_OK || status.msgs_to_tx > 0 ||
+           status.state != TWAI_STATE_RUNNING;
+  }
+
+  inline uint64_t pinBit(uint8_t pin) {
+    return (uint64_t)1 << pin;
+  }
+
+  /**
+   * Interrupt status of GPIO 0-39 (bits 32+ from the second register)
+   */
+  inline uint64_t latchedPins() {
+    return REG_READ(GPIO_STATUS_REG) | ((uint64_t)REG_READ(GPIO_STATUS1_REG) << 32);
+  }
+
+  inline void clearLatchedPins(uint64_t pins) {
+    REG_WRITE(GPIO_STATUS_W1TC_REG, (uint32_t)pins);
+    REG_WRITE(GPIO_STATUS1_W1TC_REG, (uint32_t)(pins >> 32));
+  }
+
+  /**
+   * Light-sleep until deadlineUs (esp_timer time, 0 = none), a pressed
+   * button or CAN activity. Call from the loop task only.
+   */
+  inline WakeSource sleep(int64_t deadlineUs, const uint8_t *buttonPins, uint8_t buttonCount, gpio_num_t canRxPin) {
+    int64_t start = esp_timer_get_time();
+    if (deadlineUs != 0 && deadlineUs - start < MIN_SLEEP_US) {
+      return WAKE_NONE;
+    }
+    if (twai_stop() != ESP_OK) {
+      return WAKE_NONE;
+    }
+    if (deadlineUs != 0) {
+      esp_sleep_enable_timer_wakeup((uint64_t)(deadlineUs - start));
+    }
+
+    uint64_t buttonMask = 0;
+    for (uint8_t i = 0; i < buttonCount; i++) {
+      gpio_wakeup_enable((gpio_num_t)buttonPins[i], GPIO_INTR_LOW_LEVEL);
+      buttonMask |= pinBit(buttonPins[i]);
+    }
+    gpio_wakeup_enable(canRxPin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    clearLatchedPins(buttonMask | pinBit(canRxPin));
+
+    esp_err_t err = esp_light_sleep_start();
+    int64_t woke = esp_timer_get_time();
+    uint64_t latched = latchedPins();
+
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+    for (uint8_t i = 0; i < buttonCount; i++) {
+      gpio_wakeup_disable((gpio_num_t)buttonPins[i]);
+    }
+    gpio_wakeup_disable(canRxPin);
+    clearLatchedPins(buttonMask | pinBit(canRxPin));
+    if (twai_start() != ESP_OK) {
+      debugln("[SLEEP] TWAI restart failed");
+    }
+    if (err != ESP_OK) {
+      return WAKE_NONE;                       // Rejected, e.g. while WiFi is on
+    }
+
+    WakeSource source = WAKE_TIMER;
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) {
+      source = (latched & buttonMask) != 0 ? WAKE_BUTTON : WAKE_CAN;
+    }
+
+    portENTER_CRITICAL(&lock);
+    counters.sleeps++;
+    counters.asleepUs += woke - start;
+    if (source == WAKE_BUTTON) {
+      counters.buttonWakes++;
+    } else if (source == WAKE_CAN) {
+      counters.canWakes++;
+      wokeAtUs = woke;
+      awaitingFrame = true;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (source != WAKE_TIMER) {
+      noteActivity();
+    }
+    return source;
+  }
+
+  inline Stats stats() {
+    portENTER_CRITICAL(&lock);
+    Stats copy = counters;
+    portEXIT_CRITICAL(&lock);
+    return copy;
+  }
+
+  /**
+   * Fill the wake notice (identifier set by the caller): [type, mac0, mac1, mac2]
+   */
+  inline void buildWakeNotice(twai_message_t &msg, const uint8_t *macSuffix) {
+    msg.flags = 0;
+    msg.data_length_code = 4;
+    msg.data[0] = FRAME_TYPE;
+    memcpy(&msg.data[1], macSuffix, 3);
+  }
+}
@@ -0,0 +1,310 @@
+#pragma once
+#include "globals.h"
+#include "configStore.h"
+#include "canHelper.h"
+#include "driver/twai.h"
+#include <TwaiTaskBased.h>
+
+// ============================================================================
+// J1939 Protocol Mode
+// ============================================================================
+// Set J1939_MODE here or via platformio.ini build flags:
+//   build_flags = -DJ1939_MODE=1
+//
+// When enabled, every panel frame is sent as a 29-bit extended frame on the
+// Proprietary B PGN (0xFF00) with the legacy 11-bit identifier carried in the
+// group extension byte (IDs below are the defaults; the configured IDs from
+// the config store are used):
+//
+//   Legacy ID   PGN      Description
+//   0x00        0xFF00   OTA update trigger
+//   0x01        0xFF01   WiFi credential configuration
+//   0x02        0xFF02   Panel configuration
+//   0x15        0xFF15   Brightness control
+//   0x16        0xFF16   Scene batch
+//   0x18        0xFF18   Button toggle
+//   0x1B        0xFF1B   LED backlight state
+//
+// The panel claims a source address (PGN 0xEE00) before it transmits and
+// answers Requests (PGN 0xEA00) for its address claim. Inbound frames are
+// translated back to the legacy identifiers, so the message handlers in
+// main.cpp are the same in both modes.
+#ifndef J1939_MODE
+#define J1939_MODE 0
+#endif
+
+#ifndef J1939_PREFERRED_ADDRESS
+#define J1939_PREFERRED_ADDRESS 0x80
+#endif
+
+namespace j1939 {
+
+  const uint32_t PGN_REQUEST = 0xEA00;
+  const uint32_t PGN_ADDRESS_CLAIMED = 0xEE00;
+  const uint32_t PGN_PROPRIETARY_B = 0xFF00;
+
+  const uint8_t ADDRESS_GLOBAL = 0xFF;
+  const uint8_t ADDRESS_NULL = 0xFE;
+
+  // Self-configurable address range (J1939-81)
+  const uint8_t ADDRESS_RANGE_FIRST = 0x80;
+  const uint8_t ADDRESS_RANGE_LAST = 0xF7;
+
+  const uint8_t PRIORITY_CONTROL = 3;     // Button and brightness commands
+  const uint8_t PRIORITY_DEFAULT = 6;     // Everything else
+
+  // No normal traffic for 250ms after a claim (J1939-81 4.4.4.3)
+  const unsigned long CLAIM_SETTLE_MS = 250;
+
+  // NAME fields
+  const uint8_t NAME_FUNCTION = 0x81;            // Operator controls panel
+  const uint8_t NAME_VEHICLE_SYSTEM = 0x00;
+  const uint8_t NAME_INDUSTRY_GROUP = 0x00;      // Global
+  const uint16_t NAME_MANUFACTURER_CODE = 0x000; // Reserved/unassigned
+
+  enum ClaimState : uint8_t {
+    CLAIM_IDLE,       // begin() not called yet
+    CLAIM_HELD,       // Claim sent; usable once the settle time has passed
+    CLAIM_CANNOT      // Address range exhausted; panel stays silent
+  };
+
+  static uint64_t name = 0;
+  static uint8_t address = J1939_PREFERRED_ADDRESS;
+  static ClaimState claimState = CLAIM_IDLE;
+  static unsigned long claimSentAt = 0;
+
+  // Addresses claimed by other nodes, one bit per source address
+  static uint32_t takenAddresses[8] = {0};
+
+  // ==========================================================================
+  // Identifier helpers
+  // ==========================================================================
+
+  inline uint32_t buildId(uint8_t priority, uint32_t pgn, uint8_t sourceAddress) {
+    return ((uint32_t)(priority & 0x07) << 26) | ((pgn & 0x3FFFF) << 8) | sourceAddress;
+  }
+
+  inline uint8_t pduFormat(uint32_t id) { return (id >> 16) & 0xFF; }
+  inline uint8_t pduSpecific(uint32_t id) { return (id >> 8) & 0xFF; }
+  inline uint8_t sourceAddressOf(uint32_t id) { return id & 0xFF; }
+
+  /**
+   * PGN of an extended identifier. For PDU1 formats (PF < 240) the PS byte
+   * is a destination address and is not part of the PGN.
+   */
+  inline uint32_t pgnOf(uint32_t id) {
+    uint32_t pgn = (id >> 8) & 0x3FFFF;
+    if (pduFormat(id) < 240) {
+      pgn &= 0x3FF00;
+    }
+    return pgn;
+  }
+
+  // ==========================================================================
+  // Receive filter (software)
+  // ==========================================================================
+  // TwaiTaskBased::begin() installs the driver with an accept-all hardware
+  // filter, so every frame on the bus reaches the RX task; this filter runs
+  // at the entry of the RX path instead. The first check is a mask over the
+  // PF byte: REQUEST (0xEA), ADDRESS_CLAIMED (0xEE) and PROPRIETARY_B (0xFF)
+  // share the pattern 111x1x1x, which also passes five unused neighbours
+  // (0xEB, 0xEF, 0xFA, 0xFB, 0xFE). The exact PGN checks after it drop those
+  // and unmapped group extensions.
+
+  const uint8_t RX_PF_CODE = 0xEA;
+  const uint8_t RX_PF_CARE = 0xEA;         // Bits that must match
+
+  /**
+   * Software receive filter for J1939 mode: true for a 29-bit data frame
+   * this panel handles (a Request to it or to all, an Address Claimed, or a
+   * Proprietary B frame on a mapped legacy ID)
+   */
+  inline bool softwareFilter(const twai_message_t &msg) {
+    if (!msg.extd || msg.rtr) {
+      return false;
+    }
+
+    uint8_t pf = (uint8_t)(msg.identifier >> 16);
+    if (((pf ^ RX_PF_CODE) & RX_PF_CARE) != 0) {
+      return false;
+    }
+
+    uint32_t pgn = pgnOf(msg.identifier);
+    if (pgn == PGN_REQUEST) {
+      uint8_t destination = pduSpecific(msg.identifier);
+      return destination == address || destination == ADDRESS_GLOBAL;
+    }
+    if (pgn == PGN_ADDRESS_CLAIMED) {
+      return true;
+    }
+    if ((pgn & 0x3FF00) == PGN_PROPRIETARY_B) {
+      return config::isPanelId(config::get(), pduSpecific(msg.identifier));
+    }
+    return false;
+  }
+
+  // ==========================================================================
+  // Address claim
+  // ==========================================================================
+
+  inline bool isTaken(uint8_t sa) {
+    return (takenAddresses[sa >> 5] >> (sa & 31)) & 1;
+  }
+
+  inline void markTaken(uint8_t sa) {
+    takenAddresses[sa >> 5] |= (1UL << (sa & 31));
+  }
+
+  /**
+   * Build the 64-bit NAME. The 21-bit identity number comes from the low
+   * bits of the factory MAC so every panel on the bus has a unique NAME.
+   */
+  inline uint64_t buildName() {
+    uint64_t mac = ESP.getEfuseMac();
+    uint32_t identity = (uint32_t)(mac >> 24) & 0x1FFFFF;   // Low 21 bits of MAC bytes 3-5
+
+    uint64_t n = 0;
+    n |= (uint64_t)identity;
+    n |= (uint64_t)(NAME_MANUFACTURER_CODE & 0x7FF) << 21;
+    n |= (uint64_t)NAME_FUNCTION << 40;
+    n |= (uint64_t)(NAME_VEHICLE_SYSTEM & 0x7F) << 49;
+    n |= (uint64_t)(NAME_INDUSTRY_GROUP & 0x07) << 60;
+    n |= (uint64_t)1 << 63;                                  // Arbitrary address capable
+    return n;
+  }
+
+  static void sendAddressClaim(uint8_t sa) {
+    twai_message_t message = {};
+    message.identifier = buildId(PRIORITY_DEFAULT, PGN_ADDRESS_CLAIMED | ADDRESS_GLOBAL, sa);
+    message.extd = true;
+    message.rtr = false;
+    message.data_length_code = 8;
+    for (int i = 0; i < 8; i++) {
+      message.data[i] = (uint8_t)(name >> (8 * i));
+    }
+
+    if (!TwaiTaskBased::send(message)) {
+      debugln("[J1939] Address claim TX failed");
+    }
+  }
+
+  static void claim(uint8_t sa) {
+    address = sa;
+    claimState = CLAIM_HELD;
+    claimSentAt = millis();
+    sendAddressClaim(address);
+    debugf("[J1939] Claiming address 0x%02X\n", address);
+  }
+
+  /**
+   * Pick the next free address in the self-configurable range after losing
+   * arbitration, or give up with a Cannot Claim Address message.
+   */
+  static void claimNextAddress() {
+    uint8_t candidate = address;
+    for (int tries = 0; tries <= (ADDRESS_RANGE_LAST - ADDRESS_RANGE_FIRST); tries++) {
+      candidate = (candidate >= ADDRESS_RANGE_LAST || candidate < ADDRESS_RANGE_FIRST)
+                    ? ADDRESS_RANGE_FIRST : candidate + 1;
+      if (!isTaken(candidate)) {
+        claim(candidate);
+        return;
+      }
+    }
+
+    claimState = CLAIM_CANNOT;
+    address = ADDRESS_NULL;
+    sendAddressClaim(ADDRESS_NULL);
+    debugln("[J1939] ERROR: No free address - cannot claim");
+  }
+
+  /**
+   * Start address claim. Call once after the CAN bus is up.
+   */
+  inline void begin() {
+    name = buildName();
+    debugf("[J1939] NAME: %08lX%08lX\n", (unsigned long)(name >> 32), (unsigned long)name);
+    claim(J1939_PREFERRED_ADDRESS);
+  }
+
+  /**
+   * True once the address claim has settled and normal traffic may be sent
+   */
+  inline bool ready() {
+    return claimState == CLAIM_HELD && (millis() - claimSentAt) >= CLAIM_SETTLE_MS;
+  }
+
+  static void handleAddressClaimed(const twai_message_t &msg) {
+    uint8_t sa = sourceAddressOf(msg.identifier);
+    if (sa == ADDRESS_NULL || msg.data_length_code < 8) {
+      return;
+    }
+    markTaken(sa);
+
+    if (sa != address || claimState != CLAIM_HELD) {
+      return;
+    }
+
+    uint64_t otherName = 0;
+    for (int i = 0; i < 8; i++) {
+      otherName |= (uint64_t)msg.data[i] << (8 * i);
+    }
+
+    // Lower NAME has priority
+    if (name < otherName) {
+      debugf("[J1939] Address 0x%02X contended - we keep it\n", address);
+      sendAddressClaim(address);
+    } else {
+      debugf("[J1939] Address 0x%02X lost to another node\n", address);
+      claimNextAddress();
+    }
+  }
+
+  static void handleRequest(const twai_message_t &msg) {
+    if (msg.data_length_code < 3) {
+      return;
+    }
+    uint32_t requested = msg.data[0] | ((uint32_t)msg.data[1] << 8) | ((uint32_t)msg.data[2] << 16);
+    if (requested == PGN_ADDRESS_CLAIMED && claimState != CLAIM_IDLE) {
+      sendAddressClaim(address);
+    }
+  }
+
+  /**
+   * Process an inbound frame. Network management PGNs are consumed here.
+   * For Proprietary B frames view is set to the frame under its legacy
+   * 11-bit identifier and true is returned so the caller dispatches it
+   * normally; the frame itself is left as delivered.
+   */
+  inline bool receive(const twai_message_t &msg, canHelper::FrameView &view) {
+    if (!softwareFilter(msg)) {
+      return false;
+    }
+
+    uint32_t pgn = pgnOf(msg.identifier);
+    if (pgn == PGN_ADDRESS_CLAIMED) {
+      handleAddressClaimed(msg);
+      return false;
+    }
+    if (pgn == PGN_REQUEST) {
+      handleRequest(msg);
+      return false;
+    }
+
+    view = canHelper::viewOf(msg);
+    view.identifier = pduSpecific(msg.identifier);
+    return true;
+  }
+
+  /**
+   * Rewrite an outbound legacy frame to its Proprietary B equivalent.
+   * Returns false while no address is held, in which case nothing may be sent.
+   */
+  inline bool encode(twai_message_t &msg, uint8_t priority) {
+    if (!ready() || msg.identifier > 0xFF || !config::isPanelId(config::get(), msg.identifier)) {
+      return false;
+    }
+    msg.identifier = buildId(priority, PGN_PROPRIETARY_B | msg.identifier, address);
+    msg.extd = true;
+    return true;
+  }
+}
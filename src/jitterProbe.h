@@ -0,0 +1,202 @@
+#pragma once
+#include <WiFi.h>
+#include "globals.h"
+#include "canHelper.h"
+#include "taskPlan.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+
+// ============================================================================
+// Jitter Probe
+// ============================================================================
+// On-demand measurement of how late the firmware reacts, optionally while a
+// synthetic WiFi/OTA load runs on core 0:
+//
+//   SCAN   - button scan period overrun (time between scans minus the
+//            nominal period)
+//   RX     - queueing a probe frame to its RX callback. The frame is sent
+//            with self-reception, so this covers TX queue, bus time and the
+//            RX task wake-up. Needs one other node on the bus to ACK.
+//   TIMER  - scheduler deadline to callback (scheduler::stats())
+//
+// The load keeps the WiFi stack busy with back-to-back asynchronous scans
+// and runs a core-0 task at OTA priority that spins 8ms out of every 10ms,
+// standing in for the TCP and flash work of an update.
+
+namespace jitterProbe {
+
+  enum Metric : uint8_t {
+    METRIC_SCAN = 0,
+    METRIC_RX,
+    METRIC_TIMER,
+    METRIC_COUNT
+  };
+
+  struct Stat {
+    uint32_t count;
+    uint32_t maxUs;
+    uint64_t totalUs;
+  };
+
+  const uint8_t PROBE_FRAME_TYPE = 0x00;    // Diagnostic frame type: probe echo
+  const uint8_t REPORT_FRAME_TYPE = 0x01;   // Diagnostic frame type: jitter report
+  const uint8_t REPORT_UNDER_LOAD = 0x80;   // Metric byte flag
+  const uint32_t PROBE_INTERVAL_MS = 10;    // One RX probe frame per interval
+  const uint32_t LOAD_PERIOD_MS = 10;
+  const uint32_t LOAD_BUSY_MS = 8;
+
+  static Stat stats[METRIC_COUNT];
+  static volatile bool active = false;
+  static volatile bool loadRunning = false;
+  static bool withLoad = false;
+  static uint16_t tag = 0;                  // Identifies this run's probe frames
+  static uint8_t sequence = 0;
+  static TaskHandle_t loadTask = NULL;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  inline void record(Metric metric, uint32_t us) {
+    portENTER_CRITICAL(&lock);
+    Stat &s = stats[metric];
+    s.count++;
+    s.totalUs += us;
+    if (us > s.maxUs) {
+      s.maxUs = us;
+    }
+    portEXIT_CRITICAL(&lock);
+  }
+
+  static void loadTaskMain(void *arg) {
+    WiFi.mode(WIFI_STA);
+    while (loadRunning) {
+      int64_t busyUntil = esp_timer_get_time() + LOAD_BUSY_MS * 1000;
+      while (esp_timer_get_time() < busyUntil) {
+        // Spin: occupy core 0 like an OTA write burst
+      }
+      if (WiFi.scanComplete() != WIFI_SCAN_RUNNING) {
+        WiFi.scanDelete();
+        WiFi.scanNetworks(true);
+      }
+      vTaskDelay(pdMS_TO_TICKS(LOAD_PERIOD_MS - LOAD_BUSY_MS));
+    }
+    WiFi.scanDelete();
+    WiFi.mode(WIFI_OFF);
+    loadTask = NULL;
+    vTaskDelete(NULL);
+  }
+
+  /**
+   * Start a measurement run. Returns false if one is already running.
+   */
+  inline bool start(bool underLoad) {
+    if (active || loadTask != NULL) {
+      return false;
+    }
+    memset(stats, 0, sizeof(stats));
+    tag = (uint16_t)esp_random();
+    sequence = 0;
+    withLoad = underLoad;
+    active = true;
+
+    if (underLoad) {
+      loadRunning = true;
+      if (xTaskCreatePinnedToCore(loadTaskMain, "jitterLoad", 4096, NULL,
+                                  taskPlan::PRIORITY_OTA, &loadTask, taskPlan::CORE_SYSTEM) != pdPASS) {
+        loadRunning = false;
+        loadTask = NULL;
+        debugln("[JITTER] ERROR: Failed to start load task");
+      }
+    }
+    debugf("[JITTER] Probe started%s\n", underLoad ? " with WiFi/OTA load" : "");
+    return true;
+  }
+
+  /**
+   * End the run. The load task stops itself on its next cycle.
+   */
+  inline void stop() {
+    active = false;
+    loadRunning = false;
+  }
+
+  inline bool isActive() {
+    return active;
+  }
+
+  /**
+   * Fill a probe frame (8 bytes, identifier set by the caller):
+   * [type, tag lo, tag hi, seq, t0..t3] with t = esp_timer low 32 bits in us
+   */
+  inline void buildProbeFrame(twai_message_t &msg) {
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    msg.flags = 0;
+    msg.self = true;                        // Receive our own frame
+    msg.data_length_code = 8;
+    msg.data[0] = PROBE_FRAME_TYPE;
+    msg.data[1] = tag & 0xFF;
+    msg.data[2] = tag >> 8;
+    msg.data[3] = sequence++;
+    memcpy(&msg.data[4], &now, sizeof(now));
+  }
+
+  /**
+   * Handle a received probe frame. Returns true if it was one of ours.
+   */
+  inline bool handleProbeFrame(const canHelper::FrameView &msg) {
+    if (!active || msg.data_length_code < 8 || msg.data[0] != PROBE_FRAME_TYPE ||
+        msg.data[1] != (tag & 0xFF) || msg.data[2] != (tag >> 8)) {
+      return false;
+    }
+    uint32_t sentAt;
+    memcpy(&sentAt, &msg.data[4], sizeof(sentAt));
+    record(METRIC_RX, (uint32_t)esp_timer_get_time() - sentAt);
+    return true;
+  }
+
+  /**
+   * Record one button scan that woke after its timeout
+   */
+  inline void recordScan(uint32_t intervalUs, uint32_t nominalUs) {
+    if (active) {
+      record(METRIC_SCAN, intervalUs > nominalUs ? intervalUs - nominalUs : 0);
+    }
+  }
+
+  inline void setTimerStats(uint32_t fired, uint32_t maxUs, uint64_t totalUs) {
+    portENTER_CRITICAL(&lock);
+    stats[METRIC_TIMER].count = fired;
+    stats[METRIC_TIMER].maxUs = maxUs;
+    stats[METRIC_TIMER].totalUs = totalUs;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  inline uint16_t saturate16(uint64_t value) {
+    return value > 0xFFFF ? 0xFFFF : (uint16_t)value;
+  }
+
+  /**
+   * Fill the report frame for one metric (8 bytes, identifier set by caller):
+   * [type, metric | load flag, count LE16, avg us LE16, max us LE16]
+   * Values saturate at 65535.
+   */
+  inline void buildReportFrame(Metric metric, twai_message_t &msg) {
+    portENTER_CRITICAL(&lock);
+    Stat s = stats[metric];
+    portEXIT_CRITICAL(&lock);
+
+    uint16_t count = saturate16(s.count);
+    uint16_t avg = saturate16(s.count ? s.totalUs / s.count : 0);
+    uint16_t max = saturate16(s.maxUs);
+
+    msg.flags = 0;
+    msg.data_length_code = 8;
+    msg.data[0] = REPORT_FRAME_TYPE;
+    msg.data[1] = metric | (withLoad ? REPORT_UNDER_LOAD : 0);
+    memcpy(&msg.data[2], &count, sizeof(count));
+    memcpy(&msg.data[4], &avg, sizeof(avg));
+    memcpy(&msg.data[6], &max, sizeof(max));
+
+    debugf("[JITTER] %s: %lu samples, avg %u us, max %lu us\n",
+           metric == METRIC_SCAN ? "scan" : metric == METRIC_RX ? "rx" : "timer",
+           (unsigned long)s.count, avg, (unsigned long)s.maxUs);
+  }
+}
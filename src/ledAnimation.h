@@ -0,0 +1,190 @@
+#pragma once
+#include "globals.h"
+#include "driver/ledc.h"
+
+// ============================================================================
+// Backlight Status Animations
+// ============================================================================
+// Blink, breathe and chase patterns played by the LEDC peripheral, for
+// panel states the 0x1B display cannot show. The main loop picks the highest
+// priority active status (see updateStatusAnimation() in main.cpp) and calls
+// show() on every wake-up; only a change of status touches the hardware.
+//
+// The animated LEDs are routed to LEDC channels through the GPIO matrix.
+// While they are, writes to the GPIO output register (the 0x1B display)
+// keep landing in the register but do not reach the pins, so the display
+// stays current underneath and reappears as soon as the pins are handed
+// back. No display code needs to know about animations.
+//
+// Blink and chase are plain PWM at 1-4 Hz: chase gives every LED the same
+// duty with its start (hpoint) shifted by 1/N of the period. Breathe is a
+// hardware duty fade; the loop task only reverses its direction every half
+// period (step()).
+
+namespace ledAnimation {
+
+  enum Status : uint8_t {
+    STATUS_NONE = 0,
+    STATUS_WAITING,                           // No LED state frame from a controller yet
+    STATUS_BRIGHTNESS,                        // A held button is ramping brightness
+    STATUS_BUS_OFF,                           // CAN controller bus-off or recovering
+    STATUS_OTA,                               // Waiting for / receiving an OTA update
+    STATUS_COUNT
+  };
+
+  enum Pattern : uint8_t {
+    PATTERN_BLINK,
+    PATTERN_BREATHE,
+    PATTERN_CHASE
+  };
+
+  struct Animation {
+    Pattern pattern;
+    uint16_t periodMs;                        // Blink/chase: 1000 / periodMs must be whole Hz
+  };
+
+  // Indexed by Status
+  static const Animation animations[STATUS_COUNT] = {
+    {PATTERN_BLINK, 1000},                    // STATUS_NONE (unused)
+    {PATTERN_BREATHE, 3000},                  // STATUS_WAITING
+    {PATTERN_BLINK, 250},                     // STATUS_BRIGHTNESS
+    {PATTERN_BLINK, 500},                     // STATUS_BUS_OFF
+    {PATTERN_CHASE, 1000},                    // STATUS_OTA
+  };
+
+  const ledc_mode_t MODE = LEDC_LOW_SPEED_MODE;
+  const ledc_timer_t TIMER = LEDC_TIMER_0;
+  const ledc_timer_bit_t SLOW_RESOLUTION = LEDC_TIMER_20_BIT;    // Reaches 1 Hz from the 80 MHz APB clock
+  const uint32_t SLOW_PERIOD_TICKS = 1UL << 20;
+  const ledc_timer_bit_t BREATHE_RESOLUTION = LEDC_TIMER_13_BIT;
+  const uint32_t BREATHE_DUTY_MAX = (1UL << 13) - 1;
+  const uint32_t BREATHE_PWM_HZ = 5000;
+
+  static Status playing = STATUS_NONE;
+  static uint8_t playingMask = 0;             // Bit N = LED N (ledc channel N)
+  static const uint8_t *ledPins = NULL;
+  static uint8_t ledCount = 0;
+  static bool breatheUp = false;
+
+  /**
+   * Call once from setup() with the backlight pins (index = LEDC channel)
+   */
+  inline void begin(const uint8_t *pins, uint8_t count) {
+    ledPins = pins;
+    ledCount = count;
+    ledc_fade_func_install(0);
+  }
+
+  inline bool isPlaying() {
+    return playing != STATUS_NONE;
+  }
+
+  static void configureTimer(uint32_t freqHz, ledc_timer_bit_t resolution) {
+    ledc_timer_config_t timer = {};
+    timer.speed_mode = MODE;
+    timer.duty_resolution = resolution;
+    timer.timer_num = TIMER;
+    timer.freq_hz = freqHz;
+    timer.clk_cfg = LEDC_AUTO_CLK;
+    ledc_timer_config(&timer);
+  }
+
+  static void attach(uint8_t led, uint32_t duty, int hpoint) {
+    ledc_channel_config_t channel = {};
+    channel.gpio_num = ledPins[led];
+    channel.speed_mode = MODE;
+    channel.channel = (ledc_channel_t)led;
+    channel.timer_sel = TIMER;
+    channel.duty = duty;
+    channel.hpoint = hpoint;
+    ledc_channel_config(&channel);
+  }
+
+  /**
+   * Hand the pins back to the GPIO output register (the 0x1B display)
+   */
+  static void release() {
+    for (uint8_t i = 0; i < ledCount; i++) {
+      if (playingMask & (1 << i)) {
+        ledc_stop(MODE, (ledc_channel_t)i, 0);
+        pinMatrixOutDetach(ledPins[i], false, false);
+      }
+    }
+    playingMask = 0;
+  }
+
+  /**
+   * Breathe: start the fade in the other direction. Returns the delay in ms
+   * until the next step, 0 when nothing is breathing.
+   */
+  inline uint32_t step() {
+    if (playing == STATUS_NONE || animations[playing].pattern != PATTERN_BREATHE) {
+      return 0;
+    }
+    breatheUp = !breatheUp;
+    uint32_t halfMs = animations[playing].periodMs / 2;
+    for (uint8_t i = 0; i < ledCount; i++) {
+      if (playingMask & (1 << i)) {
+        ledc_set_fade_with_time(MODE, (ledc_channel_t)i, breatheUp ? BREATHE_DUTY_MAX : 0, halfMs);
+        ledc_fade_start(MODE, (ledc_channel_t)i, LEDC_FADE_NO_WAIT);
+      }
+    }
+    return halfMs;
+  }
+
+  /**
+   * Show status on the LEDs in ledMask (STATUS_NONE = back to the 0x1B
+   * display). Call from the loop task. Returns the delay in ms until step()
+   * is due, 0 if the pattern needs no steps.
+   */
+  inline uint32_t show(Status status, uint8_t ledMask) {
+    if (ledMask == 0) {
+      status = STATUS_NONE;
+    }
+    if (status == playing && (status == STATUS_NONE || ledMask == playingMask)) {
+      return 0;
+    }
+    release();
+    playing = status;
+    if (status == STATUS_NONE) {
+      debugln("[LED] Status display off");
+      return 0;
+    }
+
+    const Animation &a = animations[status];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ledCount; i++) {
+      count += (ledMask >> i) & 1;
+    }
+
+    if (a.pattern == PATTERN_BREATHE) {
+      configureTimer(BREATHE_PWM_HZ, BREATHE_RESOLUTION);
+    } else {
+      configureTimer(1000 / a.periodMs, SLOW_RESOLUTION);
+    }
+
+    uint8_t position = 0;
+    for (uint8_t i = 0; i < ledCount; i++) {
+      if (!(ledMask & (1 << i))) continue;
+      switch (a.pattern) {
+        case PATTERN_BLINK:
+          attach(i, SLOW_PERIOD_TICKS / 2, 0);
+          break;
+        case PATTERN_CHASE:
+          attach(i, SLOW_PERIOD_TICKS / count, (int)(SLOW_PERIOD_TICKS / count * position++));
+          break;
+        case PATTERN_BREATHE:
+          attach(i, 0, 0);
+          break;
+      }
+    }
+    playingMask = ledMask;
+    debugf("[LED] Status display %d on LEDs 0x%02X\n", status, ledMask);
+
+    if (a.pattern != PATTERN_BREATHE) {
+      return 0;
+    }
+    breatheUp = false;
+    return step();
+  }
+}
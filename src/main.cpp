@@ -1,89 +1,62 @@
 #include <Arduino.h>
 #include <stdint.h>
-#include <Preferences.h>
 #include <TwaiTaskBased.h>
 #include <OtaUpdate.h>
 #include "globals.h"
-
-// Button debounce timing
-unsigned long btn01DebounceTime = 0;
-unsigned long btn02DebounceTime = 0;
-unsigned long btn03DebounceTime = 0;
-unsigned long btn04DebounceTime = 0;
-unsigned long btn05DebounceTime = 0;
-unsigned long btn06DebounceTime = 0;
-unsigned long btn07DebounceTime = 0;
-unsigned long btn08DebounceTime = 0;
-unsigned long debounceDelay = 200;
-
-// Button state tracking for press-and-hold brightness control
-unsigned long btn01PressStartTime = 0;
-unsigned long btn02PressStartTime = 0;
-unsigned long btn03PressStartTime = 0;
-unsigned long btn04PressStartTime = 0;
-unsigned long btn05PressStartTime = 0;
-unsigned long btn06PressStartTime = 0;
-unsigned long btn07PressStartTime = 0;
-unsigned long btn08PressStartTime = 0;
-
-bool btn01WasPressed = false;
-bool btn02WasPressed = false;
-bool btn03WasPressed = false;
-bool btn04WasPressed = false;
-bool btn05WasPressed = false;
-bool btn06WasPressed = false;
-bool btn07WasPressed = false;
-bool btn08WasPressed = false;
-
-bool btn01ToggleSent = false;
-bool btn02ToggleSent = false;
-bool btn03ToggleSent = false;
-bool btn04ToggleSent = false;
-bool btn05ToggleSent = false;
-bool btn06ToggleSent = false;
-bool btn07ToggleSent = false;
-bool btn08ToggleSent = false;
-
-bool btn01InBrightnessMode = false;
-bool btn02InBrightnessMode = false;
-bool btn03InBrightnessMode = false;
-bool btn04InBrightnessMode = false;
-bool btn05InBrightnessMode = false;
-bool btn06InBrightnessMode = false;
-bool btn07InBrightnessMode = false;
-bool btn08InBrightnessMode = false;
-
-uint8_t btn01Brightness = 0;
-uint8_t btn02Brightness = 0;
-uint8_t btn03Brightness = 0;
-uint8_t btn04Brightness = 0;
-uint8_t btn05Brightness = 0;
-uint8_t btn06Brightness = 0;
-uint8_t btn07Brightness = 0;
-uint8_t btn08Brightness = 0;
-
-unsigned long btn01LastBrightnessUpdate = 0;
-unsigned long btn02LastBrightnessUpdate = 0;
-unsigned long btn03LastBrightnessUpdate = 0;
-unsigned long btn04LastBrightnessUpdate = 0;
-unsigned long btn05LastBrightnessUpdate = 0;
-unsigned long btn06LastBrightnessUpdate = 0;
-unsigned long btn07LastBrightnessUpdate = 0;
-unsigned long btn08LastBrightnessUpdate = 0;
-
-// Timing constants for brightness control
-const unsigned long HOLD_THRESHOLD = 700;        // 700ms to enter brightness mode
-const unsigned long BRIGHTNESS_INCREMENT = 100;  // Update brightness every 100ms
-
-// Button GPIO pins
-#define BTN1_PIN 34
-#define BTN2_PIN 25
-#define BTN3_PIN 27
-#define BTN4_PIN 12
-#define BTN5_PIN 16
-#define BTN6_PIN 22
-#define BTN7_PIN 21
-#define BTN8_PIN 18
+#include "taskPlan.h"
+#include "scheduler.h"
+#include "configStore.h"
+#include "j1939.h"
+#include "canHelper.h"
+#include "gestures.h"
+#include "jitterProbe.h"
+#include "taskStats.h"
+#include "heapHook.h"
+#include "bulkTransfer.h"
+#include "timeSync.h"
+#include "flightRecorder.h"
+#include "coredump.h"
+#include "idleSleep.h"
+#include "slcan.h"
+#include "busLoad.h"
+#include "ledAnimation.h"
+#include "watchdog.h"
+#include "benchmark.h"
+
+// Button, LED and CAN transceiver pins: board profile (src/boardProfile.h)
+#define CAN_TX_PIN ((gpio_num_t)board::CAN_TX_GPIO)
+#define CAN_RX_PIN ((gpio_num_t)board::CAN_RX_GPIO)
+uint32_t busBitrate = 0;          // Selected at boot
+
+#define SERIAL_CONSOLE_BAUD 115200        // Debug console; the SLCAN bridge uses SLCAN_BAUD
+
+// Button N (0-based) has its backlight on ledPins[N]. board::BUTTONS is the
+// number of buttons fitted; config::NUM_BUTTONS is the width of a device page.
+const uint8_t *const buttonPins = board::Active::buttonPins;
+const uint8_t *const ledPins = board::Active::ledPins;
+
+// Tap / double-tap / chord / hold recognition over the pressed-button mask.
+// The recognizer runs on a mask change or at its next deadline (scheduler).
+#define BUTTON_SCAN_PERIOD_MS 5
+gestures::Recognizer recognizer;
+int64_t lastScanAt = 0;           // esp_timer time of the previous loop wake-up
+uint8_t buttonBrightness[config::NUM_BUTTONS] = {};
+uint8_t sentBrightness[config::NUM_BUTTONS] = {};   // Last value sent; steps may be skipped under bus load
+
+// Debounce, hold threshold and brightness step timing come from the
+// config store (config::get().debounceMs / holdThresholdMs / brightnessIncrementMs)
+
+// Device pages: page P covers devices P*8..P*8+7 and receives its LED state
+// on CAN ID canIdLedState + P. Every page's last state is cached so a page
+// switch redraws immediately.
+const uint8_t PAGE_CHORD_MASK = 0x01 | (1 << (board::BUTTONS - 1));   // First + last button = next page
+uint8_t activePage = 0;
+uint8_t ledCache[config::MAX_PAGES][config::NUM_BUTTONS] = {};
+
+// Status animations on the backlights (src/ledAnimation.h)
+#define WAITING_FOR_CONTROLLER_MS 5000    // Boot time before "no controller yet" is shown
+volatile bool ledStateSeen = false;       // An LED state frame has arrived since boot
+uint8_t brightnessModeMask = 0;           // Buttons in brightness mode (bit N = button N+1)
 
 // WiFi credential reception state (CAN ID 0x01 protocol)
 bool wifiConfigInProgress = false;
@@ -93,21 +66,243 @@ uint8_t wifiSsidLen = 0;          // Expected total SSID length
 uint8_t wifiPasswordLen = 0;      // Expected total password length
 uint8_t wifiSsidReceived = 0;     // Bytes received so far
 uint8_t wifiPasswordReceived = 0;
+#define WIFI_CONFIG_TIMEOUT_MS 2000       // Abandon a transfer after this much silence
 
 // Create OTA update handler (3-minute timeout, 180000 ms)
 // Credentials are loaded from NVS when OTA is triggered; empty here for getHostName() only
 OtaUpdate otaUpdate(180000, "", "");
+TaskHandle_t otaTask = NULL;      // Parked on core 0 until an OTA trigger arrives
+volatile bool otaActive = false;  // Set while an OTA session runs
+
+// Node identity: last three MAC bytes, parsed once at boot from the OTA
+// hostname (esp32-XXXXXX) so frames can be matched without allocating
+uint8_t nodeMac[3] = {};
+
+// Diagnostics (CAN ID 0x03 request, results on 0x1F)
+#define DIAG_CMD_JITTER_PROBE 0x01
+#define JITTER_PROBE_MAX_SECONDS 60
+#define DIAG_CMD_TASK_STATS 0x02
+#define TASK_STATS_FRAME_SPACING_MS 2     // Keeps a snapshot from flooding the TX queue
+uint16_t taskStatsIntervalS = 0;          // 0 = task statistics off
+uint8_t taskStatsNextFrame = 0;
+#define DIAG_CMD_BULK_READ 0x03
+#define DIAG_CMD_BULK_ACK 0x04
+#define DIAG_CMD_BUS_LOAD 0x05
+#define DIAG_CMD_SLA 0x06
+#define BULK_STREAM_FLIGHT_LOG 0x00
+#define BULK_STREAM_COREDUMP 0x01
+#define COREDUMP_FIRST_ADVERT_MS 1000     // After the J1939 address claim has settled
+#define RESET_REPORT_MS 1000              // Same, for the reset reason report
+
+// Hot-path microbenchmarks (BENCHMARK=1 builds, see src/benchmark.h)
+#if BENCHMARK
+#define BENCHMARK_START_MS 2000           // After boot traffic and the J1939 address claim
+#define BENCHMARK_DIAG_FRAME 0x7F         // Filler frame type on CAN ID 0x1F for the TX case
+void runBenchmarks();
+#endif
+uint8_t bulkRequestedStream = 0;
+uint32_t bulkFreezeRequestedAt = 0;       // millis() when the flight log was asked to freeze
+#define FLIGHT_LOG_FREEZE_TIMEOUT_MS 3000 // Logger starved this long: refuse the readout
+
+/**
+ * Drive the backlights from the cached state of a device page.
+ * Each LED shows the device its button is mapped to; scene buttons stay dark.
+ */
+void showLedPage(uint8_t page) {
+  const config::PanelConfig cfg = config::get();
+  uint64_t on = 0;
+  for (uint8_t i = 0; i < board::BUTTONS; i++) {
+    uint8_t slot = cfg.buttonDevice[i];
+    if (!(slot & config::BUTTON_SCENE_FLAG) && ledCache[page][slot] > 0) {
+      on |= board::bit(ledPins[i]);
+    }
+  }
+  board::writeLeds(on);
+  flightRecorder::record(flightRecorder::ENTRY_LED, page, ledCache[page], config::NUM_BUTTONS);
+}
 
 /**
- * Save WiFi credentials to NVS (Non-Volatile Storage)
+ * Switch to a device page and redraw its backlights from the cache
+ */
+void setActivePage(uint8_t page) {
+  activePage = page;
+  showLedPage(page);
+  debugf("[PAGE] Device page %d of %d active\n", page + 1, config::get().pageCount);
+}
+
+/**
+ * Save WiFi credentials to the config store.
+ * Unchanged credentials are not rewritten; changed ones reach NVS with the
+ * next batched config commit.
  */
 void saveWifiCredentials(const char* ssid, const char* password) {
-  Preferences prefs;
-  prefs.begin("wifi", false);  // read-write
-  prefs.putString("ssid", ssid);
-  prefs.putString("password", password);
-  prefs.end();
-  debugf("[WiFi] Credentials saved to NVS (SSID: %s)\n", ssid);
+  bool changed = config::setString(config::KEY_WIFI_SSID, ssid);
+  changed |= config::setString(config::KEY_WIFI_PASSWORD, password);
+  if (changed) {
+    // SSID printed separately: printf output over 63 chars allocates
+    debug("[WiFi] Credentials updated, SSID: ");
+    debugln(ssid);
+  } else {
+    debugln("[WiFi] Credentials unchanged - nothing to save");
+  }
+}
+
+/**
+ * Take the node identity from the factory MAC: its last three bytes, the
+ * same ones the OTA hostname (esp32-XXXXXX) is built from
+ */
+void loadNodeIdentity() {
+  uint64_t mac = ESP.getEfuseMac();             // Byte 0 in the low bits
+  for (uint8_t i = 0; i < sizeof(nodeMac); i++) {
+    nodeMac[i] = (uint8_t)(mac >> (8 * (3 + i)));
+  }
+  debugf("[OTA] Node %02X%02X%02X, hostname %s\n", nodeMac[0], nodeMac[1], nodeMac[2],
+         otaUpdate.getHostName().c_str());
+}
+
+/**
+ * Check whether a 3-byte MAC suffix from a CAN frame names this panel
+ */
+bool isAddressedToThisPanel(const uint8_t *macSuffix) {
+  return memcmp(macSuffix, nodeMac, sizeof(nodeMac)) == 0;
+}
+
+/**
+ * SLCAN bridge: frames from the host go onto the bus as they are, without
+ * the J1939 translation or the flight recorder
+ */
+bool sendBridgeFrame(twai_message_t &message) {
+  if (!TwaiTaskBased::send(message)) {
+    return false;
+  }
+  busLoad::noteFrame(message);
+  return true;
+}
+
+/**
+ * Scheduler callback: give the serial port to the SLCAN bridge or the debug
+ * console, as config key 20 says
+ */
+void applySerialMode() {
+  if (config::get().serialBridge) {
+    slcan::begin(busBitrate, nodeMac);
+  } else {
+    slcan::end(SERIAL_CONSOLE_BAUD);
+  }
+}
+
+/**
+ * Handle panel configuration CAN messages (CAN ID 0x02)
+ * Message format: [mac0, mac1, mac2, key, value0..value3]
+ *   mac0-2:  last three MAC bytes of the target panel, FF FF FF = every panel
+ *   key:     config::ConfigKey
+ *   value:   little-endian; KEY_BUTTON_DEVICE takes [button index, device index]
+ * Changes apply immediately and are committed to NVS in one deferred batch.
+ */
+void handleConfigMessage(const canHelper::FrameView &msg) {
+  if (msg.data_length_code < 5) return;
+
+  bool broadcast = msg.data[0] == 0xFF && msg.data[1] == 0xFF && msg.data[2] == 0xFF;
+  if (!broadcast && !isAddressedToThisPanel(msg.data)) return;
+
+  uint8_t key = msg.data[3];
+  const uint8_t *value = &msg.data[4];
+  uint8_t valueLen = msg.data_length_code - 4;
+  bool changed = false;
+
+  switch (key) {
+    case config::KEY_BUTTON_DEVICE:
+      // Slot within a page (the page offset is added when sending) or a scene
+      if (valueLen < 2 || value[0] >= config::NUM_BUTTONS) return;
+      changed = config::set(config::KEY_BUTTON_DEVICE, &value[1], 1, value[0]);
+      break;
+
+    case config::KEY_WIFI_SSID:
+    case config::KEY_WIFI_PASSWORD:
+      // Credentials only via the checksummed CAN ID 0x01 protocol
+      return;
+
+    case config::KEY_CAN_BITRATE: {
+      uint32_t bitrate;
+      if (valueLen < sizeof(bitrate)) return;
+      memcpy(&bitrate, value, sizeof(bitrate));
+      changed = config::setU32(config::KEY_CAN_BITRATE, bitrate);   // Applies on next boot
+      break;
+    }
+
+    case config::KEY_SCENE_STEP: {
+      if (valueLen < 4 || value[0] >= config::MAX_SCENES || value[1] >= config::MAX_SCENE_STEPS) return;
+      size_t offset = (value[0] * config::MAX_SCENE_STEPS + value[1]) * sizeof(config::SceneStep);
+      changed = config::set(config::KEY_SCENE_STEP, &value[2], sizeof(config::SceneStep), offset);
+      break;
+    }
+
+    case config::KEY_DOUBLE_TAP_SCENE:
+      if (valueLen < 2 || value[0] >= config::NUM_BUTTONS) return;
+      changed = config::set(config::KEY_DOUBLE_TAP_SCENE, &value[1], 1, value[0]);
+      break;
+
+    case config::KEY_DEBOUNCE_MS:
+    case config::KEY_HOLD_THRESHOLD_MS:
+    case config::KEY_BRIGHTNESS_INCREMENT_MS:
+    case config::KEY_DOUBLE_TAP_WINDOW_MS:
+    case config::KEY_CHORD_WINDOW_MS:
+    case config::KEY_CAN_ID_OTA_TRIGGER:
+    case config::KEY_CAN_ID_WIFI_CONFIG:
+    case config::KEY_CAN_ID_BRIGHTNESS:
+    case config::KEY_CAN_ID_BUTTON:
+    case config::KEY_CAN_ID_LED_STATE:
+    case config::KEY_CAN_ID_SCENE:
+    case config::KEY_TIME_SYNC_MASTER:
+    case config::KEY_IDLE_SLEEP_MS:
+    case config::KEY_BUS_LOAD_LIMIT:
+    case config::KEY_SCAN_SLA_MS:
+    case config::KEY_RX_SLA_MS: {
+      uint16_t number;
+      if (valueLen < sizeof(number)) return;
+      memcpy(&number, value, sizeof(number));
+      changed = config::setU16((config::ConfigKey)key, number);   // Checked by config::isValid()
+      break;
+    }
+
+    case config::KEY_SERIAL_BRIDGE: {
+      uint16_t mode;
+      if (valueLen < sizeof(mode)) return;
+      memcpy(&mode, value, sizeof(mode));
+      changed = config::setU16(config::KEY_SERIAL_BRIDGE, mode);
+      scheduler::schedule(scheduler::TIMER_SERIAL_MODE, 0, applySerialMode);   // Serial belongs to the loop task
+      break;
+    }
+
+    case config::KEY_PAGE_COUNT: {
+      uint16_t pages;
+      if (valueLen < sizeof(pages)) return;
+      memcpy(&pages, value, sizeof(pages));
+      changed = config::setU16(config::KEY_PAGE_COUNT, pages);
+      if (changed && activePage >= pages) {
+        setActivePage(0);
+      }
+      break;
+    }
+
+    default:
+      // Every key has its own case; anything else is unknown
+      return;
+  }
+
+  debugf("[CFG] Key %d %s\n", key, changed ? "updated" : "unchanged");
+  (void)changed;                      // Only read by the debug output
+}
+
+/**
+ * Scheduler callback: the WiFi credential transfer stalled
+ */
+void onWifiConfigTimeout() {
+  if (wifiConfigInProgress) {
+    wifiConfigInProgress = false;
+    debugf("[WiFi] Config timed out: SSID %d/%d bytes, Password %d/%d bytes\n",
+           wifiSsidReceived, wifiSsidLen, wifiPasswordReceived, wifiPasswordLen);
+  }
 }
 
 /**
@@ -117,10 +312,17 @@ void saveWifiCredentials(const char* ssid, const char* password) {
  *   0x02: SSID chunk - chunk_index + up to 6 data bytes
  *   0x03: Password chunk - chunk_index + up to 6 data bytes
  *   0x04: End - XOR checksum for validation
+ * A transfer with no message for WIFI_CONFIG_TIMEOUT_MS is abandoned.
  */
-void handleWifiConfigMessage(const twai_message_t &msg) {
+void handleWifiConfigMessage(const canHelper::FrameView &msg) {
   uint8_t msgType = msg.data[0];
 
+  if (msgType == 0x04) {
+    scheduler::cancel(scheduler::TIMER_WIFI_CONFIG_TIMEOUT);
+  } else if (msgType == 0x01 || wifiConfigInProgress) {
+    scheduler::schedule(scheduler::TIMER_WIFI_CONFIG_TIMEOUT, WIFI_CONFIG_TIMEOUT_MS, onWifiConfigTimeout);
+  }
+
   switch (msgType) {
     case 0x01: {  // Start message
       wifiSsidLen = msg.data[1];
@@ -172,8 +374,8 @@ void handleWifiConfigMessage(const twai_message_t &msg) {
         wifiPasswordBuffer[wifiPasswordReceived] = '\0';
         saveWifiCredentials((const char*)wifiSsidBuffer, (const char*)wifiPasswordBuffer);
       } else {
-        debugf("[WiFi] Config failed: checksum %s, SSID %d/%d bytes, Password %d/%d bytes\n",
-               (checksum == msg.data[1]) ? "OK" : "MISMATCH",
+        debugf("[WiFi] Config failed: checksum %s\n", (checksum == msg.data[1]) ? "OK" : "MISMATCH");
+        debugf("[WiFi] SSID %d/%d bytes, Password %d/%d bytes\n",
                wifiSsidReceived, wifiSsidLen, wifiPasswordReceived, wifiPasswordLen);
       }
       break;
@@ -181,43 +383,385 @@ void handleWifiConfigMessage(const twai_message_t &msg) {
   }
 }
 
+/**
+ * OTA session task - pinned to core 0 at low priority so waiting for an
+ * update never blocks CAN reception or button handling. Created at boot and
+ * parked, so an OTA trigger only has to notify it (no allocation on RX).
+ */
+void otaTaskMain(void *arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    const config::PanelConfig cfg = config::get();
+    debugf("[OTA] Using stored WiFi credentials (SSID: %s)\n", cfg.wifiSsid);
+    {
+      OtaUpdate ota(180000, cfg.wifiSsid, cfg.wifiPassword);
+      ota.waitForOta();
+    }
+    debugln("[OTA] OTA mode exited - resuming normal operation");
+    otaActive = false;
+  }
+}
+
+bool canSend(twai_message_t &message, uint8_t priority);
+
+/**
+ * Scheduler callback: queue the next jitter probe frame
+ */
+void onJitterProbeTick() {
+  if (!jitterProbe::isActive()) return;
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  jitterProbe::buildProbeFrame(message);
+  canSend(message, j1939::PRIORITY_DEFAULT);
+  scheduler::schedule(scheduler::TIMER_JITTER_PROBE, jitterProbe::PROBE_INTERVAL_MS, onJitterProbeTick);
+}
+
+uint8_t jitterProbeSeconds = 0;   // Requested run, started on the loop task
+bool jitterProbeLoad = false;
+
+void onJitterProbeEnd();
+
+/**
+ * Scheduler callback: start a requested jitter probe run. Runs on the loop
+ * task because starting the load task allocates its stack.
+ */
+void onJitterProbeStart() {
+  if (!jitterProbe::start(jitterProbeLoad)) {
+    debugln("[JITTER] Probe already running");
+    return;
+  }
+  scheduler::resetStats();
+  scheduler::schedule(scheduler::TIMER_JITTER_PROBE, jitterProbe::PROBE_INTERVAL_MS, onJitterProbeTick);
+  scheduler::schedule(scheduler::TIMER_JITTER_PROBE_END, jitterProbeSeconds * 1000UL, onJitterProbeEnd);
+}
+
+/**
+ * Scheduler callback: the jitter probe run is over - publish one report
+ * frame per metric on the diagnostics ID
+ */
+void onJitterProbeEnd() {
+  jitterProbe::stop();
+  scheduler::cancel(scheduler::TIMER_JITTER_PROBE);
+
+  scheduler::JitterStats timerStats = scheduler::stats();
+  jitterProbe::setTimerStats(timerStats.fired, timerStats.maxLatenessUs, timerStats.totalLatenessUs);
+
+  for (uint8_t m = 0; m < jitterProbe::METRIC_COUNT; m++) {
+    twai_message_t message;
+    message.identifier = config::CAN_ID_DIAG;
+    jitterProbe::buildReportFrame((jitterProbe::Metric)m, message);
+    canSend(message, j1939::PRIORITY_DEFAULT);
+  }
+}
+
+/**
+ * Scheduler callback: send the next frame of the current task snapshot
+ */
+void onTaskStatsFrame() {
+  if (taskStatsNextFrame >= taskStats::count()) return;
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  taskStats::buildFrame(taskStatsNextFrame++, message);
+  canSend(message, j1939::PRIORITY_DEFAULT);
+  if (taskStatsNextFrame < taskStats::count()) {
+    scheduler::schedule(scheduler::TIMER_TASK_STATS_FRAME, busLoad::stretch(TASK_STATS_FRAME_SPACING_MS),
+                        onTaskStatsFrame);
+  }
+}
+
+/**
+ * Scheduler callback: snapshot all tasks and start publishing one frame per task
+ */
+void onTaskStatsSample() {
+  if (taskStatsIntervalS == 0) return;
+  if (taskStats::sample() > 0) {
+    taskStats::log();
+    taskStatsNextFrame = 0;
+    onTaskStatsFrame();
+  }
+  scheduler::schedule(scheduler::TIMER_TASK_STATS, taskStatsIntervalS * 1000UL, onTaskStatsSample);
+}
+
+/**
+ * bulk::SendFn - bulk transfer frames go out on CAN ID 0x20
+ */
+bool sendBulkFrame(twai_message_t &message) {
+  message.identifier = config::CAN_ID_BULK;
+  return canSend(message, j1939::PRIORITY_DEFAULT);
+}
+
+/**
+ * Scheduler callback: drive the running bulk transfer
+ */
+void onBulkService() {
+  uint32_t nextMs = bulk::service(sendBulkFrame, millis());
+  if (nextMs != bulk::IDLE) {
+    uint32_t backoffMs = busLoad::bulkBackoffMs();
+    scheduler::schedule(scheduler::TIMER_BULK, nextMs > backoffMs ? nextMs : backoffMs, onBulkService);
+  }
+}
+
+/**
+ * Scheduler callback: advertise the stored core dump until it is fetched
+ */
+void onCoredumpAdvert() {
+  if (!coredump::available()) return;
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  coredump::buildAdvertFrame(message, nodeMac);
+  canSend(message, j1939::PRIORITY_DEFAULT);
+  scheduler::schedule(scheduler::TIMER_COREDUMP_ADVERT, busLoad::stretch(coredump::ADVERTISE_INTERVAL_MS),
+                      onCoredumpAdvert);
+}
+
+/**
+ * Scheduler callback: answer a bus load query
+ */
+void onBusLoadReport() {
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  busLoad::buildReport(message, nodeMac);
+  canSend(message, j1939::PRIORITY_DEFAULT);
+}
+
+/**
+ * Scheduler callback: report the reset reason and the last SLA violator of
+ * the previous boot (not after power-on)
+ */
+void onResetReport() {
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  if (watchdog::buildResetReport(message, nodeMac)) {
+    canSend(message, j1939::PRIORITY_DEFAULT);
+  }
+}
+
+/**
+ * Scheduler callback: answer an SLA violation query
+ */
+void onSlaReport() {
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  watchdog::buildSlaReport(message, nodeMac);
+  canSend(message, j1939::PRIORITY_DEFAULT);
+}
+
+/**
+ * Scheduler callback: time sync beacon on the master, loss detection on
+ * followers. The role follows config key 18 without a reboot.
+ */
+void onTimeSync() {
+  timeSync::setMaster(config::get().timeSyncMaster != 0);
+  twai_message_t message;
+  if (timeSync::tick(message)) {
+    message.identifier = config::CAN_ID_TIME_SYNC;
+    canSend(message, j1939::PRIORITY_CONTROL);
+  }
+  scheduler::schedule(scheduler::TIMER_TIME_SYNC, timeSync::INTERVAL_MS, onTimeSync);
+}
+
+/**
+ * bulk::DoneFn for the core dump - erase it once the host has confirmed it
+ */
+void onCoredumpTransferred(bool confirmed) {
+  if (confirmed) {
+    coredump::erase();
+  }
+}
+
+/**
+ * bulk::DoneFn for the flight log - resume logging
+ */
+void onFlightLogTransferred(bool confirmed) {
+  (void)confirmed;                    // Logging resumes either way; nothing is erased
+  flightRecorder::thaw();
+}
+
+/**
+ * Scheduler callback: start a requested bulk read once its source is ready
+ */
+void onBulkStart() {
+  bool started = false;
+  if (bulkRequestedStream == BULK_STREAM_FLIGHT_LOG) {
+    if (!flightRecorder::isFrozen()) {
+      if (millis() - bulkFreezeRequestedAt < FLIGHT_LOG_FREEZE_TIMEOUT_MS) {
+        scheduler::schedule(scheduler::TIMER_BULK, 10, onBulkStart);
+        return;
+      }
+      debugln("[FLOG] Logger did not pause - readout refused");
+      flightRecorder::thaw();
+      return;
+    }
+    started = bulk::start(BULK_STREAM_FLIGHT_LOG, flightRecorder::size(), flightRecorder::read,
+                          onFlightLogTransferred);
+    if (!started) {
+      flightRecorder::thaw();
+    }
+  } else if (bulkRequestedStream == BULK_STREAM_COREDUMP) {
+    if (!coredump::available()) {
+      debugln("[CORE] No core dump stored");
+      return;
+    }
+    started = bulk::start(BULK_STREAM_COREDUMP, coredump::size(), coredump::read, onCoredumpTransferred);
+  }
+  if (!started) {
+    debugln("[BULK] Transfer already running");
+    return;
+  }
+  onBulkService();
+}
+
+/**
+ * Handle diagnostic request CAN messages (CAN ID 0x03)
+ * Message format: [mac0, mac1, mac2, command, args...]
+ *   mac0-2:  last three MAC bytes of the target panel, FF FF FF = every panel
+ *   0x01:    jitter probe - [seconds (1-60), load (0 = idle, 1 = WiFi/OTA load)]
+ *   0x02:    task statistics - [interval seconds LE16, 0 = off]
+ *   0x03:    bulk read - [stream (0 = flight log, 1 = core dump)]
+ *   0x04:    bulk ack - [stream, bytes received LE24, FFFFFF = abort]
+ *   0x05:    bus load query - no arguments
+ *   0x06:    SLA violation query - no arguments
+ */
+void handleDiagRequest(const canHelper::FrameView &msg) {
+  if (msg.data_length_code < 4) return;
+
+  bool broadcast = msg.data[0] == 0xFF && msg.data[1] == 0xFF && msg.data[2] == 0xFF;
+  if (!broadcast && !isAddressedToThisPanel(msg.data)) return;
+
+  switch (msg.data[3]) {
+    case DIAG_CMD_JITTER_PROBE: {
+      if (msg.data_length_code < 6) return;
+      uint8_t seconds = msg.data[4];
+      if (seconds < 1 || seconds > JITTER_PROBE_MAX_SECONDS) return;
+      jitterProbeSeconds = seconds;
+      jitterProbeLoad = msg.data[5] != 0;
+      scheduler::schedule(scheduler::TIMER_JITTER_PROBE_START, 0, onJitterProbeStart);
+      break;
+    }
+
+    case DIAG_CMD_TASK_STATS: {
+      if (msg.data_length_code < 6) return;
+      memcpy(&taskStatsIntervalS, &msg.data[4], sizeof(taskStatsIntervalS));
+      if (taskStatsIntervalS == 0) {
+        scheduler::cancel(scheduler::TIMER_TASK_STATS);
+        debugln("[TASKS] Statistics off");
+      } else {
+        // The first snapshot only sets the CPU baseline
+        taskStats::sample();
+        scheduler::schedule(scheduler::TIMER_TASK_STATS, taskStatsIntervalS * 1000UL, onTaskStatsSample);
+        debugf("[TASKS] Statistics every %u s\n", taskStatsIntervalS);
+      }
+      break;
+    }
+
+    case DIAG_CMD_BULK_READ:
+      if (msg.data_length_code < 5 || msg.data[4] > BULK_STREAM_COREDUMP) return;
+      if (bulk::isActive() || scheduler::isArmed(scheduler::TIMER_BULK)) {
+        debugln("[BULK] Transfer already running");
+        return;
+      }
+      bulkRequestedStream = msg.data[4];
+      if (bulkRequestedStream == BULK_STREAM_FLIGHT_LOG) {
+        flightRecorder::freeze();
+        bulkFreezeRequestedAt = millis();
+      }
+      scheduler::schedule(scheduler::TIMER_BULK, 0, onBulkStart);
+      break;
+
+    case DIAG_CMD_BULK_ACK: {
+      if (msg.data_length_code < 8) return;
+      uint32_t offset = msg.data[5] | (msg.data[6] << 8) | ((uint32_t)msg.data[7] << 16);
+      bulk::ack(msg.data[4], offset);
+      scheduler::schedule(scheduler::TIMER_BULK, busLoad::bulkBackoffMs(), onBulkService);
+      break;
+    }
+
+    case DIAG_CMD_BUS_LOAD:
+      scheduler::schedule(scheduler::TIMER_BUS_LOAD_REPORT, 0, onBusLoadReport);
+      break;
+
+    case DIAG_CMD_SLA:
+      scheduler::schedule(scheduler::TIMER_SLA_REPORT, 0, onSlaReport);
+      break;
+  }
+}
+
+/**
+ * Frames kept in the flight recorder: panel traffic, but not the
+ * diagnostic and bulk frames used to read it out
+ */
+bool isRecordedId(const config::PanelConfig &cfg, uint32_t identifier) {
+  if (identifier > 0x7FF) {
+    return false;                       // Not a legacy ID; must not truncate onto one
+  }
+  return identifier != config::CAN_ID_DIAG_REQUEST && identifier != config::CAN_ID_DIAG &&
+         identifier != config::CAN_ID_BULK && identifier != config::CAN_ID_TIME_SYNC &&
+         config::isPanelId(cfg, (uint16_t)identifier);
+}
+
 /**
  * CAN RX Callback - called when a CAN message is received
- * Handles three types of messages:
+ * Handles four types of messages:
  *   - ID 0x0: OTA trigger (MAC-based targeting)
  *   - ID 0x01: WiFi credential configuration
- *   - ID 0x1B: LED control commands
+ *   - ID 0x02: Panel configuration
+ *   - ID 0x03: Diagnostic request (0x1F: own jitter probe frames)
+ *   - ID 0x21: Time sync beacon, timestamped with rxAtUs
+ *   - ID 0x1B: LED control commands (0x1B + page for additional device pages)
+ * IDs other than 0x02 are the defaults; the configured IDs are matched.
+ * In J1939 mode the same messages arrive as Proprietary B PGNs and are
+ * translated back to these IDs before dispatch.
+ * Nothing on this path allocates; debug builds with DEBUG_HEAP_HOOK count
+ * any allocation that does happen here.
  */
-void onCanRx(const twai_message_t &msg) {
-  // OTA trigger message (ID 0x0)
-  if (msg.identifier == 0x0) {
-    debugln("[OTA] CAN trigger received");
+void dispatchCanRx(const twai_message_t &rxMsg, int64_t rxAtUs) {
+#if J1939_MODE
+  // Translate Proprietary B frames to their legacy IDs; drop everything else
+  canHelper::FrameView msg;
+  if (!j1939::receive(rxMsg, msg)) {
+    return;
+  }
+#else
+  canHelper::FrameView msg = canHelper::viewOf(rxMsg);
+#endif
+
+  const config::PanelConfig cfg = config::get();
 
-    // Extract target hostname from CAN data
-    char updateForHostName[14];
-    String currentHostName = otaUpdate.getHostName();
+  flightRecorder::counters.rxFrames++;
+  // An extended frame is panel traffic only in J1939 mode, translated above
+  if ((J1939_MODE || !rxMsg.extd) && isRecordedId(cfg, msg.identifier)) {
+    flightRecorder::recordFrame(flightRecorder::ENTRY_CAN_RX, msg);
+  }
 
-    // Format: esp32-XXXXXX where X is MAC address in hex
-    sprintf(updateForHostName, "esp32-%02X%02X%02X",
-            msg.data[0], msg.data[1], msg.data[2]);
+  // Jitter probe echo (ID 0x1F) - checked first to keep the measurement tight
+  if (msg.identifier == config::CAN_ID_DIAG) {
+    jitterProbe::handleProbeFrame(msg);
+  }
 
-    debugf("[OTA] Target hostname: %s\n", updateForHostName);
-    debugf("[OTA] Current hostname: %s\n", currentHostName.c_str());
+  // Time sync beacon (ID 0x21) - the master answers its own SYNC with a FOLLOW_UP
+  else if (msg.identifier == config::CAN_ID_TIME_SYNC) {
+    twai_message_t reply;
+    if (timeSync::handleFrame(msg, rxAtUs, reply)) {
+      reply.identifier = config::CAN_ID_TIME_SYNC;
+      canSend(reply, j1939::PRIORITY_CONTROL);
+    }
+  }
+
+  // OTA trigger message (ID 0x0)
+  else if (msg.identifier == cfg.canIdOtaTrigger) {
+    debugln("[OTA] CAN trigger received");
 
     // Check if this OTA trigger is for this device
-    if (currentHostName.equals(updateForHostName)) {
-      debugln("[OTA] Hostname matched - reading WiFi credentials from NVS");
-      Preferences prefs;
-      prefs.begin("wifi", true);  // read-only
-      String ssid = prefs.getString("ssid", "");
-      String password = prefs.getString("password", "");
-      prefs.end();
-
-      if (ssid.length() > 0 && password.length() > 0) {
-        debugf("[OTA] Using stored WiFi credentials (SSID: %s)\n", ssid.c_str());
-        OtaUpdate ota(180000, ssid.c_str(), password.c_str());
-        ota.waitForOta();
-        debugln("[OTA] OTA mode exited - resuming normal operation");
+    if (isAddressedToThisPanel(msg.data)) {
+      debugln("[OTA] Hostname matched - using stored WiFi credentials");
+
+      if (otaActive) {
+        debugln("[OTA] Already waiting for an update");
+      } else if (otaTask == NULL) {
+        debugln("[OTA] ERROR: OTA task not running");
+      } else if (cfg.wifiSsid[0] != '\0' && cfg.wifiPassword[0] != '\0') {
+        otaActive = true;
+        xTaskNotifyGive(otaTask);
       } else {
         debugln("[OTA] ERROR: No WiFi credentials in NVS - cannot start OTA");
       }
@@ -225,25 +769,32 @@ void onCanRx(const twai_message_t &msg) {
   }
 
   // WiFi credential configuration message (ID 0x01)
-  else if (msg.identifier == 0x01) {
+  else if (msg.identifier == cfg.canIdWifiConfig) {
     handleWifiConfigMessage(msg);
   }
 
+  // Panel configuration message (ID 0x02)
+  else if (msg.identifier == config::CAN_ID_CONFIG) {
+    handleConfigMessage(msg);
+  }
+
+  // Diagnostic request (ID 0x03)
+  else if (msg.identifier == config::CAN_ID_DIAG_REQUEST) {
+    handleDiagRequest(msg);
+  }
+
   // LED control message (ID 0x1B) - updates LED backlights to show current state
-  else if (msg.identifier == 0x1B) {
+  else if (msg.identifier >= cfg.canIdLedState && msg.identifier < cfg.canIdLedState + cfg.pageCount) {
     // Expected: 8 bytes of LED data (0 = OFF, non-zero = ON)
     if (msg.data_length_code >= 8) {
-      debugln("[LED] LED state update received");
-
-      // Update LED backlights based on received state
-      digitalWrite(LED1_PIN, msg.data[0] > 0 ? HIGH : LOW);
-      digitalWrite(LED2_PIN, msg.data[1] > 0 ? HIGH : LOW);
-      digitalWrite(LED3_PIN, msg.data[2] > 0 ? HIGH : LOW);
-      digitalWrite(LED4_PIN, msg.data[3] > 0 ? HIGH : LOW);
-      digitalWrite(LED5_PIN, msg.data[4] > 0 ? HIGH : LOW);
-      digitalWrite(LED6_PIN, msg.data[5] > 0 ? HIGH : LOW);
-      digitalWrite(LED7_PIN, msg.data[6] > 0 ? HIGH : LOW);
-      digitalWrite(LED8_PIN, msg.data[7] > 0 ? HIGH : LOW);
+      uint8_t page = msg.identifier - cfg.canIdLedState;
+      debugf("[LED] Page %d state update received\n", page + 1);
+      ledStateSeen = true;
+
+      memcpy(ledCache[page], msg.data, config::NUM_BUTTONS);
+      if (page == activePage) {
+        showLedPage(page);
+      }
 
       debugf("[LED] Backlight states: %d,%d,%d,%d,%d,%d,%d,%d\n",
              msg.data[0], msg.data[1], msg.data[2], msg.data[3],
@@ -252,531 +803,704 @@ void onCanRx(const twai_message_t &msg) {
   }
 }
 
+/**
+ * CAN RX Callback - called when a CAN message is received
+ */
+void onCanRx(const twai_message_t &rxMsg) {
+  int64_t rxAtUs = esp_timer_get_time();   // Time sync reference point: first thing in the callback
+  taskPlan::adoptCurrentTask(taskPlan::ROLE_CAN_RX);
+  watchdog::enterRx();
+  idleSleep::noteRx(rxAtUs);
+  slcan::capture(rxMsg, rxAtUs);
+  busLoad::noteFrame(rxMsg);
+  heapHook::enter();
+  dispatchCanRx(rxMsg, rxAtUs);
+  heapHook::exit();
+  taskStats::addBusy(taskStats::MEASURED_CAN_RX, watchdog::leaveRx(config::get().rxSlaMs));
+}
+
 /**
  * CAN TX Callback - called when a CAN message transmission completes
  * Logs transmission result
  */
 void onCanTx(bool success) {
+  taskPlan::adoptCurrentTask(taskPlan::ROLE_CAN_TX);
   if (!success) {
+    flightRecorder::counters.txFailures++;
     debugln("[CAN] Transmission failed");
   }
 }
 
+/**
+ * Queue a frame built with a legacy 11-bit identifier.
+ * In J1939 mode the frame is rewritten to its Proprietary B PGN first.
+ */
+bool canSend(twai_message_t &message, uint8_t priority) {
+  idleSleep::noteActivity();
+  if (!message.extd && isRecordedId(config::get(), message.identifier)) {
+    flightRecorder::recordFrame(flightRecorder::ENTRY_CAN_TX, message);
+  }
+#if J1939_MODE
+  if (!j1939::encode(message, priority)) {
+    return false;
+  }
+#else
+  (void)priority;                     // Only J1939 frames carry a priority
+#endif
+  if (!TwaiTaskBased::send(message)) {
+    return false;
+  }
+  slcan::capture(message, esp_timer_get_time());   // The bridge shows the panel's own traffic too
+  busLoad::noteFrame(message);
+  return true;
+}
+
 /**
  * Send a CAN button message
- * Message format: ID=0x18, 1 byte containing button index (0-7)
+ * Message format: ID=0x18, 1 byte containing device index (page * 8 + slot)
  * The external controller receives this and toggles the light state,
  * then broadcasts the new state via CAN ID 0x1B for all panels to display
  */
-void send_message(int buttonIndex) {
+void send_message(int deviceIndex) {
   twai_message_t message;
-  message.identifier = 0x18;           // Button press message ID
-  message.extd = false;                // Standard CAN format
+  message.identifier = config::get().canIdButton;  // Button press message ID
+  message.extd = false;                // Standard CAN format (canSend() extends it in J1939 mode)
   message.rtr = false;
   message.data_length_code = 1;
-  message.data[0] = buttonIndex;       // Button index (0-7)
+  message.data[0] = deviceIndex;       // Device index (page * 8 + slot)
 
-  if (TwaiTaskBased::send(message)) {
-    debugf("[BTN] Button %d pressed - CAN message sent\n", buttonIndex + 1);
+  if (canSend(message, j1939::PRIORITY_CONTROL)) {
+    debugf("[BTN] Device %d toggle - CAN message sent\n", deviceIndex + 1);
   } else {
-    debugf("[BTN] Button %d pressed - CAN TX failed\n", buttonIndex + 1);
+    debugf("[BTN] Device %d toggle - CAN TX failed\n", deviceIndex + 1);
   }
 }
 
 /**
  * Send a CAN brightness control message
  * Message format: ID=0x015, 2 bytes [device_index, brightness]
- * Button N controls device N brightness on the CAN bus
+ * Each button controls the device assigned to it in the config store
  */
 void send_brightness_message(int deviceIndex, uint8_t brightness) {
   twai_message_t message;
-  message.identifier = 0x015;          // Brightness control message ID
-  message.extd = false;                // Standard CAN format
+  message.identifier = config::get().canIdBrightness;  // Brightness control message ID
+  message.extd = false;                // Standard CAN format (canSend() extends it in J1939 mode)
   message.rtr = false;
   message.data_length_code = 2;
-  message.data[0] = deviceIndex;       // Device index (0-7)
+  message.data[0] = deviceIndex;       // Device index (page * 8 + slot)
   message.data[1] = brightness;        // Brightness (0-255)
 
-  if (TwaiTaskBased::send(message)) {
+  if (canSend(message, j1939::PRIORITY_CONTROL)) {
     debugf("[BTN] Device %d brightness set to %d\n", deviceIndex + 1, brightness);
   } else {
     debugf("[BTN] Device %d brightness message failed\n", deviceIndex + 1);
   }
 }
 
+/**
+ * Fire a scene: send all of its steps back to back as packed batch frames
+ * Message format: ID=0x16, up to 4 steps of 2 bytes [op, value] per frame
+ *   op: action in bits 7-6 (0 = off, 1 = on, 2 = brightness), device index in bits 5-0
+ * The controller applies the steps in order and broadcasts the new state via
+ * CAN ID 0x1B as usual.
+ */
+void send_scene(uint8_t sceneIndex) {
+  const config::PanelConfig cfg = config::get();
+  const config::SceneStep *steps = cfg.scenes[sceneIndex];
+  const uint8_t stepsPerFrame = 8 / sizeof(config::SceneStep);
+  unsigned long start = debug_micros();
+  int frames = 0;
+  int stepCount = 0;
+
+  twai_message_t message;
+  message.identifier = cfg.canIdScene;
+  message.extd = false;                // Standard CAN format (canSend() extends it in J1939 mode)
+  message.rtr = false;
+  message.data_length_code = 0;
+
+  for (uint8_t i = 0; i < config::MAX_SCENE_STEPS; i++) {
+    if (steps[i].op == config::SCENE_STEP_UNUSED) continue;
+
+    memcpy(&message.data[message.data_length_code], &steps[i], sizeof(config::SceneStep));
+    message.data_length_code += sizeof(config::SceneStep);
+    stepCount++;
+
+    if (message.data_length_code == stepsPerFrame * sizeof(config::SceneStep)) {
+      frames += canSend(message, j1939::PRIORITY_CONTROL) ? 1 : 0;
+      message.identifier = cfg.canIdScene;   // canSend() may have rewritten it
+      message.extd = false;
+      message.data_length_code = 0;
+    }
+  }
+  if (message.data_length_code > 0) {
+    frames += canSend(message, j1939::PRIORITY_CONTROL) ? 1 : 0;
+  }
+
+  debugf("[SCENE] Scene %d: %d steps in %d frames queued\n", sceneIndex + 1, stepCount, frames);
+  debug_elapsed(start, "Scene batch queued");
+  (void)start;                        // Only read by the debug output
+}
+
+#if DEBUG == 1
+#define JITTER_REPORT_INTERVAL_MS 60000
+
+/**
+ * Scheduler callback: log timer firing jitter and heap usage once a minute
+ */
+void onJitterReport() {
+  scheduler::JitterStats stats = scheduler::stats();
+  if (stats.fired > 0) {
+    debugf("[SCHED] %lu timers fired, lateness avg %lu us, max %lu us\n",
+           (unsigned long)stats.fired, (unsigned long)(stats.totalLatenessUs / stats.fired),
+           (unsigned long)stats.maxLatenessUs);
+  }
+  debugf("[HEAP] Free %lu, min free %lu, largest block %lu bytes\n",
+         (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(),
+         (unsigned long)ESP.getMaxAllocHeap());
+  idleSleep::Stats sleepStats = idleSleep::stats();
+  if (sleepStats.sleeps > 0) {
+    debugf("[SLEEP] %lu sleeps, %lu s asleep, wakes: %lu button, %lu CAN (first frame after %lu us, max %lu us)\n",
+           (unsigned long)sleepStats.sleeps, (unsigned long)(sleepStats.asleepUs / 1000000),
+           (unsigned long)sleepStats.buttonWakes, (unsigned long)sleepStats.canWakes,
+           (unsigned long)sleepStats.lastWakeToFrameUs, (unsigned long)sleepStats.maxWakeToFrameUs);
+  }
+  busLoad::Stats bus = busLoad::stats();
+  debugf("[BUS] Load %u%%, throttle level %u, %lu brightness steps skipped, %lu bus errors, %lu arbitration lost\n",
+         bus.loadPercent, bus.level, (unsigned long)bus.throttledFrames, (unsigned long)bus.busErrors,
+         (unsigned long)bus.arbitrationLost);
+  watchdog::Stats wdt = watchdog::stats();
+  debugf("[WDT] SLA misses: %lu loop (worst gap %u ms), %lu CAN RX (worst %u ms)\n",
+         (unsigned long)wdt.violations[watchdog::WATCH_BUTTONS], wdt.worstMs[watchdog::WATCH_BUTTONS],
+         (unsigned long)wdt.violations[watchdog::WATCH_CAN_RX], wdt.worstMs[watchdog::WATCH_CAN_RX]);
+#if DEBUG_HEAP_HOOK
+  heapHook::Stats heap = heapHook::stats();
+  if (heap.hotAllocations > 0) {
+    debugf("[HEAP] %lu allocations on the RX path (last %lu bytes)\n",
+           (unsigned long)heap.hotAllocations, (unsigned long)heap.lastSize);
+  }
+#endif
+  scheduler::schedule(scheduler::TIMER_JITTER_REPORT, JITTER_REPORT_INTERVAL_MS, onJitterReport);
+}
+#endif
+
+// ============================================================================
+// Link-time hooks
+// ============================================================================
+// Symbols the linker binds by name must be defined exactly once, so they
+// live here rather than in the headers that hold their logic.
+
+/**
+ * Weak hook in ESP-IDF's task_wdt.c, called from the watchdog ISR
+ */
+extern "C" void IRAM_ATTR esp_task_wdt_isr_user_handler(void) {
+  watchdog::expired();
+}
+
+#if DEBUG_HEAP_HOOK
+extern "C" {
+  void *__real_malloc(size_t size);
+  void *__real_calloc(size_t n, size_t size);
+  void *__real_realloc(void *ptr, size_t size);
+
+  void *__wrap_malloc(size_t size) {
+    heapHook::count(size);
+    return __real_malloc(size);
+  }
+
+  void *__wrap_calloc(size_t n, size_t size) {
+    heapHook::count(n * size);
+    return __real_calloc(n, size);
+  }
+
+  void *__wrap_realloc(void *ptr, size_t size) {
+    heapHook::count(size);
+    return __real_realloc(ptr, size);
+  }
+}
+#endif
+
 void setup() {
-  Serial.begin(115200);
+  Serial.begin(SERIAL_CONSOLE_BAUD);
   delay(100);
 
   debugln("=== TrailCurrent Eight Button Panel ===");
   debugln("CAN Bus Control with OTA Updates");
 
-  // Initialize LED pins (outputs)
-  pinMode(LED1_PIN, OUTPUT);
-  pinMode(LED2_PIN, OUTPUT);
-  pinMode(LED3_PIN, OUTPUT);
-  pinMode(LED4_PIN, OUTPUT);
-  pinMode(LED5_PIN, OUTPUT);
-  pinMode(LED6_PIN, OUTPUT);
-  pinMode(LED7_PIN, OUTPUT);
-  pinMode(LED8_PIN, OUTPUT);
-
-  // Turn off all LEDs initially
-  digitalWrite(LED1_PIN, LOW);
-  digitalWrite(LED2_PIN, LOW);
-  digitalWrite(LED3_PIN, LOW);
-  digitalWrite(LED4_PIN, LOW);
-  digitalWrite(LED5_PIN, LOW);
-  digitalWrite(LED6_PIN, LOW);
-  digitalWrite(LED7_PIN, LOW);
-  digitalWrite(LED8_PIN, LOW);
+  // Load runtime configuration into RAM once
+  config::load();
+
+  // Start the flight recorder early so the boot is logged
+  flightRecorder::begin();
+
+  // Initialize LED pins (outputs) and turn off all LEDs initially
+  for (uint8_t i = 0; i < board::BUTTONS; i++) {
+    pinMode(ledPins[i], OUTPUT);
+    digitalWrite(ledPins[i], LOW);
+  }
 
   debugln("[LED] All LEDs initialized to OFF");
+  ledAnimation::begin(ledPins, board::BUTTONS);
 
-  // Initialize button pins (inputs with pullup)
-  pinMode(BTN1_PIN, INPUT_PULLUP);
-  pinMode(BTN2_PIN, INPUT_PULLUP);
-  pinMode(BTN3_PIN, INPUT_PULLUP);
-  pinMode(BTN4_PIN, INPUT_PULLUP);
-  pinMode(BTN5_PIN, INPUT_PULLUP);
-  pinMode(BTN6_PIN, INPUT_PULLUP);
-  pinMode(BTN7_PIN, INPUT_PULLUP);
-  pinMode(BTN8_PIN, INPUT_PULLUP);
+  // Initialize button pins (inputs with the internal pull-up unless the
+  // board has its own)
+  for (uint8_t i = 0; i < board::BUTTONS; i++) {
+    pinMode(buttonPins[i], board::Active::buttonMode(buttonPins[i]));
+  }
 
+  gestures::reset(recognizer);
   debugln("[BTN] All buttons initialized");
 
+  // Button handling priority on core 1; deadline timers run on this task
+  taskPlan::applyToLoopTask();
+  scheduler::begin();
+#if DEBUG == 1
+  scheduler::schedule(scheduler::TIMER_JITTER_REPORT, JITTER_REPORT_INTERVAL_MS, onJitterReport);
+#endif
+
   // Register CAN callbacks
   TwaiTaskBased::onReceive(onCanRx);
   TwaiTaskBased::onTransmit(onCanTx);
 
+  // Pick the bus bitrate: stored in NVS, or auto-detected on first boot.
+  // Holding the last button during power-up discards the stored value and
+  // re-probes.
+  bool forceBitrateProbe = (digitalRead(buttonPins[board::BUTTONS - 1]) == LOW);
+  if (forceBitrateProbe) {
+    debugf("[CAN] Button %d held - re-detecting bitrate\n", board::BUTTONS);
+  }
+  bool bitrateDetected;
+  busBitrate = canHelper::selectBitrate(config::get().canBitrate, forceBitrateProbe, bitrateDetected);
+  if (bitrateDetected) {
+    config::setU32(config::KEY_CAN_BITRATE, busBitrate);
+    debugln("[CAN] Detected bitrate saved to NVS");
+  }
+
   // Initialize CAN bus
-  // GPIO 15 = TX, GPIO 13 = RX, 500 kbps
-  if (!TwaiTaskBased::begin(GPIO_NUM_15, GPIO_NUM_13, 500000)) {
+  if (!TwaiTaskBased::begin(CAN_TX_PIN, CAN_RX_PIN, busBitrate)) {
     debugln("[CAN] ERROR: Failed to initialize CAN bus!");
     while (1) {  // Halt on CAN initialization failure
       delay(1000);
     }
   }
 
-  debugln("[CAN] CAN bus initialized successfully");
-  debugf("[OTA] Device hostname: %s\n", otaUpdate.getHostName().c_str());
+  debugf("[CAN] CAN bus initialized successfully at %lu bps\n", (unsigned long)busBitrate);
+  busLoad::begin(busBitrate);
+
+#if J1939_MODE
+  j1939::begin();
+#endif
+  loadNodeIdentity();
+  onTimeSync();
+  applySerialMode();
+
+  // A stored core dump from an earlier crash is advertised on CAN ID 0x1F
+  if (coredump::begin()) {
+    scheduler::schedule(scheduler::TIMER_COREDUMP_ADVERT, COREDUMP_FIRST_ADVERT_MS, onCoredumpAdvert);
+  }
+  scheduler::schedule(scheduler::TIMER_RESET_REPORT, RESET_REPORT_MS, onResetReport);
+  if (xTaskCreatePinnedToCore(otaTaskMain, "ota", taskPlan::STACK_OTA, NULL,
+                              taskPlan::PRIORITY_OTA, &otaTask, taskPlan::CORE_SYSTEM) != pdPASS) {
+    otaTask = NULL;
+    debugln("[OTA] ERROR: Failed to start OTA task");
+  }
+#if BENCHMARK
+  scheduler::schedule(scheduler::TIMER_BENCHMARK, BENCHMARK_START_MS, runBenchmarks);
+#endif
+#if J1939_MODE
+  debugln("[OTA] Ready to receive OTA trigger (PGN 0xFF00)");
+#else
   debugln("[OTA] Ready to receive OTA trigger (CAN ID 0x0)");
+#endif
+
+  // Loop and CAN RX latency SLAs; the task watchdog resets a stuck panel.
+  // Benchmark builds block the loop task for the whole run and leave it unarmed.
+  watchdog::begin(!BENCHMARK);
+  lastScanAt = esp_timer_get_time();        // The first scan is not late
+
   debugln("======================================");
   debugln("Normal operation started");
 }
 
-void loop() {
-  // HANDLE BTN01 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN1_PIN) == LOW) {
-    // Button is pressed
-    if (!btn01WasPressed) {
-      // Button just pressed (first detection)
-      btn01WasPressed = true;
-      btn01PressStartTime = millis();
-      btn01ToggleSent = false;
-      btn01InBrightnessMode = false;
-      debugln("[BTN] Button 1 pressed");
-    } else {
-      // Button is being held
-      unsigned long holdDuration = millis() - btn01PressStartTime;
-
-      // Send toggle message on first press (after debounce), before brightness mode
-      if (!btn01ToggleSent && !btn01InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn01ToggleSent = true;
-        debugln("[BTN] Button 1 short press - sending toggle");
-        send_message(0);
-      }
-
-      // Enter brightness adjustment mode after 700ms
-      if (holdDuration >= HOLD_THRESHOLD && !btn01InBrightnessMode) {
-        btn01InBrightnessMode = true;
-        btn01Brightness = 0;
-        btn01LastBrightnessUpdate = millis();
-        btn01ToggleSent = false;  // Reset toggle flag when entering brightness
-        debugln("[BTN] Button 1 entering brightness mode");
+/**
+ * Gesture handler - called synchronously from gestures::update()
+ *   Tap:        toggle (or fire the button's scene)
+ *   Tap cancel: the tap was the start of a double-tap or chord - toggle again
+ *               to undo it (scenes are not undone)
+ *   Double-tap: fire the button's double-tap scene
+ *   Chord:      buttons 1 + 8 switch device page
+ *   Hold:       brightness mode, one step per tick
+ */
+void onGesture(const gestures::Event &event) {
+  const config::PanelConfig cfg = config::get();
+  uint8_t i = event.button;
+  bool isSceneButton = (cfg.buttonDevice[i] & config::BUTTON_SCENE_FLAG) != 0;
+  uint8_t device = activePage * config::NUM_BUTTONS + cfg.buttonDevice[i];
+
+  uint8_t logged[4] = {i, event.mask, event.held, activePage};
+  flightRecorder::record(flightRecorder::ENTRY_BUTTON, event.type, logged, sizeof(logged));
+
+  switch (event.type) {
+    case gestures::EVENT_TAP:
+      if (isSceneButton) {
+        debugf("[BTN] Button %d short press - firing scene\n", i + 1);
+        send_scene(cfg.buttonDevice[i] & ~config::BUTTON_SCENE_FLAG);
+      } else {
+        debugf("[BTN] Button %d short press - sending toggle\n", i + 1);
+        send_message(device);
       }
+      break;
 
-      if (btn01InBrightnessMode) {
-        // Brightness adjustment mode - increment every 100ms
-        if ((millis() - btn01LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn01LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn01Brightness >= 255) {
-            btn01Brightness = 0;
-          } else {
-            btn01Brightness++;
-          }
-          send_brightness_message(0, btn01Brightness);
-        }
-      }
-    }
-  } else {
-    // Button is not pressed (released or never pressed)
-    if (btn01WasPressed) {
-      // Button was just released
-      if (btn01InBrightnessMode) {
-        // Long press released - brightness mode ended
-        debugf("[BTN] Button 1 brightness mode ended at %d\n", btn01Brightness);
+    case gestures::EVENT_TAP_CANCEL:
+      if (!isSceneButton) {
+        debugf("[BTN] Button %d tap retracted - sending correction toggle\n", i + 1);
+        send_message(device);
       }
+      break;
 
-      // Reset state
-      btn01WasPressed = false;
-      btn01ToggleSent = false;
-      btn01InBrightnessMode = false;
-    }
-  }
+    case gestures::EVENT_DOUBLE_TAP:
+      debugf("[BTN] Button %d double-tap\n", i + 1);
+      send_scene(cfg.doubleTapScene[i]);
+      break;
 
-  // HANDLE BTN02 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN2_PIN) == LOW) {
-    if (!btn02WasPressed) {
-      btn02WasPressed = true;
-      btn02PressStartTime = millis();
-      btn02ToggleSent = false;
-      btn02InBrightnessMode = false;
-      debugln("[BTN] Button 2 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn02PressStartTime;
-
-      if (!btn02ToggleSent && !btn02InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn02ToggleSent = true;
-        debugln("[BTN] Button 2 short press - sending toggle");
-        send_message(1);
+    case gestures::EVENT_CHORD:
+      if (event.mask == PAGE_CHORD_MASK) {
+        setActivePage((activePage + 1) % cfg.pageCount);
       }
+      break;
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn02InBrightnessMode) {
-        btn02InBrightnessMode = true;
-        btn02Brightness = 0;
-        btn02LastBrightnessUpdate = millis();
-        btn02ToggleSent = false;
-        debugln("[BTN] Button 2 entering brightness mode");
+    case gestures::EVENT_HOLD_START:
+      // Scene buttons have no brightness mode
+      if (!isSceneButton) {
+        buttonBrightness[i] = 0;
+        sentBrightness[i] = 0;
+        brightnessModeMask |= (1 << i);
+        debugf("[BTN] Button %d entering brightness mode\n", i + 1);
       }
+      break;
 
-      if (btn02InBrightnessMode) {
-        if ((millis() - btn02LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn02LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn02Brightness >= 255) {
-            btn02Brightness = 0;
-          } else {
-            btn02Brightness++;
-          }
-          send_brightness_message(1, btn02Brightness);
+    case gestures::EVENT_HOLD_TICK:
+      if (!isSceneButton) {
+        // Increment brightness and loop: 0 → 1 → ... → 255 → 0. The ramp
+        // keeps its speed under bus load; only some steps are sent.
+        buttonBrightness[i]++;
+        if (busLoad::admitStep(buttonBrightness[i] - 1)) {
+          send_brightness_message(device, buttonBrightness[i]);
+          sentBrightness[i] = buttonBrightness[i];
         }
       }
-    }
-  } else {
-    if (btn02WasPressed) {
-      if (btn02InBrightnessMode) {
-        debugf("[BTN] Button 2 brightness mode ended at %d\n", btn02Brightness);
+      break;
+
+    case gestures::EVENT_RELEASE:
+      brightnessModeMask &= ~(1 << i);
+      if (event.held && !isSceneButton) {
+        // Long press released - brightness mode ended; the final value always goes out
+        if (sentBrightness[i] != buttonBrightness[i]) {
+          send_brightness_message(device, buttonBrightness[i]);
+          sentBrightness[i] = buttonBrightness[i];
+        }
+        debugf("[BTN] Button %d brightness mode ended at %d\n", i + 1, buttonBrightness[i]);
       }
+      break;
+  }
+}
 
-      btn02WasPressed = false;
-      btn02ToggleSent = false;
-      btn02InBrightnessMode = false;
+/**
+ * Gesture bindings from the current configuration
+ */
+gestures::Bindings currentBindings(const config::PanelConfig &cfg) {
+  gestures::Bindings bindings = {};
+  for (uint8_t i = 0; i < board::BUTTONS; i++) {
+    if (cfg.doubleTapScene[i] != config::NO_SCENE) {
+      bindings.doubleTapMask |= (1 << i);
     }
   }
+  if (cfg.pageCount > 1) {
+    bindings.chords[0] = PAGE_CHORD_MASK;
+  }
+  return bindings;
+}
 
-  // HANDLE BTN03 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN3_PIN) == LOW) {
-    if (!btn03WasPressed) {
-      btn03WasPressed = true;
-      btn03PressStartTime = millis();
-      btn03ToggleSent = false;
-      btn03InBrightnessMode = false;
-      debugln("[BTN] Button 3 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn03PressStartTime;
-
-      if (!btn03ToggleSent && !btn03InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn03ToggleSent = true;
-        debugln("[BTN] Button 3 short press - sending toggle");
-        send_message(2);
-      }
+/**
+ * Read all buttons into a mask (bit N = button N+1 pressed)
+ */
+uint8_t readButtons() {
+  uint64_t levels = board::readButtonLevels();
+  uint8_t pressedMask = 0;
+  for (uint8_t i = 0; i < board::BUTTONS; i++) {
+    if (!(levels & board::bit(buttonPins[i]))) {
+      pressedMask |= (1 << i);
+    }
+  }
+  return pressedMask;
+}
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn03InBrightnessMode) {
-        btn03InBrightnessMode = true;
-        btn03Brightness = 0;
-        btn03LastBrightnessUpdate = millis();
-        btn03ToggleSent = false;
-        debugln("[BTN] Button 3 entering brightness mode");
-      }
+void onGestureDeadline();
 
-      if (btn03InBrightnessMode) {
-        if ((millis() - btn03LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn03LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn03Brightness >= 255) {
-            btn03Brightness = 0;
-          } else {
-            btn03Brightness++;
-          }
-          send_brightness_message(2, btn03Brightness);
-        }
-      }
-    }
+/**
+ * Run the gesture recognizer and arm the scheduler for its next deadline
+ * (debounce, hold threshold or brightness tick)
+ */
+void updateGestures(uint8_t pressedMask) {
+  const config::PanelConfig cfg = config::get();
+  idleSleep::noteActivity();
+  gestures::Timing timing = {
+    cfg.debounceMs, cfg.holdThresholdMs, cfg.brightnessIncrementMs,
+    cfg.doubleTapWindowMs, cfg.chordWindowMs
+  };
+
+  // Deadlines are aligned to millisecond boundaries of esp_timer so that
+  // millis() has reached the deadline when the timer fires
+  int64_t nowMsAligned = esp_timer_get_time() / 1000;
+  uint32_t nowMs = millis();
+  gestures::update(recognizer, pressedMask, nowMs, timing, currentBindings(cfg), onGesture);
+
+  uint32_t dueInMs = gestures::nextDeadline(recognizer, nowMs, timing);
+  if (dueInMs == gestures::NO_DEADLINE) {
+    scheduler::cancel(scheduler::TIMER_GESTURES);
   } else {
-    if (btn03WasPressed) {
-      if (btn03InBrightnessMode) {
-        debugf("[BTN] Button 3 brightness mode ended at %d\n", btn03Brightness);
-      }
+    scheduler::scheduleAt(scheduler::TIMER_GESTURES, (nowMsAligned + dueInMs) * 1000, onGestureDeadline);
+  }
+}
 
-      btn03WasPressed = false;
-      btn03ToggleSent = false;
-      btn03InBrightnessMode = false;
-    }
+/**
+ * Scheduler callback: a debounce, hold or brightness-tick deadline is due
+ */
+void onGestureDeadline() {
+  updateGestures(readButtons());
+}
+
+/**
+ * Scheduler callback: reverse a breathing status animation
+ */
+void onLedAnimationStep() {
+  uint32_t nextMs = ledAnimation::step();
+  if (nextMs != 0) {
+    scheduler::schedule(scheduler::TIMER_LED_ANIMATION, nextMs, onLedAnimationStep);
   }
+}
 
-  // HANDLE BTN04 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN4_PIN) == LOW) {
-    if (!btn04WasPressed) {
-      btn04WasPressed = true;
-      btn04PressStartTime = millis();
-      btn04ToggleSent = false;
-      btn04InBrightnessMode = false;
-      debugln("[BTN] Button 4 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn04PressStartTime;
-
-      if (!btn04ToggleSent && !btn04InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn04ToggleSent = true;
-        debugln("[BTN] Button 4 short press - sending toggle");
-        send_message(3);
-      }
+/**
+ * Show the most important panel status on the backlights, or the 0x1B
+ * display when there is none. Runs on every loop wake-up; only a change of
+ * status reaches the LEDC hardware.
+ */
+void updateStatusAnimation() {
+  ledAnimation::Status status = ledAnimation::STATUS_NONE;
+  uint8_t ledMask = (1 << board::BUTTONS) - 1;
+  if (otaActive) {
+    status = ledAnimation::STATUS_OTA;
+  } else if (canHelper::busOff()) {
+    status = ledAnimation::STATUS_BUS_OFF;
+  } else if (brightnessModeMask != 0) {
+    status = ledAnimation::STATUS_BRIGHTNESS;
+    ledMask = brightnessModeMask;           // Only the buttons being held
+  } else if (!ledStateSeen && millis() >= WAITING_FOR_CONTROLLER_MS) {
+    status = ledAnimation::STATUS_WAITING;
+  }
+  uint32_t stepMs = ledAnimation::show(status, ledMask);
+  if (stepMs != 0) {
+    scheduler::schedule(scheduler::TIMER_LED_ANIMATION, stepMs, onLedAnimationStep);
+  }
+}
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn04InBrightnessMode) {
-        btn04InBrightnessMode = true;
-        btn04Brightness = 0;
-        btn04LastBrightnessUpdate = millis();
-        btn04ToggleSent = false;
-        debugln("[BTN] Button 4 entering brightness mode");
-      }
+/**
+ * Light sleep is allowed once the panel has been quiet for the configured
+ * time (key 19) with no button held, no brightness ramp or gesture pending,
+ * nothing left to send and no OTA, transfer or probe in progress
+ */
+bool mayLightSleep() {
+  const config::PanelConfig cfg = config::get();
+  if (cfg.idleSleepMs == 0 || !idleSleep::quietFor(cfg.idleSleepMs)) return false;
+  if (recognizer.pressedMask != 0 || scheduler::isArmed(scheduler::TIMER_GESTURES)) return false;
+  if (otaActive || wifiConfigInProgress || bulk::isActive() || jitterProbe::isActive()) return false;
+  if (slcan::isActive()) return false;      // The host may send commands at any time
+  if (ledAnimation::isPlaying()) return false;   // LEDC stops with the APB clock
+  if (watchdog::rxInFlight()) return false;  // Watched until the callback returns
+  return !idleSleep::txPending();
+}
 
-      if (btn04InBrightnessMode) {
-        if ((millis() - btn04LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn04LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn04Brightness >= 255) {
-            btn04Brightness = 0;
-          } else {
-            btn04Brightness++;
-          }
-          send_brightness_message(3, btn04Brightness);
-        }
-      }
-    }
-  } else {
-    if (btn04WasPressed) {
-      if (btn04InBrightnessMode) {
-        debugf("[BTN] Button 4 brightness mode ended at %d\n", btn04Brightness);
-      }
+/**
+ * Sleep until the next deadline, a button or CAN activity. The frame that
+ * woke us from CAN was lost, so ask the controller to repeat its state.
+ */
+void lightSleep() {
+  idleSleep::WakeSource source = idleSleep::sleep(scheduler::nextDeadline(), buttonPins,
+                                                  board::BUTTONS, CAN_RX_PIN);
+  if (source == idleSleep::WAKE_NONE) return;
+  lastScanAt = esp_timer_get_time();        // Not a late scan
+  if (source == idleSleep::WAKE_CAN) {
+    twai_message_t message;
+    message.identifier = config::CAN_ID_DIAG;
+    idleSleep::buildWakeNotice(message, nodeMac);
+    canSend(message, j1939::PRIORITY_DEFAULT);
+  }
+}
 
-      btn04WasPressed = false;
-      btn04ToggleSent = false;
-      btn04InBrightnessMode = false;
-    }
+void loop() {
+  // Sleep until the next button scan or until a scheduler deadline wakes us
+  bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BUTTON_SCAN_PERIOD_MS)) > 0;
+  int64_t now = esp_timer_get_time();
+  if (!woken) {
+    jitterProbe::recordScan((uint32_t)(now - lastScanAt), BUTTON_SCAN_PERIOD_MS * 1000);
   }
+  const config::PanelConfig cfg = config::get();
+  watchdog::feed((uint32_t)(now - lastScanAt), cfg.scanSlaMs, cfg.rxSlaMs);
+  lastScanAt = now;
 
-  // HANDLE BTN05 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN5_PIN) == LOW) {
-    if (!btn05WasPressed) {
-      btn05WasPressed = true;
-      btn05PressStartTime = millis();
-      btn05ToggleSent = false;
-      btn05InBrightnessMode = false;
-      debugln("[BTN] Button 5 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn05PressStartTime;
-
-      if (!btn05ToggleSent && !btn05InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn05ToggleSent = true;
-        debugln("[BTN] Button 5 short press - sending toggle");
-        send_message(4);
-      }
+  uint8_t pressedMask = readButtons();
+  if (pressedMask != recognizer.pressedMask) {
+    updateGestures(pressedMask);
+  }
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn05InBrightnessMode) {
-        btn05InBrightnessMode = true;
-        btn05Brightness = 0;
-        btn05LastBrightnessUpdate = millis();
-        btn05ToggleSent = false;
-        debugln("[BTN] Button 5 entering brightness mode");
-      }
+  // Bus load estimate for throttling brightness streams and telemetry
+  busLoad::update(cfg.busLoadLimit);
 
-      if (btn05InBrightnessMode) {
-        if ((millis() - btn05LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn05LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn05Brightness >= 255) {
-            btn05Brightness = 0;
-          } else {
-            btn05Brightness++;
-          }
-          send_brightness_message(4, btn05Brightness);
-        }
-      }
-    }
-  } else {
-    if (btn05WasPressed) {
-      if (btn05InBrightnessMode) {
-        debugf("[BTN] Button 5 brightness mode ended at %d\n", btn05Brightness);
-      }
+  // Run due timers (gesture deadlines, config commit, timeouts) and re-arm
+  scheduler::run();
 
-      btn05WasPressed = false;
-      btn05ToggleSent = false;
-      btn05InBrightnessMode = false;
-    }
+  // SLCAN bridge: host commands in, one batch of frames out per scan
+  slcan::service(sendBridgeFrame);
+
+  updateStatusAnimation();
+  taskStats::addBusy(taskStats::MEASURED_LOOP, (uint32_t)(esp_timer_get_time() - now));
+
+  if (mayLightSleep()) {
+    lightSleep();
   }
+}
 
-  // HANDLE BTN06 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN6_PIN) == LOW) {
-    if (!btn06WasPressed) {
-      btn06WasPressed = true;
-      btn06PressStartTime = millis();
-      btn06ToggleSent = false;
-      btn06InBrightnessMode = false;
-      debugln("[BTN] Button 6 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn06PressStartTime;
-
-      if (!btn06ToggleSent && !btn06InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn06ToggleSent = true;
-        debugln("[BTN] Button 6 short press - sending toggle");
-        send_message(5);
-      }
+#if BENCHMARK
+// ============================================================================
+// Hot-path benchmarks
+// ============================================================================
+// Runs once, BENCHMARK_START_MS after boot, from the loop task; buttons are
+// not scanned while it runs. RX cases call dispatchCanRx() rather than
+// onCanRx(), which would adopt the loop task as the CAN RX task. Frames for
+// other panels use the inverted MAC suffix, and the WiFi transfer ends with
+// a wrong checksum, so the run changes no configuration. The TX case sends
+// BENCHMARK_DIAG_FRAME filler frames on CAN ID 0x1F.
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn06InBrightnessMode) {
-        btn06InBrightnessMode = true;
-        btn06Brightness = 0;
-        btn06LastBrightnessUpdate = millis();
-        btn06ToggleSent = false;
-        debugln("[BTN] Button 6 entering brightness mode");
-      }
+twai_message_t benchRxFrames[2];    // Alternated by iteration
 
-      if (btn06InBrightnessMode) {
-        if ((millis() - btn06LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn06LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn06Brightness >= 255) {
-            btn06Brightness = 0;
-          } else {
-            btn06Brightness++;
-          }
-          send_brightness_message(5, btn06Brightness);
-        }
-      }
-    }
-  } else {
-    if (btn06WasPressed) {
-      if (btn06InBrightnessMode) {
-        debugf("[BTN] Button 6 brightness mode ended at %d\n", btn06Brightness);
-      }
+/**
+ * Build a received frame from a legacy CAN ID (Proprietary B in J1939 builds)
+ */
+void benchFrame(twai_message_t &msg, uint8_t legacyId, const uint8_t *data, uint8_t length) {
+  memset(&msg, 0, sizeof(msg));
+  msg.identifier = legacyId;
+  msg.data_length_code = length;
+  memcpy(msg.data, data, length);
+#if J1939_MODE
+  msg.identifier = j1939::buildId(j1939::PRIORITY_DEFAULT, j1939::PGN_PROPRIETARY_B | legacyId, 0x80);
+  msg.extd = true;
+#endif
+}
 
-      btn06WasPressed = false;
-      btn06ToggleSent = false;
-      btn06InBrightnessMode = false;
-    }
+void benchNoop(uint32_t iteration) {
+}
+
+void benchButtonScan(uint32_t iteration) {
+  uint8_t pressedMask = readButtons();
+  if (pressedMask != recognizer.pressedMask) {
+    updateGestures(pressedMask);
   }
+}
 
-  // HANDLE BTN07 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN7_PIN) == LOW) {
-    if (!btn07WasPressed) {
-      btn07WasPressed = true;
-      btn07PressStartTime = millis();
-      btn07ToggleSent = false;
-      btn07InBrightnessMode = false;
-      debugln("[BTN] Button 7 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn07PressStartTime;
-
-      if (!btn07ToggleSent && !btn07InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn07ToggleSent = true;
-        debugln("[BTN] Button 7 short press - sending toggle");
-        send_message(6);
-      }
+void benchButtonUpdate(uint32_t iteration) {
+  // Button 2 pressed and released again well inside the debounce time
+  updateGestures((iteration & 1) ? 0x00 : 0x02);
+}
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn07InBrightnessMode) {
-        btn07InBrightnessMode = true;
-        btn07Brightness = 0;
-        btn07LastBrightnessUpdate = millis();
-        btn07ToggleSent = false;
-        debugln("[BTN] Button 7 entering brightness mode");
-      }
+void benchRx(uint32_t iteration) {
+  dispatchCanRx(benchRxFrames[iteration & 1], esp_timer_get_time());
+}
 
-      if (btn07InBrightnessMode) {
-        if ((millis() - btn07LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn07LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn07Brightness >= 255) {
-            btn07Brightness = 0;
-          } else {
-            btn07Brightness++;
-          }
-          send_brightness_message(6, btn07Brightness);
-        }
-      }
-    }
-  } else {
-    if (btn07WasPressed) {
-      if (btn07InBrightnessMode) {
-        debugf("[BTN] Button 7 brightness mode ended at %d\n", btn07Brightness);
-      }
+void benchLedApply(uint32_t iteration) {
+  ledCache[activePage][0] = iteration & 1;
+  showLedPage(activePage);
+}
 
-      btn07WasPressed = false;
-      btn07ToggleSent = false;
-      btn07InBrightnessMode = false;
-    }
-  }
+twai_message_t benchWifiFrames[6];
 
-  // HANDLE BTN08 - Short press = toggle, Long hold = brightness
-  if (digitalRead(BTN8_PIN) == LOW) {
-    if (!btn08WasPressed) {
-      btn08WasPressed = true;
-      btn08PressStartTime = millis();
-      btn08ToggleSent = false;
-      btn08InBrightnessMode = false;
-      debugln("[BTN] Button 8 pressed");
-    } else {
-      unsigned long holdDuration = millis() - btn08PressStartTime;
-
-      if (!btn08ToggleSent && !btn08InBrightnessMode && holdDuration >= debounceDelay && holdDuration < HOLD_THRESHOLD) {
-        btn08ToggleSent = true;
-        debugln("[BTN] Button 8 short press - sending toggle");
-        send_message(7);
-      }
+void benchWifiTransfer(uint32_t iteration) {
+  for (uint8_t i = 0; i < 6; i++) {
+    handleWifiConfigMessage(canHelper::viewOf(benchWifiFrames[i]));
+  }
+}
 
-      if (holdDuration >= HOLD_THRESHOLD && !btn08InBrightnessMode) {
-        btn08InBrightnessMode = true;
-        btn08Brightness = 0;
-        btn08LastBrightnessUpdate = millis();
-        btn08ToggleSent = false;
-        debugln("[BTN] Button 8 entering brightness mode");
-      }
+void benchTxEnqueue(uint32_t iteration) {
+  twai_message_t message;
+  message.identifier = config::CAN_ID_DIAG;
+  message.flags = 0;
+  message.data_length_code = 1;
+  message.data[0] = BENCHMARK_DIAG_FRAME;
+  canSend(message, j1939::PRIORITY_DEFAULT);
+}
 
-      if (btn08InBrightnessMode) {
-        if ((millis() - btn08LastBrightnessUpdate) >= BRIGHTNESS_INCREMENT) {
-          btn08LastBrightnessUpdate = millis();
-          // Increment brightness and loop: 0 → 1 → ... → 255 → 0
-          if (btn08Brightness >= 255) {
-            btn08Brightness = 0;
-          } else {
-            btn08Brightness++;
-          }
-          send_brightness_message(7, btn08Brightness);
-        }
-      }
+void runBenchmarks() {
+  const config::PanelConfig cfg = config::get();
+  uint8_t other[3] = {(uint8_t)~nodeMac[0], (uint8_t)~nodeMac[1], (uint8_t)~nodeMac[2]};
+
+  benchmark::run("harness_overhead", 10000, benchNoop);
+  benchmark::run("button_scan", 10000, benchButtonScan);
+  benchmark::run("button_state_update", 2000, benchButtonUpdate);
+  benchmark::run("led_apply", 2000, benchLedApply);
+
+  struct RxCase {
+    const char *name;
+    uint8_t id;
+    uint8_t data[8];
+    uint8_t length;
+  };
+  const RxCase rxCases[] = {
+    {"rx_ota_trigger_other_panel", (uint8_t)cfg.canIdOtaTrigger, {other[0], other[1], other[2]}, 3},
+    {"rx_wifi_config_idle", (uint8_t)cfg.canIdWifiConfig, {0x02, 0x00, 'b', 'e', 'n', 'c', 'h', '!'}, 8},
+    {"rx_config_other_panel", config::CAN_ID_CONFIG, {other[0], other[1], other[2], config::KEY_DEBOUNCE_MS, 50}, 6},
+    {"rx_diag_request_other_panel", config::CAN_ID_DIAG_REQUEST, {other[0], other[1], other[2], DIAG_CMD_TASK_STATS}, 6},
+    {"rx_diag", config::CAN_ID_DIAG, {BENCHMARK_DIAG_FRAME}, 1},
+    {"rx_time_sync_follow_up", config::CAN_ID_TIME_SYNC, {timeSync::FRAME_FOLLOW_UP}, 8},
+    {"rx_led_state", (uint8_t)cfg.canIdLedState, {}, 8},
+    {"rx_unhandled", 0x7E, {}, 8}
+  };
+  for (uint8_t c = 0; c < sizeof(rxCases) / sizeof(rxCases[0]); c++) {
+    const RxCase &rx = rxCases[c];
+    benchFrame(benchRxFrames[0], rx.id, rx.data, rx.length);
+    benchFrame(benchRxFrames[1], rx.id, rx.data, rx.length);
+    if (rx.id == cfg.canIdLedState) {
+      benchRxFrames[1].data[0] = 1;       // Button 1 backlight toggles every frame
     }
-  } else {
-    if (btn08WasPressed) {
-      if (btn08InBrightnessMode) {
-        debugf("[BTN] Button 8 brightness mode ended at %d\n", btn08Brightness);
-      }
+    benchmark::run(rx.name, 500, benchRx);
+  }
 
-      btn08WasPressed = false;
-      btn08ToggleSent = false;
-      btn08InBrightnessMode = false;
-    }
+  // One complete transfer per operation: start, 2 SSID chunks, 2 password chunks, end
+  const uint8_t wifiFrames[6][8] = {
+    {0x01, 10, 12},
+    {0x02, 0, 'T', 'r', 'a', 'i', 'l', 'e'},
+    {0x02, 1, 'r', '-', '4', '2'},
+    {0x03, 0, 'c', 'o', 'r', 'r', 'e', 'c'},
+    {0x03, 1, 't', '-', 'h', 'o', 'r', 's'},
+    {0x04, 0}
+  };
+  const uint8_t wifiLengths[6] = {3, 8, 6, 8, 8, 2};
+  uint8_t checksum = 0;
+  for (uint8_t i = 1; i <= 4; i++) {
+    for (uint8_t j = 2; j < wifiLengths[i]; j++) checksum ^= wifiFrames[i][j];
+  }
+  for (uint8_t i = 0; i < 6; i++) {
+    memset(&benchWifiFrames[i], 0, sizeof(benchWifiFrames[i]));
+    benchWifiFrames[i].identifier = cfg.canIdWifiConfig;
+    benchWifiFrames[i].data_length_code = wifiLengths[i];
+    memcpy(benchWifiFrames[i].data, wifiFrames[i], wifiLengths[i]);
   }
+  benchWifiFrames[5].data[1] = ~checksum;   // Rejected: nothing is saved
+  benchmark::run("wifi_config_transfer", 500, benchWifiTransfer);
+
+  benchmark::runSpaced("tx_enqueue", 100, TASK_STATS_FRAME_SPACING_MS, benchTxEnqueue);
 
-  // CAN I/O is handled by FreeRTOS tasks in TwaiTaskBased
-  // No polling required - just yield to let other tasks run
-  yield();
+  // Back to the real button and backlight state
+  memset(ledCache[activePage], 0, sizeof(ledCache[activePage]));
+  showLedPage(activePage);
+  updateGestures(readButtons());
+  Serial.println("{\"bench\":\"done\"}");
 }
+#endif
@@ -0,0 +1,195 @@
+#pragma once
+#include "globals.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ============================================================================
+// Deadline Scheduler
+// ============================================================================
+// One-shot timers with exact deadlines on a single esp_timer. Only the
+// earliest deadline is armed in hardware; when it expires the esp_timer task
+// notifies the owner task (the Arduino loop task), which runs every due
+// callback from run(). Between deadlines nothing is polled or compared.
+//
+// Timers live in a fixed table indexed by TimerId - no allocation, and a
+// linear scan over a handful of slots is cheaper here than a wheel.
+// schedule()/cancel() may be called from any task; callbacks always run on
+// the owner task.
+//
+// Firing jitter (actual run time minus deadline, including the task wake-up)
+// is recorded for every callback; see stats().
+
+namespace scheduler {
+
+  enum TimerId : uint8_t {
+    TIMER_GESTURES = 0,           // Next debounce/hold/tick deadline of the recognizer
+    TIMER_WIFI_CONFIG_TIMEOUT,    // Abandon a stalled WiFi credential transfer
+    TIMER_CONFIG_COMMIT,          // Deferred NVS commit of the config store
+    TIMER_JITTER_REPORT,          // Periodic jitter log (DEBUG builds)
+    TIMER_JITTER_PROBE_START,     // Start a requested jitter probe run
+    TIMER_JITTER_PROBE,           // Next jitter probe frame
+    TIMER_JITTER_PROBE_END,       // End of a jitter probe run
+    TIMER_TASK_STATS,             // Next task statistics snapshot
+    TIMER_TASK_STATS_FRAME,       // Next frame of the current snapshot
+    TIMER_BULK,                   // Bulk transfer start / flow control
+    TIMER_COREDUMP_ADVERT,        // Repeat the stored core dump advertisement
+    TIMER_TIME_SYNC,              // Time sync beacon (master) / loss check (followers)
+    TIMER_BENCHMARK,              // Start of the microbenchmark run (BENCHMARK builds)
+    TIMER_SERIAL_MODE,            // Switch the serial port between console and SLCAN
+    TIMER_BUS_LOAD_REPORT,        // Answer a bus load query
+    TIMER_LED_ANIMATION,          // Reverse the breathing status animation
+    TIMER_RESET_REPORT,           // Report the previous reset after boot
+    TIMER_SLA_REPORT,             // Answer an SLA violation query
+    TIMER_COUNT
+  };
+
+  typedef void (*Callback)(void);
+
+  struct Slot {
+    int64_t deadlineUs;
+    Callback callback;
+    bool armed;
+  };
+
+  struct JitterStats {
+    uint32_t fired;
+    uint32_t maxLatenessUs;
+    uint64_t totalLatenessUs;
+  };
+
+  static Slot slots[TIMER_COUNT];
+  static JitterStats jitter = {0, 0, 0};
+  static esp_timer_handle_t hwTimer = NULL;
+  static TaskHandle_t ownerTask = NULL;
+  static int64_t hwArmedFor = 0;        // Deadline currently armed, 0 = none
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  static void onHardwareTimer(void *arg) {
+    if (ownerTask != NULL) {
+      xTaskNotifyGive(ownerTask);
+    }
+  }
+
+  /**
+   * Create the hardware timer. Call once from the task that will call run().
+   */
+  inline void begin() {
+    ownerTask = xTaskGetCurrentTaskHandle();
+
+    esp_timer_create_args_t args = {};
+    args.callback = onHardwareTimer;
+    args.arg = NULL;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "scheduler";
+    if (esp_timer_create(&args, &hwTimer) != ESP_OK) {
+      debugln("[SCHED] ERROR: Failed to create esp_timer");
+    }
+  }
+
+  /**
+   * Arm (or re-arm) a timer for an absolute esp_timer_get_time() deadline
+   */
+  inline void scheduleAt(TimerId id, int64_t deadlineUs, Callback callback) {
+    portENTER_CRITICAL(&lock);
+    slots[id].deadlineUs = deadlineUs;
+    slots[id].callback = callback;
+    slots[id].armed = true;
+    portEXIT_CRITICAL(&lock);
+
+    // The owner re-arms the hardware timer at the end of run(); wake it if
+    // the new deadline came from another task
+    if (ownerTask != NULL && xTaskGetCurrentTaskHandle() != ownerTask) {
+      xTaskNotifyGive(ownerTask);
+    }
+  }
+
+  /**
+   * Arm (or re-arm) a timer delayMs from now
+   */
+  inline void schedule(TimerId id, uint32_t delayMs, Callback callback) {
+    scheduleAt(id, esp_timer_get_time() + (int64_t)delayMs * 1000, callback);
+  }
+
+  inline void cancel(TimerId id) {
+    portENTER_CRITICAL(&lock);
+    slots[id].armed = false;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  inline bool isArmed(TimerId id) {
+    return slots[id].armed;
+  }
+
+  /**
+   * Earliest armed deadline (esp_timer time), 0 = nothing armed
+   */
+  inline int64_t nextDeadline() {
+    int64_t earliest = 0;
+    portENTER_CRITICAL(&lock);
+    for (uint8_t id = 0; id < TIMER_COUNT; id++) {
+      if (slots[id].armed && (earliest == 0 || slots[id].deadlineUs < earliest)) {
+        earliest = slots[id].deadlineUs;
+      }
+    }
+    portEXIT_CRITICAL(&lock);
+    return earliest;
+  }
+
+  /**
+   * Run every due callback, then arm the hardware timer for the earliest
+   * remaining deadline. Call from the owner task after each wake-up.
+   */
+  inline void run() {
+    int64_t now = esp_timer_get_time();
+
+    for (uint8_t id = 0; id < TIMER_COUNT; id++) {
+      Callback due = NULL;
+      portENTER_CRITICAL(&lock);
+      if (slots[id].armed && slots[id].deadlineUs <= now) {
+        slots[id].armed = false;          // Callback may re-arm it
+        due = slots[id].callback;
+        uint32_t lateness = (uint32_t)(now - slots[id].deadlineUs);
+        jitter.fired++;
+        jitter.totalLatenessUs += lateness;
+        if (lateness > jitter.maxLatenessUs) {
+          jitter.maxLatenessUs = lateness;
+        }
+      }
+      portEXIT_CRITICAL(&lock);
+
+      if (due != NULL) {
+        due();
+        now = esp_timer_get_time();
+      }
+    }
+
+    int64_t earliest = nextDeadline();
+
+    // Leave the hardware timer alone if it is already armed for this deadline
+    if (hwTimer == NULL || (earliest == hwArmedFor && (earliest == 0 || earliest > esp_timer_get_time()))) {
+      return;
+    }
+    esp_timer_stop(hwTimer);
+    hwArmedFor = earliest;
+    if (earliest != 0) {
+      int64_t delay = earliest - esp_timer_get_time();
+      esp_timer_start_once(hwTimer, delay > 0 ? (uint64_t)delay : 0);
+    }
+  }
+
+  inline JitterStats stats() {
+    portENTER_CRITICAL(&lock);
+    JitterStats copy = jitter;
+    portEXIT_CRITICAL(&lock);
+    return copy;
+  }
+
+  inline void resetStats() {
+    portENTER_CRITICAL(&lock);
+    jitter.fired = 0;
+    jitter.maxLatenessUs = 0;
+    jitter.totalLatenessUs = 0;
+    portEXIT_CRITICAL(&lock);
+  }
+}
@@ -0,0 +1,383 @@
+#pragma once
+#include "globals.h"
+#include "esp_log.h"
+#include "driver/twai.h"
+
+// ============================================================================
+// SLCAN Bridge
+// ============================================================================
+// Turns the panel's serial port into a Lawicel/SLCAN CAN adapter, so a
+// laptop can sniff and inject trailer bus traffic without a separate USB-CAN
+// adapter (config key 20). The panel keeps working as a panel meanwhile.
+//
+//   slcand -o -c -s6 -S 921600 /dev/ttyUSB0 slcan0 && ip link set slcan0 up
+//
+// While the bridge is active the serial port runs at SLCAN_BAUD, and debug
+// output and ESP-IDF logging are muted. Received frames and the panel's own
+// frames are formatted where they happen (CAN RX task, sender) into a ring
+// buffer, and the loop task writes the ring to the UART in one batch per
+// scan period. A full ring drops frames and sets the overrun flag in 'F'.
+//
+// Commands (CR-terminated; answer CR = OK, BEL = error):
+//   S0-S8       Bitrate; only the panel's own bitrate is accepted
+//   O / L / C   Open / open listen-only (no injection) / close
+//   tIIILDD..   Send standard frame, T for 29-bit, r/R for remote frames
+//   Z0 / Z1     Timestamps off / on (ms modulo 60000, 4 hex digits)
+//   F           Status flags, V version, N serial number (MAC suffix)
+// Other standard commands (acceptance filter, M/m, X, W) are acknowledged
+// and ignored; the filter is the bus itself.
+//
+// At 921600 baud the port carries about 3500 full 8-byte frames per second
+// with timestamps, roughly 85% of a saturated 500 kbps bus. Boards whose
+// USB-UART bridge goes faster can raise SLCAN_BAUD.
+
+#ifndef SLCAN_BAUD
+#define SLCAN_BAUD 921600
+#endif
+
+namespace slcan {
+
+  typedef bool (*SendFn)(twai_message_t &msg);
+
+  const size_t RING_SIZE = 4096;              // ~150 timestamped frames
+  const size_t TX_BUFFER_SIZE = 2048;         // UART driver buffer behind Serial
+  const uint8_t MAX_LINE = 32;                // Longest frame line + CR
+  const char REPLY_OK = '\r';
+  const char REPLY_ERROR = '\a';
+
+  // Lawicel S0..S8
+  const uint32_t BITRATES[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000};
+
+  // Status flags ('F')
+  const uint8_t FLAG_ERROR_WARNING = 0x04;
+  const uint8_t FLAG_DATA_OVERRUN = 0x08;
+  const uint8_t FLAG_ERROR_PASSIVE = 0x20;
+  const uint8_t FLAG_BUS_ERROR = 0x80;
+
+  static bool active = false;                 // Serial port belongs to the bridge
+  static volatile bool channelOpen = false;
+  static bool listenOnly = false;
+  static volatile bool timestamps = false;
+  static uint32_t busBitrate = 0;
+  static const uint8_t *serialNumber = NULL;  // MAC suffix, 3 bytes
+
+  static char ring[RING_SIZE];
+  static size_t head = 0;                     // Next write
+  static size_t tail = 0;                     // Next byte to send
+  static volatile bool overrun = false;
+  static uint32_t dropped = 0;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  static char line[MAX_LINE];
+  static uint8_t lineLength = 0;
+  static bool discarding = false;             // Rest of an overlong line
+
+  static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+  inline bool isActive() {
+    return active;
+  }
+
+  static char *putHex(char *p, uint32_t value, uint8_t digits) {
+    for (int8_t i = digits - 1; i >= 0; i--) {
+      p[i] = HEX_DIGITS[value & 0x0F];
+      value >>= 4;
+    }
+    return p + digits;
+  }
+
+  static int8_t hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+  }
+
+  static bool parseHex(const char *p, uint8_t digits, uint32_t &value) {
+    value = 0;
+    for (uint8_t i = 0; i < digits; i++) {
+      int8_t v = hexValue(p[i]);
+      if (v < 0) {
+        return false;
+      }
+      value = (value << 4) | v;
+    }
+    return true;
+  }
+
+  /**
+   * Append bytes to the output ring, all or nothing. Safe from any task.
+   */
+  static bool enqueue(const char *data, size_t len) {
+    bool stored = false;
+    portENTER_CRITICAL(&lock);
+    size_t used = (head - tail + RING_SIZE) % RING_SIZE;
+    if (used + len < RING_SIZE) {
+      for (size_t i = 0; i < len; i++) {
+        ring[head] = data[i];
+        head = (head + 1) % RING_SIZE;
+      }
+      stored = true;
+    } else {
+      overrun = true;
+      dropped++;
+    }
+    portEXIT_CRITICAL(&lock);
+    return stored;
+  }
+
+  static void reply(char c) {
+    enqueue(&c, 1);
+  }
+
+  /**
+   * Switch the serial port to the bridge: SLCAN_BAUD, debug and IDF logs off.
+   * Call from the loop task.
+   */
+  inline void begin(uint32_t bitrate, const uint8_t *macSuffix) {
+    busBitrate = bitrate;
+    serialNumber = macSuffix;
+    if (active) {
+      return;
+    }
+    debugf("[SLCAN] Bridge on, serial now %lu baud\n", (unsigned long)SLCAN_BAUD);
+    Serial.flush();
+    Serial.end();
+    Serial.setTxBufferSize(TX_BUFFER_SIZE);
+    Serial.begin(SLCAN_BAUD);
+    esp_log_level_set("*", ESP_LOG_NONE);
+    debugMuted = true;
+    channelOpen = false;
+    lineLength = 0;
+    discarding = false;
+    active = true;
+  }
+
+  /**
+   * Give the serial port back to the debug console
+   */
+  inline void end(unsigned long consoleBaud) {
+    if (!active) {
+      return;
+    }
+    active = false;
+    channelOpen = false;
+    Serial.flush();
+    Serial.end();
+    Serial.begin(consoleBaud);
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    debugMuted = false;
+    debugf("[SLCAN] Bridge off, %lu frames dropped\n", (unsigned long)dropped);
+  }
+
+  /**
+   * A frame seen on the bus (received, or sent by this panel). Formats it
+   * into the ring while the channel is open. Safe from any task.
+   */
+  inline void capture(const twai_message_t &msg, int64_t atUs) {
+    if (!channelOpen) {
+      return;
+    }
+    char buf[MAX_LINE];
+    char *p = buf;
+    uint8_t length = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+    if (msg.extd) {
+      *p++ = msg.rtr ? 'R' : 'T';
+      p = putHex(p, msg.identifier & 0x1FFFFFFF, 8);
+    } else {
+      *p++ = msg.rtr ? 'r' : 't';
+      p = putHex(p, msg.identifier & 0x7FF, 3);
+    }
+    *p++ = HEX_DIGITS[length];
+    if (!msg.rtr) {
+      for (uint8_t i = 0; i < length; i++) {
+        p = putHex(p, msg.data[i], 2);
+      }
+    }
+    if (timestamps) {
+      p = putHex(p, (uint32_t)((atUs / 1000) % 60000), 4);
+    }
+    *p++ = REPLY_OK;
+    enqueue(buf, p - buf);
+  }
+
+  static uint8_t statusFlags() {
+    uint8_t flags = 0;
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) == ESP_OK) {
+      if (status.tx_error_counter >= 96 || status.rx_error_counter >= 96) flags |= FLAG_ERROR_WARNING;
+      if (status.tx_error_counter >= 128 || status.rx_error_counter >= 128) flags |= FLAG_ERROR_PASSIVE;
+      if (status.state == TWAI_STATE_BUS_OFF) flags |= FLAG_BUS_ERROR;
+    }
+    if (overrun) {
+      overrun = false;
+      flags |= FLAG_DATA_OVERRUN;
+    }
+    return flags;
+  }
+
+  /**
+   * Parse and send a t/T/r/R line
+   */
+  static bool injectFrame(SendFn send) {
+    bool extended = line[0] == 'T' || line[0] == 'R';
+    bool remote = line[0] == 'r' || line[0] == 'R';
+    uint8_t idDigits = extended ? 8 : 3;
+    uint32_t identifier;
+    uint32_t length;
+    if (lineLength < idDigits + 2 || !parseHex(&line[1], idDigits, identifier) ||
+        !parseHex(&line[1 + idDigits], 1, length) || length > 8) {
+      return false;
+    }
+    if (identifier > (extended ? 0x1FFFFFFFUL : 0x7FFUL)) {
+      return false;
+    }
+
+    twai_message_t msg;
+    msg.flags = 0;
+    msg.extd = extended;
+    msg.rtr = remote;
+    msg.identifier = identifier;
+    msg.data_length_code = length;
+    const char *data = &line[2 + idDigits];
+    if (!remote) {
+      if (lineLength < idDigits + 2 + length * 2) {
+        return false;
+      }
+      for (uint8_t i = 0; i < length; i++) {
+        uint32_t value;
+        if (!parseHex(&data[i * 2], 2, value)) {
+          return false;
+        }
+        msg.data[i] = value;
+      }
+    }
+    return send(msg);
+  }
+
+  static void handleLine(SendFn send) {
+    char response[8];
+    switch (line[0]) {
+      case 'S':
+        if (channelOpen || lineLength != 2 || line[1] < '0' || line[1] > '8') {
+          reply(REPLY_ERROR);
+        } else {
+          // The panel's bitrate is its own configuration (key 9)
+          reply(BITRATES[line[1] - '0'] == busBitrate ? REPLY_OK : REPLY_ERROR);
+        }
+        break;
+
+      case 'O':
+      case 'L':
+        if (channelOpen) {
+          reply(REPLY_ERROR);
+        } else {
+          listenOnly = line[0] == 'L';
+          channelOpen = true;
+          reply(REPLY_OK);
+        }
+        break;
+
+      case 'C':
+        channelOpen = false;
+        reply(REPLY_OK);
+        break;
+
+      case 't':
+      case 'T':
+      case 'r':
+      case 'R':
+        if (!channelOpen || listenOnly || !injectFrame(send)) {
+          reply(REPLY_ERROR);
+        } else {
+          reply(line[0] == 't' || line[0] == 'r' ? 'z' : 'Z');
+          reply(REPLY_OK);
+        }
+        break;
+
+      case 'Z':
+        timestamps = lineLength > 1 && line[1] == '1';
+        reply(REPLY_OK);
+        break;
+
+      case 'F':
+        response[0] = 'F';
+        putHex(&response[1], statusFlags(), 2);
+        response[3] = REPLY_OK;
+        enqueue(response, 4);
+        break;
+
+      case 'V':
+        enqueue("V1013\r", 6);
+        break;
+
+      case 'N':
+        response[0] = 'N';
+        putHex(&response[1], serialNumber != NULL ? (serialNumber[1] << 8) | serialNumber[2] : 0, 4);
+        response[5] = REPLY_OK;
+        enqueue(response, 6);
+        break;
+
+      case 'M':
+      case 'm':
+      case 'X':
+      case 'W':
+      case 'Q':
+        reply(REPLY_OK);                      // Accepted, no effect
+        break;
+
+      default:
+        reply(REPLY_ERROR);
+        break;
+    }
+  }
+
+  /**
+   * Loop task, once per scan: handle host commands, then write what the
+   * ring holds as far as the UART buffer takes it
+   */
+  inline void service(SendFn send) {
+    if (!active) {
+      return;
+    }
+
+    while (Serial.available() > 0) {
+      char c = (char)Serial.read();
+      if (c == '\r') {
+        if (discarding) {
+          reply(REPLY_ERROR);
+        } else if (lineLength > 0) {
+          handleLine(send);
+        } else {
+          reply(REPLY_OK);                    // Empty line: hosts use it to resync
+        }
+        lineLength = 0;
+        discarding = false;
+      } else if (c != '\n' && !discarding) {
+        if (lineLength < MAX_LINE) {
+          line[lineLength++] = c;
+        } else {
+          discarding = true;                  // Overlong line, drop it
+        }
+      }
+    }
+
+    // Batched output: at most two writes (the ring may wrap)
+    size_t room = Serial.availableForWrite();
+    while (room > 0) {
+      portENTER_CRITICAL(&lock);
+      size_t start = tail;
+      size_t contiguous = head >= tail ? head - tail : RING_SIZE - tail;
+      portEXIT_CRITICAL(&lock);
+      if (contiguous == 0) {
+        break;
+      }
+      size_t chunk = contiguous < room ? contiguous : room;
+      Serial.write((const uint8_t *)&ring[start], chunk);
+      portENTER_CRITICAL(&lock);
+      tail = (tail + chunk) % RING_SIZE;
+      portEXIT_CRITICAL(&lock);
+      room -= chunk;
+    }
+  }
+}
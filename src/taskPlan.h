@@ -0,0 +1,71 @@
+#pragma once
+#include "globals.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ============================================================================
+// Task Placement Plan
+// ============================================================================
+// Which core and priority every firmware task runs at. Core 0 (PRO_CPU)
+// belongs to the WiFi/lwIP stack and esp_timer; anything that can stall for
+// long - OTA, logging - goes there at low priority. Core 1 (APP_CPU) runs the
+// time-critical work: CAN RX/TX above button handling, both above idle.
+//
+//   Task              Core   Priority   Notes
+//   CAN RX / TX       1*     10         * see adoptCurrentTask()
+//   Buttons (loop)    1      5          Arduino loopTask, default priority 1
+//   OTA               0      2          Only while an update is running
+//   Logger            0      1          Background logging (none yet)
+//   Jitter load       0      2          Synthetic OTA stand-in (jitterProbe.h)
+//
+// For reference, IDF system tasks on core 0: WiFi 23, esp_timer 22, lwIP 18.
+// A busy WiFi stack therefore still delays esp_timer callbacks; the jitter
+// probe measures how much.
+
+namespace taskPlan {
+
+  const BaseType_t CORE_SYSTEM = 0;       // PRO_CPU: WiFi, lwIP, esp_timer
+  const BaseType_t CORE_REALTIME = 1;     // APP_CPU: CAN and buttons
+
+  const UBaseType_t PRIORITY_CAN = 10;
+  const UBaseType_t PRIORITY_BUTTONS = 5;
+  const UBaseType_t PRIORITY_OTA = 2;
+  const UBaseType_t PRIORITY_LOGGER = 1;
+
+  const uint32_t STACK_OTA = 8192;
+  const uint32_t STACK_LOGGER = 3072;
+
+  enum TaskRole : uint8_t {
+    ROLE_CAN_RX = 0,
+    ROLE_CAN_TX,
+    ROLE_COUNT
+  };
+
+  static TaskHandle_t adopted[ROLE_COUNT] = {};
+
+  /**
+   * Put the calling task (the Arduino loop task) at button-handling priority.
+   * loopTask is already pinned to CORE_REALTIME by the Arduino core.
+   */
+  inline void applyToLoopTask() {
+    vTaskPrioritySet(NULL, PRIORITY_BUTTONS);
+    debugf("[TASK] loop: core %d, priority %u\n", (int)xPortGetCoreID(), (unsigned)PRIORITY_BUTTONS);
+  }
+
+  /**
+   * Adopt a task created by a library from inside one of its callbacks and
+   * raise it to CAN priority. Only the first call per role does any work.
+   * The library creates its tasks without core affinity and FreeRTOS cannot
+   * re-pin a task after creation, so the core is logged, not enforced.
+   */
+  inline void adoptCurrentTask(TaskRole role) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (adopted[role] == self) {
+      return;
+    }
+    adopted[role] = self;
+    vTaskPrioritySet(self, PRIORITY_CAN);
+    debugf("[TASK] CAN %s: adopted on core %d, priority %u\n",
+           role == ROLE_CAN_RX ? "RX" : "TX", (int)xPortGetCoreID(), (unsigned)PRIORITY_CAN);
+  }
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include "globals.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+// ============================================================================
+// Task Statistics
+// ============================================================================
+// Periodic snapshot of every FreeRTOS task: CPU share over the last sampling
+// interval and stack high-water mark (the least free stack the task has ever
+// had). Snapshots are taken on demand by the caller and published as compact
+// diagnostic frames, so a field unit can be profiled over CAN without a
+// serial cable.
+//
+// Needs configUSE_TRACE_FACILITY (set in the Arduino core). The prebuilt
+// Arduino core leaves configGENERATE_RUN_TIME_STATS off, so the panel times
+// its own work: the loop task around each wake-up's work and the CAN RX task
+// around onCanRx() (the points the watchdog SLAs use). Their share is busy
+// wall time over the interval, so time spent preempted inside that work
+// counts too. Other tasks get their share from the run time stats if they
+// are compiled in, CPU_UNKNOWN otherwise.
+
+namespace taskStats {
+
+  const uint8_t MAX_TASKS = 24;
+  const uint8_t FRAME_TYPE = 0x02;          // Diagnostic frame type: task stats
+  const uint8_t LAST_TASK_FLAG = 0x80;      // Task number byte: final frame of a snapshot
+  const uint8_t CPU_UNKNOWN = 0xFF;         // Not measured and no run time stats
+  const uint8_t NAME_BYTES = 3;
+
+  struct TaskSample {
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t cpuHalfPercent;                 // Share of one core, 0.5% units (0-200)
+    uint32_t stackFreeBytes;                // High-water mark
+    UBaseType_t priority;
+  };
+
+#if configUSE_TRACE_FACILITY
+  static TaskStatus_t status[MAX_TASKS];
+#endif
+  static TaskSample samples[MAX_TASKS];
+  static uint8_t sampleCount = 0;
+
+  enum Measured : uint8_t {
+    MEASURED_LOOP = 0,                      // loop(): scan, gestures, timers, TX
+    MEASURED_CAN_RX,                        // onCanRx()
+    MEASURED_COUNT
+  };
+
+  // Busy time since the previous snapshot, per measured task
+  static TaskHandle_t measuredHandle[MEASURED_COUNT] = {};
+  static uint64_t busyUs[MEASURED_COUNT] = {};
+  static int64_t busySinceUs = 0;           // Previous snapshot
+  static bool busyBaseline = false;         // busySinceUs is set
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  /**
+   * Count us of work done by the calling task, which is the measured task who
+   */
+  inline void addBusy(Measured who, uint32_t us) {
+    measuredHandle[who] = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&lock);
+    busyUs[who] += us;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  inline uint8_t measuredShare(TaskHandle_t handle, const uint64_t *busy, int64_t intervalUs) {
+    for (uint8_t m = 0; m < MEASURED_COUNT; m++) {
+      if (measuredHandle[m] == handle && handle != NULL && intervalUs > 0) {
+        uint64_t share = busy[m] * 200 / (uint64_t)intervalUs;
+        return share > 200 ? 200 : (uint8_t)share;
+      }
+    }
+    return CPU_UNKNOWN;
+  }
+
+  // Run time counters from the previous snapshot, matched by task handle
+  static TaskHandle_t previousHandle[MAX_TASKS];
+  static uint32_t previousRunTime[MAX_TASKS];
+  static uint8_t previousCount = 0;
+  static uint32_t previousTotal = 0;
+
+  inline uint32_t previousRunTimeOf(TaskHandle_t handle, bool &found) {
+    for (uint8_t i = 0; i < previousCount; i++) {
+      if (previousHandle[i] == handle) {
+        found = true;
+        return previousRunTime[i];
+      }
+    }
+    found = false;
+    return 0;
+  }
+
+  /**
+   * Take a snapshot of all tasks. CPU shares cover the time since the
+   * previous call (the first call has no baseline and reports CPU_UNKNOWN).
+   * Returns the number of tasks captured.
+   */
+  inline uint8_t sample() {
+#if configUSE_TRACE_FACILITY
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(status, MAX_TASKS, &total);
+    if (count == 0) {
+      debugln("[TASKS] ERROR: More tasks than MAX_TASKS");
+      return sampleCount = 0;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    uint64_t busy[MEASURED_COUNT];
+    portENTER_CRITICAL(&lock);
+    memcpy(busy, busyUs, sizeof(busy));
+    memset(busyUs, 0, sizeof(busyUs));
+    int64_t intervalUs = busyBaseline ? nowUs - busySinceUs : 0;
+    busySinceUs = nowUs;
+    busyBaseline = true;
+    portEXIT_CRITICAL(&lock);
+
+    uint32_t elapsed = total - previousTotal;
+    for (UBaseType_t i = 0; i < count; i++) {
+      TaskSample &s = samples[i];
+      strncpy(s.name, status[i].pcTaskName, sizeof(s.name) - 1);
+      s.name[sizeof(s.name) - 1] = '\0';
+      s.stackFreeBytes = status[i].usStackHighWaterMark;
+      s.priority = status[i].uxCurrentPriority;
+      s.cpuHalfPercent = measuredShare(status[i].xHandle, busy, intervalUs);
+#if configGENERATE_RUN_TIME_STATS
+      bool found;
+      uint32_t before = previousRunTimeOf(status[i].xHandle, found);
+      if (s.cpuHalfPercent == CPU_UNKNOWN && found && previousTotal != 0 && elapsed > 0) {
+        uint64_t share = (uint64_t)(status[i].ulRunTimeCounter - before) * 200 / elapsed;
+        s.cpuHalfPercent = share > 200 ? 200 : (uint8_t)share;
+      }
+#endif
+    }
+
+    // Baseline for the next snapshot (after all lookups above)
+    for (UBaseType_t i = 0; i < count; i++) {
+      previousHandle[i] = status[i].xHandle;
+      previousRunTime[i] = status[i].ulRunTimeCounter;
+    }
+    previousCount = count;
+    previousTotal = total;
+    (void)elapsed;
+    return sampleCount = count;
+#else
+    debugln("[TASKS] configUSE_TRACE_FACILITY is off - no task list available");
+    return sampleCount = 0;
+#endif
+  }
+
+  inline uint8_t count() {
+    return sampleCount;
+  }
+
+  /**
+   * Fill the diagnostic frame for one task of the last snapshot (8 bytes,
+   * identifier set by the caller):
+   * [type, task number | last flag, cpu 0.5% units, stack free LE16, name0-2]
+   */
+  inline void buildFrame(uint8_t index, twai_message_t &msg) {
+    const TaskSample &s = samples[index];
+    uint16_t stackFree = s.stackFreeBytes > 0xFFFF ? 0xFFFF : (uint16_t)s.stackFreeBytes;
+
+    msg.flags = 0;
+    msg.data_length_code = 8;
+    msg.data[0] = FRAME_TYPE;
+    msg.data[1] = index | (index == sampleCount - 1 ? LAST_TASK_FLAG : 0);
+    msg.data[2] = s.cpuHalfPercent;
+    memcpy(&msg.data[3], &stackFree, sizeof(stackFree));
+    memset(&msg.data[5], 0, NAME_BYTES);
+    memcpy(&msg.data[5], s.name, strnlen(s.name, NAME_BYTES));
+  }
+
+  /**
+   * Print the last snapshot
+   */
+  inline void log() {
+    for (uint8_t i = 0; i < sampleCount; i++) {
+      const TaskSample &s = samples[i];
+      if (s.cpuHalfPercent == CPU_UNKNOWN) {
+        debugf("[TASKS] %-16s prio %2u  cpu   n/a  stack free %5lu\n",
+               s.name, (unsigned)s.priority, (unsigned long)s.stackFreeBytes);
+      } else {
+        debugf("[TASKS] %-16s prio %2u  cpu %3u.%u%%  stack free %5lu\n",
+               s.name, (unsigned)s.priority, s.cpuHalfPercent / 2, (s.cpuHalfPercent & 1) * 5,
+               (unsigned long)s.stackFreeBytes);
+      }
+    }
+  }
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include "globals.h"
+#include "canHelper.h"
+#include "esp_timer.h"
+
+// ============================================================================
+// Time Synchronization
+// ============================================================================
+// Shared microsecond timebase across the panels on one bus, so flight logs
+// from several panels can be merged and a press on one panel matched to the
+// backlight update on another.
+//
+// One panel is the master (config key 18). Once a second it sends a SYNC
+// frame with self-reception. A CAN frame reaches every node at the same bus
+// instant, so each node - the master included - timestamps SYNC at the top
+// of its RX callback. The master then sends FOLLOW_UP with its own receive
+// timestamp, and each follower pairs the two:
+//
+//   SYNC      [0x01, seq]
+//   FOLLOW_UP [0x02, seq, master receive time us LE48]
+//
+// Two-step sync avoids any dependency on when the SYNC frame wins
+// arbitration. What remains is the difference in RX callback latency
+// between nodes (tens of microseconds when idle).
+//
+// A follower steps its offset to every accepted pair and estimates the
+// crystal drift from consecutive pairs, so now() stays on the master's
+// clock between beacons. Pairs that disagree with the prediction by more
+// than OUTLIER_US are rejected, unless that happens MAX_REJECTS times in a
+// row. epoch() changes whenever now() may jump: sync acquired or lost, or a
+// step larger than STEP_US. Log writers use it to re-anchor their times.
+
+namespace timeSync {
+
+  const uint8_t FRAME_SYNC = 0x01;
+  const uint8_t FRAME_FOLLOW_UP = 0x02;
+  const uint32_t INTERVAL_MS = 1000;
+  const uint8_t LOST_AFTER_INTERVALS = 5;     // Missed beacons before falling back to local time
+  const int64_t OUTLIER_US = 500;
+  const int64_t STEP_US = 1000;               // Larger corrections start a new epoch
+  const uint8_t MAX_REJECTS = 3;
+  const int32_t MAX_DRIFT_PPB = 200000;       // 200 ppm, well beyond any crystal
+
+  static bool master = false;
+  static bool synced = false;
+  static uint16_t epochCounter = 0;
+  static uint8_t sendSequence = 0;
+
+  // Follower state
+  static uint8_t syncSequence = 0;
+  static int64_t syncLocalUs = 0;             // Local receive time of the last SYNC, 0 = none pending
+  static int64_t anchorLocalUs = 0;           // Last accepted pair
+  static int64_t anchorMasterUs = 0;
+  static int32_t driftPpb = 0;                // Master clock rate relative to ours
+  static uint8_t rejects = 0;
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  static int64_t predict(int64_t localUs) {
+    int64_t elapsed = localUs - anchorLocalUs;
+    return anchorMasterUs + elapsed + elapsed * driftPpb / 1000000000LL;
+  }
+
+  /**
+   * Shared time in microseconds. Local esp_timer time on the master and
+   * while unsynced. Safe from any task.
+   */
+  inline int64_t now() {
+    int64_t local = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    int64_t t = (synced && !master) ? predict(local) : local;
+    portEXIT_CRITICAL(&lock);
+    return t;
+  }
+
+  inline bool isSynced() {
+    return synced;
+  }
+
+  inline uint16_t epoch() {
+    return epochCounter;
+  }
+
+  inline int32_t drift() {
+    return driftPpb;
+  }
+
+  /**
+   * Select the master role. A master's own clock is the shared timebase.
+   */
+  inline void setMaster(bool enable) {
+    if (enable == master) {
+      return;
+    }
+    portENTER_CRITICAL(&lock);
+    master = enable;
+    synced = enable;
+    syncLocalUs = 0;
+    epochCounter++;
+    portEXIT_CRITICAL(&lock);
+    debugln(enable ? "[TIME] Master - sending sync beacons" : "[TIME] Follower");
+  }
+
+  /**
+   * Periodic work (every INTERVAL_MS): fill msg with a SYNC frame and return
+   * true on the master; detect a lost master on followers.
+   */
+  inline bool tick(twai_message_t &msg) {
+    if (master) {
+      msg.flags = 0;
+      msg.self = 1;                           // The master timestamps its own SYNC too
+      msg.data_length_code = 2;
+      msg.data[0] = FRAME_SYNC;
+      msg.data[1] = ++sendSequence;
+      return true;
+    }
+    if (synced && esp_timer_get_time() - anchorLocalUs > (int64_t)LOST_AFTER_INTERVALS * INTERVAL_MS * 1000) {
+      portENTER_CRITICAL(&lock);
+      synced = false;
+      epochCounter++;
+      portEXIT_CRITICAL(&lock);
+      debugln("[TIME] Sync lost - using local time");
+    }
+    return false;
+  }
+
+  static void acceptPair(int64_t localUs, int64_t masterUs) {
+    if (!synced) {
+      portENTER_CRITICAL(&lock);
+      anchorLocalUs = localUs;
+      anchorMasterUs = masterUs;
+      driftPpb = 0;
+      synced = true;
+      epochCounter++;
+      portEXIT_CRITICAL(&lock);
+      debugln("[TIME] Synced to master");
+      return;
+    }
+
+    int64_t residual = masterUs - predict(localUs);
+    int64_t absResidual = residual < 0 ? -residual : residual;
+    if (absResidual > OUTLIER_US && ++rejects <= MAX_REJECTS) {
+      debugf("[TIME] Rejected pair, residual %ld us\n", (long)residual);
+      return;
+    }
+    rejects = 0;
+
+    // Rate of the master clock against ours since the last accepted pair
+    int64_t localSpan = localUs - anchorLocalUs;
+    int64_t measured = localSpan > 0 ? (masterUs - anchorMasterUs - localSpan) * 1000000000LL / localSpan : 0;
+    int64_t filtered = driftPpb + (measured - driftPpb) / 4;
+    if (filtered > MAX_DRIFT_PPB) {
+      filtered = MAX_DRIFT_PPB;
+    } else if (filtered < -MAX_DRIFT_PPB) {
+      filtered = -MAX_DRIFT_PPB;
+    }
+
+    portENTER_CRITICAL(&lock);
+    anchorLocalUs = localUs;
+    anchorMasterUs = masterUs;
+    driftPpb = (int32_t)filtered;
+    if (absResidual > STEP_US) {
+      epochCounter++;
+    }
+    portEXIT_CRITICAL(&lock);
+    debugf("[TIME] Residual %ld us, drift %ld ppb\n", (long)residual, (long)driftPpb);
+  }
+
+  /**
+   * Handle a frame on the time sync ID, received at rxAtUs (esp_timer, taken
+   * at the top of the RX callback). Returns true with reply filled when the
+   * master must send a FOLLOW_UP.
+   */
+  inline bool handleFrame(const canHelper::FrameView &msg, int64_t rxAtUs, twai_message_t &reply) {
+    if (msg.data_length_code < 2) {
+      return false;
+    }
+    if (msg.data[0] == FRAME_SYNC) {
+      if (master) {
+        if (msg.data[1] != sendSequence) {
+          debugln("[TIME] WARNING: Another master on the bus");
+          return false;
+        }
+        reply.flags = 0;
+        reply.data_length_code = 8;
+        reply.data[0] = FRAME_FOLLOW_UP;
+        reply.data[1] = msg.data[1];
+        for (uint8_t i = 0; i < 6; i++) {
+          reply.data[2 + i] = (uint8_t)(rxAtUs >> (8 * i));
+        }
+        return true;
+      }
+      syncSequence = msg.data[1];
+      syncLocalUs = rxAtUs;
+    } else if (msg.data[0] == FRAME_FOLLOW_UP && !master && msg.data_length_code >= 8) {
+      if (syncLocalUs == 0 || msg.data[1] != syncSequence) {
+        return false;                         // Missed the matching SYNC
+      }
+      int64_t masterUs = 0;
+      for (uint8_t i = 0; i < 6; i++) {
+        masterUs |= (int64_t)msg.data[2 + i] << (8 * i);
+      }
+      acceptPair(syncLocalUs, masterUs);
+      syncLocalUs = 0;
+    }
+    return false;
+  }
+}
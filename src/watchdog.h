@@ -0,0 +1,265 @@
+#pragma once
+#include "globals.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+#include "driver/twai.h"
+
+// ============================================================================
+// Loop / CAN RX Watchdog and Latency SLAs
+// ============================================================================
+// Two service levels, both set over CAN (0 = not checked):
+//   - key 22: longest gap between two button scans of the loop task
+//   - key 23: longest time the CAN RX task may spend in one onCanRx()
+// A miss is counted, logged and remembered as the last violator in RTC
+// memory, which survives every reset except power-on.
+//
+// A task that stops altogether resets the panel. The loop task is
+// subscribed to the ESP-IDF task watchdog (TIMEOUT_S, panic on expiry) and
+// feeds it on every wake-up. The CAN RX task belongs to TwaiTaskBased and
+// blocks on its queue while the bus is quiet, so it cannot feed the task
+// watchdog itself: onCanRx() marks entry and exit, and the loop task stops
+// feeding once one callback has run for TIMEOUT_S. Either way the reset
+// reason reads ESP_RST_TASK_WDT, and the watchdog ISR marks the stalled task
+// in the RTC record just before the panic.
+//
+// At the next boot (anything but power-on) the panel reports the reset
+// reason and the last violator on the diagnostics ID.
+
+namespace watchdog {
+
+  const uint8_t FRAME_TYPE_RESET = 0x06;      // Diagnostic frame type: reset report (boot)
+  const uint8_t FRAME_TYPE_SLA = 0x07;        // Diagnostic frame type: SLA violation counts
+  const uint32_t TIMEOUT_S = 5;               // Task watchdog timeout (the Arduino core default)
+  const uint16_t MIN_SCAN_SLA_MS = 10;        // Floor for key 22: two scan periods
+  const uint16_t MAX_SLA_MS = 4000;           // Keys 22/23 must fire before the reset does
+  const uint8_t VIOLATOR_FATAL = 0x80;        // Violator flag: the task watchdog fired on it
+  const uint32_t RECORD_MAGIC = 0x57445431;   // "WDT1"
+
+  enum Watched : uint8_t {
+    WATCH_NONE = 0,
+    WATCH_BUTTONS,                            // Loop task: button scan, timers, TX
+    WATCH_CAN_RX,                             // onCanRx() on the TwaiTaskBased RX task
+    WATCH_OTHER,                              // Another watched task, e.g. an idle task starved
+    WATCH_COUNT
+  };
+
+  // Kept across resets in RTC slow memory; check guards against the random
+  // content it has after power-on
+  struct ResetRecord {
+    uint32_t magic;
+    uint8_t violator;                         // Watched, | VIOLATOR_FATAL if it caused the reset
+    uint8_t reserved;
+    uint16_t lateMs;                          // How long the violator took (saturating)
+    uint32_t check;
+  };
+
+  struct Stats {
+    uint32_t violations[WATCH_COUNT];
+    uint16_t worstMs[WATCH_COUNT];
+  };
+
+  RTC_NOINIT_ATTR static ResetRecord record;
+  static ResetRecord previous = {0, WATCH_NONE, 0, 0, 0};   // Record of the boot before this one
+  static esp_reset_reason_t bootReason = ESP_RST_UNKNOWN;
+  static Stats counters = {};
+  static bool armed = false;
+  static bool rxStuckLogged = false;
+  static volatile uint32_t lastFeedUs = 0;
+  static volatile uint32_t rxEnteredUs = 0;
+  static volatile bool rxBusy = false;
+  static volatile bool rxCounted = false;     // The running callback already missed its SLA
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  // Both also run in the watchdog ISR, hence IRAM
+  static uint32_t IRAM_ATTR checkOf(const ResetRecord &r) {
+    return r.magic ^ ((uint32_t)r.violator << 24) ^ r.lateMs ^ 0xA5A5A5A5;
+  }
+
+  static void IRAM_ATTR storeRecord(uint8_t violator, uint32_t lateUs) {
+    record.magic = RECORD_MAGIC;
+    record.violator = violator;
+    record.reserved = 0;
+    record.lateMs = lateUs / 1000 > 0xFFFF ? 0xFFFF : (uint16_t)(lateUs / 1000);
+    record.check = checkOf(record);
+  }
+
+  inline const char *watchedName(uint8_t who) {
+    switch (who & ~VIOLATOR_FATAL) {
+      case WATCH_NONE: return "none";
+      case WATCH_BUTTONS: return "loop";
+      case WATCH_CAN_RX: return "CAN RX";
+      default: return "other";
+    }
+  }
+
+  /**
+   * Count a missed SLA and remember the task as the last violator (any task)
+   */
+  static void violation(Watched who, uint32_t tookUs) {
+    uint16_t tookMs = tookUs / 1000 > 0xFFFF ? 0xFFFF : (uint16_t)(tookUs / 1000);
+    portENTER_CRITICAL(&lock);
+    counters.violations[who]++;
+    if (tookMs > counters.worstMs[who]) {
+      counters.worstMs[who] = tookMs;
+    }
+    storeRecord(who, tookUs);
+    portEXIT_CRITICAL(&lock);
+    debugf("[WDT] %s missed its SLA: %u ms\n", watchedName(who), tookMs);
+  }
+
+  /**
+   * Read and clear the record of the previous boot, then subscribe the
+   * calling task (the loop task) to the task watchdog if arm is set.
+   * Call at the end of setup().
+   */
+  inline void begin(bool arm) {
+    bootReason = esp_reset_reason();
+    if (bootReason != ESP_RST_POWERON && record.magic == RECORD_MAGIC && record.check == checkOf(record)) {
+      previous = record;
+    }
+    storeRecord(WATCH_NONE, 0);
+    debugf("[WDT] Reset reason %d, last SLA violator: %s%s (%u ms)\n", (int)bootReason,
+           watchedName(previous.violator), (previous.violator & VIOLATOR_FATAL) ? ", reset by the watchdog" : "",
+           previous.lateMs);
+
+    lastFeedUs = (uint32_t)esp_timer_get_time();
+    armed = arm;
+    if (armed) {
+      esp_task_wdt_init(TIMEOUT_S, true);     // Reconfigures the core's watchdog to reset on expiry
+      esp_task_wdt_add(NULL);
+      debugf("[WDT] Loop and CAN RX watched, reset after %lu s\n", (unsigned long)TIMEOUT_S);
+    }
+  }
+
+  /**
+   * onCanRx() entry and exit (CAN RX task); leaveRx() returns the time spent
+   */
+  inline void enterRx() {
+    rxCounted = false;
+    rxEnteredUs = (uint32_t)esp_timer_get_time();
+    rxBusy = true;
+  }
+
+  inline uint32_t leaveRx(uint16_t slaMs) {
+    uint32_t tookUs = (uint32_t)esp_timer_get_time() - rxEnteredUs;
+    rxBusy = false;
+    if (slaMs == 0 || tookUs <= slaMs * 1000UL) {
+      return tookUs;
+    }
+    if (!rxCounted) {
+      violation(WATCH_CAN_RX, tookUs);
+      return tookUs;
+    }
+    // Counted while still running (feed()); keep the full duration
+    portENTER_CRITICAL(&lock);
+    uint16_t tookMs = tookUs / 1000 > 0xFFFF ? 0xFFFF : (uint16_t)(tookUs / 1000);
+    if (tookMs > counters.worstMs[WATCH_CAN_RX]) {
+      counters.worstMs[WATCH_CAN_RX] = tookMs;
+    }
+    portEXIT_CRITICAL(&lock);
+    return tookUs;
+  }
+
+  /**
+   * True while a CAN RX callback is running
+   */
+  inline bool rxInFlight() {
+    return rxBusy;
+  }
+
+  /**
+   * Loop task, every wake-up: check both SLAs and feed the task watchdog
+   * unless the CAN RX task has been stuck for TIMEOUT_S. scanGapUs is the
+   * time since the previous wake-up.
+   */
+  inline void feed(uint32_t scanGapUs, uint16_t scanSlaMs, uint16_t rxSlaMs) {
+    uint32_t nowUs = (uint32_t)esp_timer_get_time();
+    if (scanSlaMs != 0 && scanGapUs > scanSlaMs * 1000UL) {
+      violation(WATCH_BUTTONS, scanGapUs);
+    }
+
+    if (rxBusy) {
+      uint32_t runningUs = nowUs - rxEnteredUs;
+      if (rxSlaMs != 0 && runningUs > rxSlaMs * 1000UL && !rxCounted) {
+        rxCounted = true;
+        violation(WATCH_CAN_RX, runningUs);
+      }
+      if (runningUs >= TIMEOUT_S * 1000000UL) {
+        if (!rxStuckLogged) {
+          rxStuckLogged = true;
+          debugln("[WDT] CAN RX stuck - no longer feeding the task watchdog");
+        }
+        return;
+      }
+    }
+
+    lastFeedUs = nowUs;
+    if (armed) {
+      esp_task_wdt_reset();
+    }
+  }
+
+  inline Stats stats() {
+    portENTER_CRITICAL(&lock);
+    Stats copy = counters;
+    portEXIT_CRITICAL(&lock);
+    return copy;
+  }
+
+  /**
+   * Fill the boot report (identifier set by the caller):
+   * [type, mac0, mac1, mac2, reset reason, last violator, late ms LE16].
+   * Returns false after a power-on reset, which has nothing to report.
+   */
+  inline bool buildResetReport(twai_message_t &msg, const uint8_t *macSuffix) {
+    if (bootReason == ESP_RST_POWERON) {
+      return false;
+    }
+    msg.flags = 0;
+    msg.data_length_code = 8;
+    msg.data[0] = FRAME_TYPE_RESET;
+    memcpy(&msg.data[1], macSuffix, 3);
+    msg.data[4] = (uint8_t)bootReason;
+    msg.data[5] = previous.violator;
+    memcpy(&msg.data[6], &previous.lateMs, sizeof(previous.lateMs));
+    return true;
+  }
+
+  /**
+   * Fill an SLA report (identifier set by the caller): [type, mac0, mac1,
+   * mac2, scan misses, RX misses, worst scan gap ms, worst RX ms], all
+   * saturating at 255
+   */
+  inline void buildSlaReport(twai_message_t &msg, const uint8_t *macSuffix) {
+    Stats s = stats();
+    msg.flags = 0;
+    msg.data_length_code = 8;
+    msg.data[0] = FRAME_TYPE_SLA;
+    memcpy(&msg.data[1], macSuffix, 3);
+    msg.data[4] = s.violations[WATCH_BUTTONS] > 255 ? 255 : (uint8_t)s.violations[WATCH_BUTTONS];
+    msg.data[5] = s.violations[WATCH_CAN_RX] > 255 ? 255 : (uint8_t)s.violations[WATCH_CAN_RX];
+    msg.data[6] = s.worstMs[WATCH_BUTTONS] > 255 ? 255 : (uint8_t)s.worstMs[WATCH_BUTTONS];
+    msg.data[7] = s.worstMs[WATCH_CAN_RX] > 255 ? 255 : (uint8_t)s.worstMs[WATCH_CAN_RX];
+  }
+
+  /**
+   * Task watchdog expiry, called from its ISR just before the panic (the
+   * esp_task_wdt_isr_user_handler hook in main.cpp): name the stalled task
+   * in the RTC record
+   */
+  static void IRAM_ATTR expired() {
+    uint32_t nowUs = (uint32_t)esp_timer_get_time();
+    uint32_t loopQuietUs = nowUs - lastFeedUs;
+    Watched who = WATCH_OTHER;
+    uint32_t lateUs = 0;
+    if (rxBusy && nowUs - rxEnteredUs >= TIMEOUT_S * 1000000UL) {
+      who = WATCH_CAN_RX;
+      lateUs = nowUs - rxEnteredUs;
+    } else if (loopQuietUs >= TIMEOUT_S * 1000000UL) {
+      who = WATCH_BUTTONS;
+      lateUs = loopQuietUs;
+    }
+    storeRecord(who | VIOLATOR_FATAL, lateUs);
+  }
+}
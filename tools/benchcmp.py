@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Compare two microbenchmark runs (see src/benchmark.h).
+
+  benchcmp.py baseline.jsonl current.jsonl                # exit 1 on a regression
+  benchcmp.py baseline.jsonl current.jsonl --threshold 5  # percent, default 10
+
+Inputs are the JSON lines printed by a BENCHMARK=1 build: the host runner
+(tools/sim/bench.cpp) or a serial log of the device ([env:bench]). Other
+lines in a serial log, such as debug output, are skipped.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('{"bench"'):
+                continue
+            try:
+                entry = json.loads(line)
+            except ValueError:
+                continue
+            if "ns_per_op" in entry:
+                results[entry["bench"]] = entry
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0, help="slowdown in percent that counts as a regression")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    if not baseline or not current:
+        sys.exit("No benchmark results in %s" % (args.baseline if not baseline else args.current))
+
+    platforms = {e["platform"] for e in baseline.values()} | {e["platform"] for e in current.values()}
+    if len(platforms) > 1:
+        print("WARNING: comparing results from different platforms (%s)" % ", ".join(sorted(platforms)))
+
+    regressions = 0
+    print("%-30s %12s %12s %8s" % ("bench", "baseline ns", "current ns", "change"))
+    for name in sorted(set(baseline) | set(current)):
+        if name not in baseline:
+            print("%-30s %12s %12.1f %8s" % (name, "-", current[name]["ns_per_op"], "new"))
+            continue
+        if name not in current:
+            print("%-30s %12.1f %12s %8s" % (name, baseline[name]["ns_per_op"], "-", "missing"))
+            continue
+        before = baseline[name]["ns_per_op"]
+        after = current[name]["ns_per_op"]
+        change = (after - before) * 100.0 / before if before > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-30s %12.1f %12.1f %+7.1f%%%s" % (name, before, after, change, flag))
+
+    if regressions:
+        print("%d regression(s) above %.0f%%" % (regressions, args.threshold))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
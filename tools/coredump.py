@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Fetch a stored core dump from a panel over CAN (see src/coredump.h).
+
+  coredump.py watch                                  # list panels advertising a dump
+  coredump.py fetch --node A1B2C3 -o core.bin        # download; the panel erases it afterwards
+
+Decode with the ESP-IDF tools and the ELF of the firmware that crashed:
+
+  espcoredump.py info_corefile -t raw -c core.bin .pio/build/esp32dev/firmware.elf
+"""
+
+import argparse
+import struct
+import time
+
+import panelbulk
+
+STREAM_COREDUMP = 0x01
+CAN_ID_DIAG = 0x1F
+FRAME_COREDUMP_AVAILABLE = 0x03
+
+
+def fetch(args):
+    bus = panelbulk.open_bus(args)
+    try:
+        blob = panelbulk.timed_fetch(bus, panelbulk.parse_node(args.node), STREAM_COREDUMP)
+    finally:
+        bus.shutdown()
+    with open(args.output, "wb") as f:
+        f.write(blob)
+    print("Saved %s - the panel has erased its copy" % args.output)
+    print("Decode: espcoredump.py info_corefile -t raw -c %s <firmware.elf>" % args.output)
+
+
+def watch(args):
+    bus = panelbulk.open_bus(args)
+    deadline = time.time() + args.seconds
+    print("Listening %d s for core dump advertisements (sent once a minute)..." % args.seconds)
+    try:
+        while time.time() < deadline:
+            msg = bus.recv(1.0)
+            if msg is None or msg.arbitration_id != CAN_ID_DIAG or msg.is_extended_id:
+                continue
+            if len(msg.data) >= 8 and msg.data[0] == FRAME_COREDUMP_AVAILABLE:
+                (size,) = struct.unpack_from("<I", bytes(msg.data), 4)
+                print("esp32-%s: core dump of %d bytes (fetch --node %s)"
+                      % (msg.data[1:4].hex().upper(), size, msg.data[1:4].hex().upper()))
+    finally:
+        bus.shutdown()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("fetch", help="download and clear a panel's core dump")
+    panelbulk.add_bus_arguments(p)
+    p.add_argument("-o", "--output", default="core.bin")
+    p.set_defaults(func=fetch)
+
+    p = sub.add_parser("watch", help="listen for core dump advertisements")
+    p.add_argument("--channel", default="can0")
+    p.add_argument("--interface", default="socketcan")
+    p.add_argument("--seconds", type=int, default=65)
+    p.set_defaults(func=watch)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
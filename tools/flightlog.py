@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""Fetch and decode the panel flight recorder (see src/flightRecorder.h).
+
+  flightlog.py fetch --node A1B2C3 -o flight.bin    # over CAN (python-can)
+  flightlog.py decode flight.bin                    # print entries, oldest first
+  flightlog.py decode flight.bin --csv > flight.csv
+  flightlog.py latency a.bin b.bin c.bin            # press -> backlight latency across panels
+
+Times are in the shared timebase of src/timeSync.h; entries marked '*' were
+logged while the panel was synced to the time master, so they compare
+directly between panels.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+import panelbulk
+
+STREAM_FLIGHT_LOG = 0x00
+
+MAGIC = 0x324C5246          # "FRL2"; FRL1 logs from older firmware are skipped
+SECTOR_SIZE = 4096
+ENTRY_SIZE = 16
+ENTRY = struct.Struct("<IBBH8s")
+HEADER = struct.Struct("<IIQ")
+
+LENGTH_MASK = 0x0F
+FLAG_SYNCED = 0x80
+TIME_SYNCED = 1 << 63
+
+ENTRY_BOOT = 0x01
+ENTRY_CAN_RX = 0x02
+ENTRY_CAN_TX = 0x03
+ENTRY_BUTTON = 0x04
+ENTRY_HEALTH = 0x05
+ENTRY_LED = 0x06
+ENTRY_TIME = 0x07
+ENTRY_FREE = 0xFF
+
+TYPE_NAMES = {ENTRY_BOOT: "BOOT", ENTRY_CAN_RX: "RX", ENTRY_CAN_TX: "TX",
+              ENTRY_BUTTON: "BUTTON", ENTRY_HEALTH: "HEALTH", ENTRY_LED: "LED", ENTRY_TIME: "TIME"}
+
+CAN_ID_BUTTON = 0x18
+CAN_ID_LED_STATE = 0x1B
+
+# esp_reset_reason_t
+RESET_REASONS = ["unknown", "power-on", "external", "software", "panic", "int-wdt",
+                 "task-wdt", "wdt", "deep-sleep", "brownout", "sdio"]
+
+# gestures::EventType
+GESTURES = ["tap", "tap-cancel", "double-tap", "chord", "hold-start", "hold-tick", "release"]
+
+
+def sectors(blob):
+    """Valid sectors as (sequence, bytes), oldest first."""
+    found = []
+    for base in range(0, len(blob) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        magic, sequence, _ = HEADER.unpack_from(blob, base)
+        if magic == MAGIC and sequence != 0xFFFFFFFF:
+            found.append((sequence, blob[base:base + SECTOR_SIZE]))
+    found.sort()
+    return found
+
+
+def extend(anchor_us, time32):
+    """Full time of a 32-bit entry time, taken as the nearest value to the anchor."""
+    delta = (time32 - anchor_us) & 0xFFFFFFFF
+    if delta >= 0x80000000:
+        delta -= 0x100000000
+    return anchor_us + delta
+
+
+def entries(blob):
+    """Yield (sector sequence, time us, synced, type, id, data), oldest first."""
+    for sequence, sector in sectors(blob):
+        _, _, header_time = HEADER.unpack_from(sector, 0)
+        anchor = header_time & ~TIME_SYNCED
+        for offset in range(ENTRY_SIZE, SECTOR_SIZE, ENTRY_SIZE):
+            time32, kind, length, ident, data = ENTRY.unpack_from(sector, offset)
+            if kind == ENTRY_FREE:
+                break
+            if kind == ENTRY_TIME:
+                (anchor,) = struct.unpack_from("<q", data)
+                time_us = anchor
+            else:
+                time_us = extend(anchor, time32)
+                anchor = time_us
+            yield (sequence, time_us, bool(length & FLAG_SYNCED), kind, ident,
+                   data[:min(length & LENGTH_MASK, 8)])
+
+
+def describe(kind, ident, data):
+    if kind == ENTRY_BOOT:
+        reason = RESET_REASONS[ident] if ident < len(RESET_REASONS) else str(ident)
+        return "reset reason %s" % reason
+    if kind in (ENTRY_CAN_RX, ENTRY_CAN_TX):
+        return "0x%03X [%d] %s" % (ident, len(data), data.hex(" "))
+    if kind == ENTRY_BUTTON:
+        gesture = GESTURES[ident] if ident < len(GESTURES) else str(ident)
+        button, mask, held, page = data[:4]
+        text = "button %d %s page %d" % (button + 1, gesture, page + 1)
+        if mask:
+            text += " mask 0x%02X" % mask
+        if held:
+            text += " (held)"
+        return text
+    if kind == ENTRY_HEALTH:
+        rx, tx_failed, dropped, heap_kb = struct.unpack_from("<4H", data.ljust(8, b"\0"))
+        return "rx %d, tx failed %d, log dropped %d, free heap %d KB" % (rx, tx_failed, dropped, heap_kb)
+    if kind == ENTRY_LED:
+        return "page %d backlights %s" % (ident + 1, "".join("1" if b else "0" for b in data))
+    if kind == ENTRY_TIME:
+        return "timebase epoch %d" % ident
+    return data.hex(" ")
+
+
+def decode(args):
+    with open(args.file, "rb") as f:
+        blob = f.read()
+
+    writer = csv.writer(sys.stdout) if args.csv else None
+    if writer:
+        writer.writerow(["sector", "time_us", "synced", "type", "id", "detail"])
+
+    count = 0
+    for sequence, time_us, synced, kind, ident, data in entries(blob):
+        name = TYPE_NAMES.get(kind, "0x%02X" % kind)
+        detail = describe(kind, ident, data)
+        if writer:
+            writer.writerow([sequence, time_us, int(synced), name, ident, detail])
+        else:
+            if kind == ENTRY_BOOT:
+                print("---- boot ----")
+            print("%14.6f%s %-6s  %s" % (time_us / 1e6, "*" if synced else " ", name, detail))
+        count += 1
+
+    if not writer:
+        print("%d entries in %d sectors" % (count, len(sectors(blob))), file=sys.stderr)
+
+
+def backlight_changes(log):
+    """(time us, device) for every synced backlight change of one panel."""
+    changes = []
+    states = {}
+    for _, time_us, synced, kind, ident, data in log:
+        if kind != ENTRY_LED or not synced:
+            continue
+        previous = states.get(ident)
+        for slot, value in enumerate(data):
+            if previous is not None and bool(previous[slot]) != bool(value):
+                changes.append((time_us, ident * 8 + slot))
+        states[ident] = data
+    return changes
+
+
+def latency(args):
+    panels = []
+    for name in args.files:
+        with open(name, "rb") as f:
+            panels.append((name, list(entries(f.read()))))
+    changes = {name: backlight_changes(log) for name, log in panels}
+
+    # Each synced button frame, matched to the first change of that device's
+    # backlight on every panel within the window
+    samples = []
+    window_us = args.window * 1000
+    for source, log in panels:
+        for _, time_us, synced, kind, ident, data in log:
+            if kind != ENTRY_CAN_TX or ident != args.button_id or not synced or not data:
+                continue
+            device = data[0]
+            row = []
+            for name, _ in panels:
+                hits = [t for t, d in changes[name] if d == device and 0 <= t - time_us <= window_us]
+                if hits:
+                    row.append("%s %.2f ms" % (name, (hits[0] - time_us) / 1000.0))
+                    samples.append(hits[0] - time_us)
+                else:
+                    row.append("%s -" % name)
+            print("%14.6f  %s device %d -> %s" % (time_us / 1e6, source, device, ", ".join(row)))
+
+    if not samples:
+        print("No matched presses (are the panels synced to a time master?)", file=sys.stderr)
+        return
+    samples.sort()
+    print("%d backlight updates: min %.2f ms, median %.2f ms, max %.2f ms"
+          % (len(samples), samples[0] / 1000.0, samples[len(samples) // 2] / 1000.0, samples[-1] / 1000.0))
+
+
+def fetch(args):
+    bus = panelbulk.open_bus(args)
+    try:
+        blob = panelbulk.timed_fetch(bus, panelbulk.parse_node(args.node), STREAM_FLIGHT_LOG)
+    finally:
+        bus.shutdown()
+    with open(args.output, "wb") as f:
+        f.write(blob)
+    print("Saved %s" % args.output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("fetch", help="read the flight log from a panel over CAN")
+    panelbulk.add_bus_arguments(p)
+    p.add_argument("-o", "--output", default="flight.bin")
+    p.set_defaults(func=fetch)
+
+    p = sub.add_parser("decode", help="print a fetched flight log")
+    p.add_argument("file")
+    p.add_argument("--csv", action="store_true", help="CSV output")
+    p.set_defaults(func=decode)
+
+    p = sub.add_parser("latency", help="match button presses to backlight updates across panel logs")
+    p.add_argument("files", nargs="+", help="flight logs of the panels on one bus")
+    p.add_argument("--button-id", type=lambda v: int(v, 0), default=CAN_ID_BUTTON,
+                   help="button CAN ID (config key 7, default 0x18)")
+    p.add_argument("--window", type=int, default=1000, help="max press to backlight time in ms")
+    p.set_defaults(func=latency)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
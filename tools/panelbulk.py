@@ -0,0 +1,142 @@
+"""Host side of the panel bulk transfer protocol (see src/bulkTransfer.h).
+
+Requests a stream with a diagnostic request on CAN ID 0x03, receives it on
+CAN ID 0x20 and acknowledges each window. Needs python-can and a classic
+11-bit bus (panels built with J1939_MODE=1 are not supported here).
+"""
+
+import struct
+import time
+import zlib
+
+CAN_ID_DIAG_REQUEST = 0x03
+CAN_ID_BULK = 0x20
+
+DIAG_CMD_BULK_READ = 0x03
+DIAG_CMD_BULK_ACK = 0x04
+
+FRAME_START = 0x80
+FRAME_END = 0x81
+BYTES_PER_FRAME = 7
+ABORT_OFFSET = 0xFFFFFF
+
+IDLE_TIMEOUT_S = 2.0
+MAX_IDLE_RETRIES = 5
+
+
+class BulkError(Exception):
+    pass
+
+
+def parse_node(text):
+    """'A1B2C3' or 'esp32-A1B2C3' -> the three MAC suffix bytes."""
+    text = text.strip()
+    if text.lower().startswith("esp32-"):
+        text = text[6:]
+    raw = bytes.fromhex(text)
+    if len(raw) != 3:
+        raise ValueError("node must be the 6 hex digits of the OTA hostname")
+    return raw
+
+
+def _send_diag(bus, can, node, payload):
+    bus.send(can.Message(arbitration_id=CAN_ID_DIAG_REQUEST, is_extended_id=False,
+                         data=bytes(node) + bytes(payload)))
+
+
+def _ack(bus, can, node, stream, offset):
+    _send_diag(bus, can, node, [DIAG_CMD_BULK_ACK, stream,
+                                offset & 0xFF, (offset >> 8) & 0xFF, (offset >> 16) & 0xFF])
+
+
+def fetch(bus, node, stream, progress=None):
+    """Read one stream from the panel and return its bytes (CRC checked)."""
+    import can
+
+    _send_diag(bus, can, node, [DIAG_CMD_BULK_READ, stream])
+
+    data = bytearray()
+    total = None
+    window = None
+    frames_in_window = 0
+    gap_acked = False
+    idle_retries = 0
+
+    while True:
+        msg = bus.recv(IDLE_TIMEOUT_S)
+        if msg is None:
+            idle_retries += 1
+            if idle_retries > MAX_IDLE_RETRIES:
+                raise BulkError("panel stopped responding at %d bytes" % len(data))
+            if total is None:
+                _send_diag(bus, can, node, [DIAG_CMD_BULK_READ, stream])
+            else:
+                _ack(bus, can, node, stream, len(data))
+                frames_in_window = 0
+            continue
+        if msg.arbitration_id != CAN_ID_BULK or msg.is_extended_id or len(msg.data) < 1:
+            continue
+        idle_retries = 0
+        kind = msg.data[0]
+
+        if kind == FRAME_START:
+            if msg.data[1] != stream:
+                continue
+            total, window = struct.unpack_from("<IB", bytes(msg.data), 2)
+            data = bytearray()
+            frames_in_window = 0
+
+        elif kind == FRAME_END:
+            if total is None or msg.data[1] != stream:
+                continue
+            if len(data) < total:
+                _ack(bus, can, node, stream, len(data))
+                frames_in_window = 0
+                continue
+            (crc,) = struct.unpack_from("<I", bytes(msg.data), 2)
+            if zlib.crc32(bytes(data)) & 0xFFFFFFFF != crc:
+                _ack(bus, can, node, stream, ABORT_OFFSET)
+                raise BulkError("CRC mismatch over %d bytes" % total)
+            _ack(bus, can, node, stream, total)
+            return bytes(data)
+
+        elif kind < 0x80 and total is not None:
+            if kind != (len(data) // BYTES_PER_FRAME) & 0x7F:
+                # Lost a frame: ask once for a resend from what we hold
+                if not gap_acked:
+                    _ack(bus, can, node, stream, len(data))
+                    frames_in_window = 0
+                    gap_acked = True
+                continue
+            gap_acked = False
+            data.extend(msg.data[1:])
+            frames_in_window += 1
+            if progress:
+                progress(len(data), total)
+            if frames_in_window == window and len(data) < total:
+                _ack(bus, can, node, stream, len(data))
+                frames_in_window = 0
+
+
+def open_bus(args):
+    import can
+    return can.interface.Bus(channel=args.channel, interface=args.interface)
+
+
+def add_bus_arguments(parser):
+    parser.add_argument("--channel", default="can0", help="python-can channel (default can0)")
+    parser.add_argument("--interface", default="socketcan", help="python-can interface (default socketcan)")
+    parser.add_argument("--node", required=True, help="panel hostname suffix, e.g. A1B2C3")
+
+
+def print_progress(done, total):
+    if total:
+        print("\r%7d / %7d bytes (%3d%%)" % (done, total, done * 100 // total), end="", flush=True)
+
+
+def timed_fetch(bus, node, stream):
+    start = time.time()
+    blob = fetch(bus, node, stream, print_progress)
+    elapsed = time.time() - start
+    print("\n%d bytes in %.1f s (%.1f KB/s)" % (len(blob), elapsed, len(blob) / 1024.0 / max(elapsed, 1e-6)))
+    return blob
@@ -0,0 +1,36 @@
+// ============================================================================
+// Hot-path Microbenchmarks (host)
+// ============================================================================
+// Runs the firmware's benchmark suite (runBenchmarks() in src/main.cpp,
+// harness in src/benchmark.h) on a Linux host. The whole firmware is
+// compiled in with the shims in tools/sim/host, boots with setup() and runs
+// the suite from the scheduler as the device does, BENCHMARK_START_MS after
+// boot in virtual time.
+//
+//   g++ -std=gnu++11 -O2 -DDEBUG=0 -DBENCHMARK=1 -Ihost -I../../src bench.cpp -o bench
+//   ./bench > host.jsonl
+//   python3 ../benchcmp.py baseline.jsonl host.jsonl
+//
+// Output is one JSON object per line on stdout. Times are host CPU time:
+// compare runs on the same machine, not with device numbers.
+
+#include "../../src/main.cpp"
+
+#if !BENCHMARK
+#error "Build with -DBENCHMARK=1"
+#endif
+
+int main(int argc, char **argv) {
+  uint32_t bitrate = CAN_DEFAULT_BITRATE;
+  host::nvsPut("can", "bitrate", &bitrate, sizeof(bitrate));
+
+  host::onLoopNotified = loop;
+  setup();
+  loop();
+
+  // Serial output from here on is the benchmark report
+  host::serialOut = stdout;
+  host::serialEcho = true;
+  host::advanceTo(host::nowUs + (BENCHMARK_START_MS + 1000) * 1000LL);
+  return 0;
+}
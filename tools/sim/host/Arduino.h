@@ -0,0 +1,118 @@
+#pragma once
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/twai.h"
+#include "host.h"
+
+// ============================================================================
+// Arduino core, as much of it as the firmware uses
+// ============================================================================
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define F(text) text
+
+typedef uint8_t byte;
+
+inline unsigned long millis() { return (unsigned long)(host::nowUs / 1000); }
+inline unsigned long micros() { return (unsigned long)host::nowUs; }
+inline void delay(uint32_t ms) { host::nowUs += (int64_t)ms * 1000; }
+inline void delayMicroseconds(uint32_t us) { host::nowUs += us; }
+inline void yield() {}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  host::pinModes[pin] = mode;
+  if (mode == INPUT_PULLUP || mode == INPUT) {
+    host::pinLevel[pin] = HIGH;             // Buttons are pulled up, on chip or on the board
+  }
+}
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+  host::pinLevel[pin] = level ? HIGH : LOW;
+  host::pinWrites++;
+}
+inline int digitalRead(uint8_t pin) { return host::pinLevel[pin]; }
+inline void pinMatrixOutDetach(uint8_t pin, bool invertOut, bool invertEnable) {}
+
+class String {
+public:
+  String(const char *s = "") : s_(s) {}
+  String(const std::string &s) : s_(s) {}
+  const char *c_str() const { return s_.c_str(); }
+  size_t length() const { return s_.size(); }
+  bool equals(const char *other) const { return s_ == other; }
+private:
+  std::string s_;
+};
+
+// Serial output goes to host::serialOut (stderr) when host::serialEcho is set
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) {}
+  size_t setTxBufferSize(size_t size) { return size; }
+  void end() {}
+  void flush() {}
+  size_t print(const char *s) { return echo("%s", s); }
+  size_t print(const String &s) { return echo("%s", s.c_str()); }
+  size_t print(char c) { return echo("%c", c); }
+  size_t print(int v) { return echo("%d", v); }
+  size_t print(unsigned v) { return echo("%u", v); }
+  size_t print(long v) { return echo("%ld", v); }
+  size_t print(unsigned long v) { return echo("%lu", v); }
+  size_t print(double v) { return echo("%.2f", v); }
+  template <class T> size_t println(T v) { return print(v) + println(); }
+  size_t println() { return echo("\n"); }
+  int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!host::serialEcho) return 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(host::serialOut, fmt, args);
+    va_end(args);
+    return n;
+  }
+  size_t write(const uint8_t *buf, size_t len) { return host::serialEcho ? fwrite(buf, 1, len, host::serialOut) : len; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  int available() { return 0; }
+  int read() { return -1; }
+  int availableForWrite() { return 128; }
+  operator bool() { return true; }
+private:
+  size_t echo(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!host::serialEcho) return 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vfprintf(host::serialOut, fmt, args);
+    va_end(args);
+    return n > 0 ? n : 0;
+  }
+};
+
+static HardwareSerial Serial;
+
+class EspClass {
+public:
+  uint64_t getEfuseMac() {
+    // MAC bytes 3-5 from the hostname suffix (esp32-XXXXXX), byte 0 in the low bits
+    uint64_t suffix = strtoull(host::hostName.c_str() + host::hostName.size() - 6, NULL, 16);
+    return ((suffix >> 16) & 0xFF) << 24 | ((suffix >> 8) & 0xFF) << 32 | (suffix & 0xFF) << 40;
+  }
+  uint32_t getFreeHeap() { return 200 * 1024; }
+  uint32_t getMinFreeHeap() { return 180 * 1024; }
+  uint32_t getMaxAllocHeap() { return 110 * 1024; }
+  uint32_t getCycleCount() { return (uint32_t)(host::nowUs * 240); }   // 240 MHz
+  void restart() { exit(0); }
+};
+
+static EspClass ESP;
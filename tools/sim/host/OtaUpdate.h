@@ -0,0 +1,10 @@
+#pragma once
+#include <Arduino.h>
+
+// Hostname only; an OTA session returns immediately
+class OtaUpdate {
+public:
+  OtaUpdate(int timeoutMs, const char *ssid, const char *password) {}
+  String getHostName() { return String(host::hostName); }
+  void waitForOta() {}
+};
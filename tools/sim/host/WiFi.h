@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+typedef enum { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+// No radio on the host
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t m) { return true; }
+  int16_t scanNetworks(bool async = false) { return 0; }
+  int16_t scanComplete() { return 0; }
+  void scanDelete() {}
+};
+
+static WiFiClass WiFi;
@@ -0,0 +1,10 @@
+#pragma once
+#include "../esp_err.h"
+
+typedef enum {
+  GPIO_INTR_DISABLE, GPIO_INTR_POSEDGE, GPIO_INTR_NEGEDGE, GPIO_INTR_ANYEDGE,
+  GPIO_INTR_LOW_LEVEL, GPIO_INTR_HIGH_LEVEL
+} gpio_int_type_t;
+
+inline esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type) { return ESP_OK; }
+inline esp_err_t gpio_wakeup_disable(gpio_num_t pin) { return ESP_OK; }
@@ -0,0 +1,102 @@
+#pragma once
+#include "../esp_err.h"
+#include "../freertos/FreeRTOS.h"
+
+typedef struct {
+  union {
+    struct {
+      uint32_t extd: 1;
+      uint32_t rtr: 1;
+      uint32_t ss: 1;
+      uint32_t self: 1;
+      uint32_t dlc_non_comp: 1;
+      uint32_t reserved: 27;
+    };
+    uint32_t flags;
+  };
+  uint32_t identifier;
+  uint8_t data_length_code;
+  uint8_t data[8];
+} twai_message_t;
+
+typedef enum { TWAI_MODE_NORMAL, TWAI_MODE_NO_ACK, TWAI_MODE_LISTEN_ONLY } twai_mode_t;
+typedef enum { TWAI_STATE_STOPPED, TWAI_STATE_RUNNING, TWAI_STATE_BUS_OFF, TWAI_STATE_RECOVERING } twai_state_t;
+
+typedef struct {
+  twai_mode_t mode;
+  gpio_num_t tx_io;
+  gpio_num_t rx_io;
+  int clkout_io;
+  int bus_off_io;
+  uint32_t tx_queue_len;
+  uint32_t rx_queue_len;
+  uint32_t alerts_enabled;
+  int clkout_divider;
+  int intr_flags;
+} twai_general_config_t;
+
+typedef struct { uint32_t brp; uint8_t tseg_1; uint8_t tseg_2; uint8_t sjw; bool triple_sampling; } twai_timing_config_t;
+typedef struct { uint32_t acceptance_code; uint32_t acceptance_mask; bool single_filter; } twai_filter_config_t;
+
+typedef struct {
+  twai_state_t state;
+  uint32_t msgs_to_tx;
+  uint32_t msgs_to_rx;
+  uint32_t tx_error_counter;
+  uint32_t rx_error_counter;
+  uint32_t tx_failed_count;
+  uint32_t rx_missed_count;
+  uint32_t rx_overrun_count;
+  uint32_t arb_lost_count;
+  uint32_t bus_error_count;
+} twai_status_info_t;
+
+#define TWAI_GENERAL_CONFIG_DEFAULT(tx, rx, m) {m, tx, rx, -1, -1, 5, 5, 0, 0, 0}
+#define TWAI_TIMING_CONFIG_125KBITS() {32, 15, 4, 3, false}
+#define TWAI_TIMING_CONFIG_250KBITS() {16, 15, 4, 3, false}
+#define TWAI_TIMING_CONFIG_500KBITS() {8, 15, 4, 3, false}
+#define TWAI_TIMING_CONFIG_1MBITS() {4, 15, 4, 3, false}
+#define TWAI_FILTER_CONFIG_ACCEPT_ALL() {0, 0xFFFFFFFF, true}
+
+#define TWAI_ALERT_TX_IDLE 0x0001
+#define TWAI_ALERT_TX_SUCCESS 0x0002
+#define TWAI_ALERT_RX_DATA 0x0004
+#define TWAI_ALERT_BELOW_ERR_WARN 0x0008
+#define TWAI_ALERT_ERR_ACTIVE 0x0010
+#define TWAI_ALERT_RECOVERY_IN_PROGRESS 0x0020
+#define TWAI_ALERT_BUS_RECOVERED 0x0040
+#define TWAI_ALERT_ARB_LOST 0x0080
+#define TWAI_ALERT_ABOVE_ERR_WARN 0x0100
+#define TWAI_ALERT_BUS_ERROR 0x0200
+#define TWAI_ALERT_TX_FAILED 0x0400
+#define TWAI_ALERT_RX_QUEUE_FULL 0x0800
+#define TWAI_ALERT_ERR_PASS 0x1000
+#define TWAI_ALERT_BUS_OFF 0x2000
+#define TWAI_ALERT_RX_FIFO_OVERRUN 0x4000
+#define TWAI_ALERT_ALL 0x7FFF
+#define TWAI_ALERT_NONE 0
+
+#include "../host.h"
+
+namespace host {
+  static std::vector<twai_message_t> sent;      // Every frame the firmware queued
+}
+
+// A silent bus: nothing is ever received and alerts time out
+inline esp_err_t twai_driver_install(const twai_general_config_t *g, const twai_timing_config_t *t,
+                                     const twai_filter_config_t *f) { return ESP_OK; }
+inline esp_err_t twai_driver_uninstall() { return ESP_OK; }
+inline esp_err_t twai_start() { return ESP_OK; }
+inline esp_err_t twai_stop() { return ESP_OK; }
+inline esp_err_t twai_transmit(const twai_message_t *msg, TickType_t wait) { host::sent.push_back(*msg); return ESP_OK; }
+inline esp_err_t twai_receive(twai_message_t *msg, TickType_t wait) { host::nowUs += (int64_t)wait * 1000; return ESP_ERR_TIMEOUT; }
+inline esp_err_t twai_read_alerts(uint32_t *alerts, TickType_t wait) {
+  *alerts = 0;
+  host::nowUs += (int64_t)wait * 1000;
+  return ESP_ERR_TIMEOUT;
+}
+inline esp_err_t twai_reconfigure_alerts(uint32_t alerts, uint32_t *previous) { return ESP_OK; }
+inline esp_err_t twai_get_status_info(twai_status_info_t *info) { *info = twai_status_info_t(); info->state = TWAI_STATE_RUNNING; return ESP_OK; }
+inline esp_err_t twai_initiate_recovery() { return ESP_OK; }
+inline esp_err_t twai_clear_transmit_queue() { return ESP_OK; }
+inline esp_err_t twai_clear_receive_queue() { return ESP_OK; }
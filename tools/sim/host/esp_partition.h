@@ -0,0 +1,66 @@
+#pragma once
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include "esp_err.h"
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0, ESP_PARTITION_TYPE_DATA = 1 } esp_partition_type_t;
+typedef enum {
+  ESP_PARTITION_SUBTYPE_DATA_COREDUMP = 0x03,
+  ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+  ESP_PARTITION_SUBTYPE_ANY = 0xFF
+} esp_partition_subtype_t;
+
+typedef struct {
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  bool encrypted;
+} esp_partition_t;
+
+// The data partitions of partitions.csv, in RAM and erased at start
+namespace host {
+  static esp_partition_t spiffsPartition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS,
+                                            0x350000, 0x89000, "spiffs", false};
+  static esp_partition_t coredumpPartition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP,
+                                              0x3D9000, 0x10000, "coredump", false};
+  static std::vector<uint8_t> spiffsFlash(0x89000, 0xFF);
+  static std::vector<uint8_t> coredumpFlash(0x10000, 0xFF);
+
+  inline std::vector<uint8_t> *flashOf(const esp_partition_t *p) {
+    return p == &spiffsPartition ? &spiffsFlash : p == &coredumpPartition ? &coredumpFlash : NULL;
+  }
+}
+
+inline const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                       const char *label) {
+  if (subtype == ESP_PARTITION_SUBTYPE_DATA_SPIFFS) return &host::spiffsPartition;
+  if (subtype == ESP_PARTITION_SUBTYPE_DATA_COREDUMP) return &host::coredumpPartition;
+  return NULL;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t len) {
+  std::vector<uint8_t> *flash = host::flashOf(p);
+  if (flash == NULL || offset + len > flash->size()) return ESP_ERR_INVALID_ARG;
+  memcpy(dst, flash->data() + offset, len);
+  return ESP_OK;
+}
+
+// NOR flash: writes can only clear bits
+inline esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t len) {
+  std::vector<uint8_t> *flash = host::flashOf(p);
+  if (flash == NULL || offset + len > flash->size()) return ESP_ERR_INVALID_ARG;
+  for (size_t i = 0; i < len; i++) {
+    (*flash)[offset + i] &= ((const uint8_t *)src)[i];
+  }
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t len) {
+  std::vector<uint8_t> *flash = host::flashOf(p);
+  if (flash == NULL || offset + len > flash->size() || offset % 4096 || len % 4096) return ESP_ERR_INVALID_ARG;
+  memset(flash->data() + offset, 0xFF, len);
+  return ESP_OK;
+}
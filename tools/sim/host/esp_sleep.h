@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+// Light sleep never happens on the host: it returns at once as a timer wake
+// without moving virtual time
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED, ESP_SLEEP_WAKEUP_ALL, ESP_SLEEP_WAKEUP_EXT0, ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER, ESP_SLEEP_WAKEUP_TOUCHPAD, ESP_SLEEP_WAKEUP_ULP, ESP_SLEEP_WAKEUP_GPIO,
+  ESP_SLEEP_WAKEUP_UART
+} esp_sleep_source_t;
+
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us) { return ESP_OK; }
+inline esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+inline esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source) { return ESP_OK; }
+inline esp_err_t esp_light_sleep_start() { return ESP_OK; }
+inline esp_sleep_source_t esp_sleep_get_wakeup_cause() { return ESP_SLEEP_WAKEUP_TIMER; }
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum {
+  ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT, ESP_RST_SDIO
+} esp_reset_reason_t;
+
+inline uint32_t esp_random(void) { return (uint32_t)rand(); }
+inline esp_reset_reason_t esp_reset_reason(void) { return ESP_RST_POWERON; }
@@ -0,0 +1,48 @@
+#pragma once
+#include "esp_err.h"
+#include "host.h"
+
+typedef void (*esp_timer_cb_t)(void *arg);
+typedef enum { ESP_TIMER_TASK } esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void *arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char *name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+typedef host::Timer *esp_timer_handle_t;
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+  host::Timer *t = new host::Timer();
+  t->callback = args->callback;
+  t->arg = args->arg;
+  t->dueUs = 0;
+  t->armed = false;
+  host::timers.push_back(t);
+  *handle = t;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t timeoutUs) {
+  if (t->armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  t->dueUs = host::nowUs + (int64_t)timeoutUs;
+  t->armed = true;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t t) {
+  if (!t->armed) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  t->armed = false;
+  return ESP_OK;
+}
+
+inline int64_t esp_timer_get_time() {
+  return host::nowUs;
+}
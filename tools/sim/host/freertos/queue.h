@@ -0,0 +1,40 @@
+#pragma once
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "FreeRTOS.h"
+
+namespace host {
+  struct Queue {
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    std::deque<std::vector<uint8_t> > items;
+  };
+}
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  host::Queue *q = new host::Queue();
+  q->length = length;
+  q->itemSize = itemSize;
+  return q;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t wait) {
+  host::Queue *q = (host::Queue *)handle;
+  if (q->items.size() >= q->length) {
+    return pdFALSE;                   // Nothing drains it while we wait, so never block
+  }
+  const uint8_t *bytes = (const uint8_t *)item;
+  q->items.push_back(std::vector<uint8_t>(bytes, bytes + q->itemSize));
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t wait) {
+  host::Queue *q = (host::Queue *)handle;
+  if (q->items.empty()) {
+    return pdFALSE;
+  }
+  memcpy(item, q->items.front().data(), q->itemSize);
+  q->items.pop_front();
+  return pdTRUE;
+}
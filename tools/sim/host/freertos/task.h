@@ -0,0 +1,63 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "../host.h"
+
+#define configUSE_TRACE_FACILITY 1
+#define configGENERATE_RUN_TIME_STATS 0
+#define configMAX_TASK_NAME_LEN 16
+
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct {
+  TaskHandle_t xHandle;
+  const char *pcTaskName;
+  UBaseType_t xTaskNumber;
+  int eCurrentState;
+  UBaseType_t uxCurrentPriority;
+  UBaseType_t uxBasePriority;
+  uint32_t ulRunTimeCounter;
+  void *pxStackBase;
+  uint32_t usStackHighWaterMark;
+  BaseType_t xCoreID;
+} TaskStatus_t;
+
+// Tasks are registered but never run on the host
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                          UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  if (handle != NULL) {
+    *handle = (TaskHandle_t)host::nextTaskHandle++;
+  }
+  return pdPASS;
+}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return host::currentTask; }
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) { host::notifications[task]++; return pdPASS; }
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) { host::notifications[task]++; }
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+  uint32_t &count = host::notifications[host::LOOP_TASK];
+  uint32_t taken = count;
+  count = clear ? 0 : (count > 0 ? count - 1 : 0);
+  return taken;
+}
+inline void vTaskDelay(TickType_t ticks) { host::nowUs += (int64_t)ticks * 1000; }
+inline void vTaskDelete(TaskHandle_t task) {}
+inline void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {}
+inline UBaseType_t uxTaskPriorityGet(TaskHandle_t task) { return 1; }
+inline BaseType_t xPortGetCoreID() { return 1; }
+inline TickType_t xTaskGetTickCount() { return (TickType_t)(host::nowUs / 1000); }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+inline char *pcTaskGetTaskName(TaskHandle_t task) { return (char *)"loopTask"; }
+// The two tasks the firmware runs on (see host.h), without run time counters
+inline UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t count, uint32_t *totalRunTime) {
+  if (totalRunTime != NULL) {
+    *totalRunTime = 0;
+  }
+  if (count < 2) {
+    return 0;
+  }
+  TaskStatus_t loopTask = {host::LOOP_TASK, "loopTask", 1, 0, 5, 1, 0, NULL, 0, 1};
+  TaskStatus_t canRxTask = {host::CAN_RX_TASK, "canRx", 2, 0, 10, 10, 0, NULL, 0, 1};
+  status[0] = loopTask;
+  status[1] = canRxTask;
+  return 2;
+}
+inline void portYIELD_FROM_ISR() {}
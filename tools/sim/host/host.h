@@ -0,0 +1,100 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Host Environment
+// ============================================================================
+// State behind the ESP32/Arduino shims in this directory, so the firmware
+// (src/main.cpp and its headers, one translation unit as on the device) can
+// be compiled and driven on Linux by the host tools in tools/sim.
+//
+// Time is virtual: millis(), micros() and esp_timer_get_time() return
+// host::nowUs, which only the driver moves (advanceTo()). esp_timer one-shot
+// timers fire from advanceTo() in deadline order. FreeRTOS tasks are created
+// but never run; queues and task notifications only record what happened.
+// GPIO writes land in host::pinLevel and CAN sends in host::sent.
+
+namespace host {
+
+  typedef void (*TimerCallback)(void *arg);
+
+  struct Timer {
+    TimerCallback callback;
+    void *arg;
+    int64_t dueUs;
+    bool armed;
+  };
+
+  static int64_t nowUs = 0;
+  static bool serialEcho = false;               // Print Serial output to serialOut
+  static FILE *serialOut = stderr;
+  static std::string hostName = "esp32-A1B2C3";
+
+  static uint8_t pinLevel[40];
+  static uint8_t pinModes[40];
+  static uint32_t pinWrites = 0;
+
+  static std::vector<Timer *> timers;
+
+  // Task identities for xTaskGetCurrentTaskHandle(): setup()/loop() run as
+  // LOOP_TASK, CAN RX callbacks as CAN_RX_TASK
+  static void *const LOOP_TASK = (void *)1;
+  static void *const CAN_RX_TASK = (void *)2;
+  static void *currentTask = LOOP_TASK;
+  static uintptr_t nextTaskHandle = 3;
+  static std::map<void *, uint32_t> notifications;
+
+  // Called from advanceTo() when the loop task was notified, i.e. where the
+  // firmware's loop() would wake up. Drivers normally set it to loop.
+  static void (*onLoopNotified)() = NULL;
+
+  // NVS: namespace -> key -> raw bytes
+  static std::map<std::string, std::map<std::string, std::vector<uint8_t> > > nvs;
+
+  inline void nvsPut(const char *ns, const char *key, const void *value, size_t len) {
+    const uint8_t *bytes = (const uint8_t *)value;
+    nvs[ns][key] = std::vector<uint8_t>(bytes, bytes + len);
+  }
+
+  inline void dispatchLoopNotification() {
+    std::map<void *, uint32_t>::iterator it = notifications.find(LOOP_TASK);
+    if (it != notifications.end() && it->second > 0) {
+      it->second = 0;
+      if (onLoopNotified != NULL) {
+        onLoopNotified();
+      }
+    }
+  }
+
+  /**
+   * Move virtual time forward to t, firing every esp_timer due on the way
+   */
+  inline void advanceTo(int64_t t) {
+    for (;;) {
+      Timer *due = NULL;
+      for (size_t i = 0; i < timers.size(); i++) {
+        if (timers[i]->armed && timers[i]->dueUs <= t && (due == NULL || timers[i]->dueUs < due->dueUs)) {
+          due = timers[i];
+        }
+      }
+      if (due == NULL) {
+        break;
+      }
+      if (due->dueUs > nowUs) {
+        nowUs = due->dueUs;
+      }
+      due->armed = false;
+      due->callback(due->arg);
+      dispatchLoopNotification();
+    }
+    if (t > nowUs) {
+      nowUs = t;
+    }
+    dispatchLoopNotification();
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+#include "host.h"
+
+// NVS over host::nvs. A handle is an index into the list of opened namespaces.
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+namespace host {
+  static std::vector<std::string> nvsHandles;
+
+  inline std::vector<uint8_t> *nvsFind(nvs_handle_t handle, const char *key) {
+    std::map<std::string, std::vector<uint8_t> > &ns = nvs[nvsHandles[handle]];
+    std::map<std::string, std::vector<uint8_t> >::iterator it = ns.find(key);
+    return it == ns.end() ? NULL : &it->second;
+  }
+
+  inline esp_err_t nvsGet(nvs_handle_t handle, const char *key, void *out, size_t len) {
+    std::vector<uint8_t> *value = nvsFind(handle, key);
+    if (value == NULL) return ESP_ERR_NVS_NOT_FOUND;
+    if (value->size() != len) return ESP_ERR_INVALID_ARG;
+    memcpy(out, value->data(), len);
+    return ESP_OK;
+  }
+}
+
+inline esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *handle) {
+  if (mode == NVS_READONLY && host::nvs.find(ns) == host::nvs.end()) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  host::nvs[ns];
+  host::nvsHandles.push_back(ns);
+  *handle = (nvs_handle_t)(host::nvsHandles.size() - 1);
+  return ESP_OK;
+}
+inline void nvs_close(nvs_handle_t handle) {}
+inline esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+
+inline esp_err_t nvs_get_u8(nvs_handle_t h, const char *key, uint8_t *out) { return host::nvsGet(h, key, out, sizeof(*out)); }
+inline esp_err_t nvs_get_u16(nvs_handle_t h, const char *key, uint16_t *out) { return host::nvsGet(h, key, out, sizeof(*out)); }
+inline esp_err_t nvs_get_u32(nvs_handle_t h, const char *key, uint32_t *out) { return host::nvsGet(h, key, out, sizeof(*out)); }
+
+inline esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *len) {
+  std::vector<uint8_t> *value = host::nvsFind(h, key);
+  if (value == NULL) return ESP_ERR_NVS_NOT_FOUND;
+  if (value->size() > *len) return ESP_ERR_INVALID_ARG;
+  memcpy(out, value->data(), value->size());
+  *len = value->size();
+  return ESP_OK;
+}
+
+inline esp_err_t nvs_get_str(nvs_handle_t h, const char *key, char *out, size_t *len) {
+  return nvs_get_blob(h, key, out, len);
+}
+
+inline esp_err_t nvs_set_u8(nvs_handle_t h, const char *key, uint8_t v) { host::nvsPut(host::nvsHandles[h].c_str(), key, &v, sizeof(v)); return ESP_OK; }
+inline esp_err_t nvs_set_u16(nvs_handle_t h, const char *key, uint16_t v) { host::nvsPut(host::nvsHandles[h].c_str(), key, &v, sizeof(v)); return ESP_OK; }
+inline esp_err_t nvs_set_u32(nvs_handle_t h, const char *key, uint32_t v) { host::nvsPut(host::nvsHandles[h].c_str(), key, &v, sizeof(v)); return ESP_OK; }
+inline esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *v, size_t len) { host::nvsPut(host::nvsHandles[h].c_str(), key, v, len); return ESP_OK; }
+inline esp_err_t nvs_set_str(nvs_handle_t h, const char *key, const char *v) { host::nvsPut(host::nvsHandles[h].c_str(), key, v, strlen(v) + 1); return ESP_OK; }
+inline esp_err_t nvs_erase_key(nvs_handle_t h, const char *key) { host::nvs[host::nvsHandles[h]].erase(key); return ESP_OK; }
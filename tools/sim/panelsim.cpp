@@ -0,0 +1,559 @@
+// ============================================================================
+// Multi-Panel Bus Simulator
+// ============================================================================
+// Runs N button panels and a reference controller on a simulated classic CAN
+// bus and reports what happens to the 0x18 -> controller -> 0x1B loop as N
+// grows: bus load, dropped presses and how long it takes until every panel
+// shows the new backlight state.
+//
+//   g++ -std=gnu++11 -O2 -I../../src panelsim.cpp -o panelsim
+//   ./panelsim                                  # N = 1, 2, 4, 8, 16, 32
+//   ./panelsim --panels 8,64 --rate 2 --hold 0.3 --csv
+//
+// Panels run the firmware's own gesture recognizer (src/gestures.h) with the
+// default timing of src/configStore.h, see buttons at the 5ms scan period and
+// send 0x18 toggles and 0x15 brightness steps like onGesture() does. Every
+// panel drives the same eight devices on page 0.
+//
+// The reference controller toggles a device (0 <-> 255) on 0x18, sets it on
+// or off by brightness on 0x15, and broadcasts the page state on 0x1B after
+// a fixed processing delay, one frame per change.
+//
+// Bus model: exact frame length including stuff bits, lowest identifier wins
+// arbitration, FIFO transmit queue per node (TWAI default: 5 frames), queue
+// full = frame refused. Two panels sending the same identifier at once is
+// the interesting case:
+//   - same payload (same device toggled): both transmitters see one frame
+//     succeed, the controller toggles once - one press is lost ("merged")
+//   - different payload: bit error in the data field and an error frame;
+//     the senders then retry one after the other. Real nodes can collide
+//     several times before their error counters break the tie, so this is
+//     an optimistic model ("collisions" counts the first one only).
+// Error frames from other causes, bus-off and RX queue overflow are not
+// modeled.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gestures.h"
+
+namespace sim {
+
+  const uint16_t CAN_ID_BRIGHTNESS = 0x15;
+  const uint16_t CAN_ID_BUTTON = 0x18;
+  const uint16_t CAN_ID_LED_STATE = 0x1B;
+  const uint8_t NUM_BUTTONS = gestures::NUM_BUTTONS;
+  const uint32_t SCAN_PERIOD_US = 5000;         // BUTTON_SCAN_PERIOD_MS
+  const size_t CONTROLLER_QUEUE = 32;
+
+  struct Options {
+    std::vector<int> panels;
+    double seconds = 600;
+    double rate = 0.5;                          // Presses per panel per second
+    double hold = 0.2;                          // Share of presses held into brightness mode
+    uint32_t bitrate = 500000;
+    double controllerDelayMs = 1.0;
+    size_t txQueue = 5;
+    uint32_t seed = 1;
+    bool csv = false;
+  };
+
+  struct Frame {
+    uint16_t id;
+    uint8_t dlc;
+    uint8_t data[8];
+    int node;
+    std::vector<int> presses;                   // 0x18: the press; 0x1B: presses it confirms
+  };
+
+  struct Result {
+    int panels;
+    uint32_t presses;
+    uint32_t refused;                           // TX queue full at the panel
+    uint32_t merged;                            // Identical frame from two panels at once
+    uint32_t undelivered;                       // Still queued at the end
+    uint32_t collisions;
+    uint32_t controllerRefused;
+    uint64_t frames;
+    double busLoad;
+    double p50Ms, p99Ms, maxMs;
+    int diverged;                               // Panels whose LEDs differ from the controller at the end
+  };
+
+  // --------------------------------------------------------------------------
+  // Frame length: data frame with 11-bit ID, including stuff bits
+  // --------------------------------------------------------------------------
+
+  static uint32_t frameBits(const Frame &f) {
+    std::vector<uint8_t> bits;
+    bits.push_back(0);                          // SOF
+    for (int i = 10; i >= 0; i--) bits.push_back((f.id >> i) & 1);
+    bits.push_back(0);                          // RTR
+    bits.push_back(0);                          // IDE
+    bits.push_back(0);                          // r0
+    for (int i = 3; i >= 0; i--) bits.push_back((f.dlc >> i) & 1);
+    for (int b = 0; b < f.dlc; b++) {
+      for (int i = 7; i >= 0; i--) bits.push_back((f.data[b] >> i) & 1);
+    }
+    uint16_t crc = 0;
+    for (size_t i = 0; i < bits.size(); i++) {
+      bool feedback = bits[i] ^ ((crc >> 14) & 1);
+      crc = (crc << 1) & 0x7FFF;
+      if (feedback) crc ^= 0x4599;
+    }
+    for (int i = 14; i >= 0; i--) bits.push_back((crc >> i) & 1);
+
+    uint32_t stuffed = 0;
+    int run = 1;
+    for (size_t i = 1; i < bits.size(); i++) {
+      run = (bits[i] == bits[i - 1]) ? run + 1 : 1;
+      if (run == 5) {
+        stuffed++;
+        run = 1;                                // The stuff bit starts a new run
+      }
+    }
+    // + CRC delimiter, ACK slot, ACK delimiter, EOF, intermission
+    return bits.size() + stuffed + 1 + 1 + 1 + 7 + 3;
+  }
+
+  // --------------------------------------------------------------------------
+  // Event loop
+  // --------------------------------------------------------------------------
+
+  struct Event {
+    int64_t atUs;
+    uint64_t order;
+    std::function<void()> run;
+    bool operator<(const Event &other) const {
+      return atUs != other.atUs ? atUs > other.atUs : order > other.order;
+    }
+  };
+
+  class Simulation;
+  static Simulation *active = NULL;           // For the gesture callback (plain function pointer)
+
+  struct Panel {
+    gestures::Recognizer recognizer;
+    uint8_t pressedMask;                        // Physical buttons
+    uint8_t seenMask;                           // As of the last scan
+    int64_t scanPhaseUs;
+    uint32_t deadlineGeneration;
+    uint8_t led[NUM_BUTTONS];
+    uint8_t brightness[NUM_BUTTONS];
+    std::deque<Frame> txQueue;
+  };
+
+  class Simulation {
+  public:
+    Simulation(const Options &opt, int panelCount)
+      : opt_(opt), rng_(opt.seed + panelCount), panels_(panelCount) {
+      timing_.debounceMs = 200;
+      timing_.holdThresholdMs = 700;
+      timing_.holdTickMs = 100;
+      timing_.doubleTapWindowMs = 300;
+      timing_.chordWindowMs = 300;
+      memset(&bindings_, 0, sizeof(bindings_));
+      memset(controllerState_, 0, sizeof(controllerState_));
+      std::uniform_int_distribution<int64_t> phase(0, SCAN_PERIOD_US - 1);
+      for (Panel &p : panels_) {
+        gestures::reset(p.recognizer);
+        p.pressedMask = p.seenMask = 0;
+        p.scanPhaseUs = phase(rng_);
+        p.deadlineGeneration = 0;
+        memset(p.led, 0, sizeof(p.led));
+        memset(p.brightness, 0, sizeof(p.brightness));
+      }
+    }
+
+    Result run() {
+      int64_t endUs = (int64_t)(opt_.seconds * 1e6);
+      for (size_t i = 0; i < panels_.size(); i++) {
+        schedulePress((int)i);
+      }
+      while (!events_.empty()) {
+        Event e = events_.top();
+        events_.pop();
+        now_ = e.atUs;
+        stopped_ = now_ >= endUs;               // Presses stop; everything in flight drains
+        e.run();
+      }
+      return summarize(endUs);
+    }
+
+    void onGesture(const gestures::Event &event) {
+      Panel &p = panels_[gesturePanel_];
+      uint8_t device = event.button;
+      switch (event.type) {
+        case gestures::EVENT_TAP: {
+          int press = (int)pressedAt_.size();
+          pressedAt_.push_back(now_);
+          confirmedAt_.push_back(-1);
+          Frame f = makeFrame(CAN_ID_BUTTON, 1, gesturePanel_);
+          f.data[0] = device;
+          f.presses.push_back(press);
+          if (!queue(p.txQueue, f, opt_.txQueue)) {
+            result_.refused++;
+          }
+          break;
+        }
+        case gestures::EVENT_HOLD_START:
+          p.brightness[device] = 0;
+          break;
+        case gestures::EVENT_HOLD_TICK: {
+          p.brightness[device]++;
+          Frame f = makeFrame(CAN_ID_BRIGHTNESS, 2, gesturePanel_);
+          f.data[0] = device;
+          f.data[1] = p.brightness[device];
+          queue(p.txQueue, f, opt_.txQueue);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+  private:
+    const Options &opt_;
+    std::mt19937 rng_;
+    std::vector<Panel> panels_;
+    std::priority_queue<Event> events_;
+    uint64_t order_ = 0;
+    int64_t now_ = 0;
+    bool stopped_ = false;
+    gestures::Timing timing_;
+    gestures::Bindings bindings_;
+    int gesturePanel_ = 0;
+
+    // Bus
+    bool busBusy_ = false;
+    bool arbitrationPending_ = false;
+    int64_t busBusyUs_ = 0;
+
+    // Controller (node index = panel count)
+    uint8_t controllerState_[NUM_BUTTONS];
+    std::deque<Frame> controllerQueue_;
+    std::vector<int> unconfirmed_;              // Presses applied but not yet broadcast
+
+    std::vector<int64_t> pressedAt_;
+    std::vector<int64_t> confirmedAt_;
+    Result result_ = {};
+
+    void at(int64_t t, std::function<void()> fn) {
+      Event e;
+      e.atUs = t;
+      e.order = order_++;
+      e.run = fn;
+      events_.push(e);
+    }
+
+    Frame makeFrame(uint16_t id, uint8_t dlc, int node) {
+      Frame f;
+      f.id = id;
+      f.dlc = dlc;
+      memset(f.data, 0, sizeof(f.data));
+      f.node = node;
+      return f;
+    }
+
+    bool queue(std::deque<Frame> &q, const Frame &f, size_t capacity) {
+      if (q.size() >= capacity) {
+        return false;
+      }
+      q.push_back(f);
+      requestArbitration();
+      return true;
+    }
+
+    // ---- Workload ----------------------------------------------------------
+
+    void schedulePress(int panel) {
+      std::exponential_distribution<double> gap(opt_.rate);
+      int64_t t = now_ + (int64_t)(gap(rng_) * 1e6);
+      at(t, [this, panel]() { startPress(panel); });
+    }
+
+    void startPress(int panel) {
+      if (stopped_) return;
+      Panel &p = panels_[panel];
+      std::uniform_int_distribution<int> pick(0, NUM_BUTTONS - 1);
+      std::uniform_real_distribution<double> unit(0.0, 1.0);
+      uint8_t bit = 1 << pick(rng_);
+      if (!(p.pressedMask & bit)) {
+        // Taps clear the debounce time but not the hold threshold; holds run a few ticks
+        double ms = unit(rng_) < opt_.hold
+                      ? timing_.holdThresholdMs + 200 + unit(rng_) * 1800
+                      : timing_.debounceMs + 20 + unit(rng_) * 250;
+        p.pressedMask |= bit;
+        at(now_ + (int64_t)(ms * 1000), [this, panel, bit]() { panels_[panel].pressedMask &= ~bit; scheduleScan(panel); });
+        scheduleScan(panel);
+      }
+      schedulePress(panel);
+    }
+
+    // The loop task sees a mask change at its next 5ms wake-up
+    void scheduleScan(int panel) {
+      const Panel &p = panels_[panel];
+      int64_t sinceGrid = (now_ - p.scanPhaseUs) % SCAN_PERIOD_US;
+      int64_t next = now_ + (sinceGrid == 0 ? 0 : SCAN_PERIOD_US - sinceGrid);
+      at(next, [this, panel]() { scan(panel); });
+    }
+
+    void scan(int panel) {
+      Panel &p = panels_[panel];
+      if (p.pressedMask == p.seenMask) return;
+      p.seenMask = p.pressedMask;
+      updateGestures(panel);
+    }
+
+    void updateGestures(int panel) {
+      Panel &p = panels_[panel];
+      uint32_t nowMs = (uint32_t)(now_ / 1000);
+      gesturePanel_ = panel;
+      active = this;
+      gestures::update(p.recognizer, p.seenMask, nowMs, timing_, bindings_, dispatchGesture);
+      uint32_t dueInMs = gestures::nextDeadline(p.recognizer, nowMs, timing_);
+      uint32_t generation = ++p.deadlineGeneration;
+      if (dueInMs != gestures::NO_DEADLINE) {
+        at((int64_t)(nowMs + dueInMs) * 1000, [this, panel, generation]() {
+          if (panels_[panel].deadlineGeneration == generation) updateGestures(panel);
+        });
+      }
+    }
+
+    static void dispatchGesture(const gestures::Event &event) {
+      active->onGesture(event);
+    }
+
+    // ---- Bus ---------------------------------------------------------------
+
+    void requestArbitration() {
+      if (busBusy_ || arbitrationPending_) return;
+      arbitrationPending_ = true;
+      at(now_, [this]() { arbitrate(); });     // Lets frames queued at the same instant contend
+    }
+
+    std::deque<Frame> &queueOf(int node) {
+      return node < (int)panels_.size() ? panels_[node].txQueue : controllerQueue_;
+    }
+
+    void arbitrate() {
+      arbitrationPending_ = false;
+      std::vector<int> contenders;
+      uint16_t lowest = 0xFFFF;
+      for (int node = 0; node <= (int)panels_.size(); node++) {
+        std::deque<Frame> &q = queueOf(node);
+        if (q.empty()) continue;
+        if (q.front().id < lowest) {
+          lowest = q.front().id;
+          contenders.clear();
+        }
+        if (q.front().id == lowest) contenders.push_back(node);
+      }
+      if (contenders.empty()) return;
+
+      // Contenders with the first contender's payload go out together
+      Frame winner = queueOf(contenders[0]).front();
+      std::vector<int> senders;
+      bool collision = false;
+      for (int node : contenders) {
+        const Frame &f = queueOf(node).front();
+        if (f.dlc == winner.dlc && memcmp(f.data, winner.data, f.dlc) == 0) {
+          senders.push_back(node);
+        } else {
+          collision = true;
+        }
+      }
+
+      if (collision) {
+        // Error frame, then one sender goes first and the rest wait for
+        // the next arbitration (see header)
+        result_.collisions++;
+        std::shuffle(contenders.begin(), contenders.end(), rng_);
+        std::vector<Frame> deferred;
+        for (size_t i = 1; i < contenders.size(); i++) {
+          std::deque<Frame> &q = queueOf(contenders[i]);
+          deferred.push_back(q.front());
+          q.pop_front();
+        }
+        Frame first = queueOf(contenders[0]).front();
+        queueOf(contenders[0]).pop_front();
+        result_.frames++;
+        uint32_t errorBits = 19 + 8 + 8 * 2 + 20;   // Up to the data field, error flag + delimiter, intermission
+        occupyBus(errorBits + frameBits(first), [this, first, deferred]() {
+          for (const Frame &f : deferred) queueOf(f.node).push_front(f);
+          deliver(first);
+          requestArbitration();
+        });
+        return;
+      }
+
+      for (size_t i = 1; i < senders.size(); i++) {
+        Frame &dup = queueOf(senders[i]).front();
+        winner.presses.insert(winner.presses.end(), dup.presses.begin(), dup.presses.end());
+        result_.merged += dup.presses.size();
+        queueOf(senders[i]).pop_front();
+      }
+      queueOf(senders[0]).pop_front();
+      result_.frames++;
+      occupyBus(frameBits(winner), [this, winner]() {
+        deliver(winner);
+        requestArbitration();
+      });
+    }
+
+    void occupyBus(uint32_t bits, std::function<void()> done) {
+      busBusy_ = true;
+      int64_t durationUs = ((int64_t)bits * 1000000 + opt_.bitrate - 1) / opt_.bitrate;
+      busBusyUs_ += durationUs;
+      at(now_ + durationUs, [this, done]() {
+        busBusy_ = false;
+        done();
+      });
+    }
+
+    void deliver(const Frame &f) {
+      if (f.id == CAN_ID_LED_STATE) {
+        for (Panel &p : panels_) memcpy(p.led, f.data, NUM_BUTTONS);
+        for (int press : f.presses) {
+          if (confirmedAt_[press] < 0) confirmedAt_[press] = now_;
+        }
+        return;
+      }
+      // Only the first press of a merged frame reaches the controller
+      int64_t applyAt = now_ + (int64_t)(opt_.controllerDelayMs * 1000);
+      at(applyAt, [this, f]() { controllerApply(f); });
+    }
+
+    // ---- Controller ----------------------------------------------------------
+
+    void controllerApply(const Frame &f) {
+      uint8_t device = f.data[0];
+      if (device >= NUM_BUTTONS) return;
+      if (f.id == CAN_ID_BUTTON) {
+        controllerState_[device] = controllerState_[device] ? 0 : 255;
+        unconfirmed_.push_back(f.presses[0]);
+      } else if (f.id == CAN_ID_BRIGHTNESS) {
+        controllerState_[device] = f.data[1] > 0 ? 255 : 0;
+      }
+      Frame state = makeFrame(CAN_ID_LED_STATE, 8, (int)panels_.size());
+      memcpy(state.data, controllerState_, NUM_BUTTONS);
+      state.presses = unconfirmed_;
+      if (queue(controllerQueue_, state, CONTROLLER_QUEUE)) {
+        unconfirmed_.clear();
+      } else {
+        result_.controllerRefused++;          // Confirmed by the next state frame instead
+      }
+    }
+
+    // ---- Results -------------------------------------------------------------
+
+    Result summarize(int64_t endUs) {
+      Result r = result_;
+      r.panels = (int)panels_.size();
+      r.presses = (uint32_t)pressedAt_.size();
+      r.busLoad = (double)busBusyUs_ / (double)std::max(now_, endUs);
+
+      std::vector<double> latencies;
+      uint32_t confirmed = 0;
+      for (size_t i = 0; i < pressedAt_.size(); i++) {
+        if (confirmedAt_[i] >= 0) {
+          confirmed++;
+          latencies.push_back((confirmedAt_[i] - pressedAt_[i]) / 1000.0);
+        }
+      }
+      // Refused and merged presses never get a state frame of their own
+      int64_t lost = (int64_t)r.presses - confirmed - r.refused - r.merged;
+      r.undelivered = lost > 0 ? (uint32_t)lost : 0;
+      std::sort(latencies.begin(), latencies.end());
+      if (!latencies.empty()) {
+        r.p50Ms = latencies[latencies.size() / 2];
+        r.p99Ms = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+        r.maxMs = latencies.back();
+      }
+      r.diverged = 0;
+      for (const Panel &p : panels_) {
+        if (memcmp(p.led, controllerState_, NUM_BUTTONS) != 0) r.diverged++;
+      }
+      return r;
+    }
+  };
+
+  // --------------------------------------------------------------------------
+
+  static std::vector<int> parseList(const char *text) {
+    std::vector<int> values;
+    std::string s(text);
+    size_t pos = 0;
+    while (pos < s.size()) {
+      size_t comma = s.find(',', pos);
+      if (comma == std::string::npos) comma = s.size();
+      values.push_back(atoi(s.substr(pos, comma - pos).c_str()));
+      pos = comma + 1;
+    }
+    return values;
+  }
+
+  static void usage() {
+    fprintf(stderr,
+            "usage: panelsim [--panels 1,2,4] [--seconds S] [--rate presses/s per panel]\n"
+            "                [--hold share] [--bitrate bps] [--controller-delay ms]\n"
+            "                [--tx-queue frames] [--seed N] [--csv]\n");
+    exit(2);
+  }
+}
+
+int main(int argc, char **argv) {
+  sim::Options opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--panels" && hasValue) opt.panels = sim::parseList(argv[++i]);
+    else if (arg == "--seconds" && hasValue) opt.seconds = atof(argv[++i]);
+    else if (arg == "--rate" && hasValue) opt.rate = atof(argv[++i]);
+    else if (arg == "--hold" && hasValue) opt.hold = atof(argv[++i]);
+    else if (arg == "--bitrate" && hasValue) opt.bitrate = (uint32_t)atol(argv[++i]);
+    else if (arg == "--controller-delay" && hasValue) opt.controllerDelayMs = atof(argv[++i]);
+    else if (arg == "--tx-queue" && hasValue) opt.txQueue = (size_t)atoi(argv[++i]);
+    else if (arg == "--seed" && hasValue) opt.seed = (uint32_t)atol(argv[++i]);
+    else if (arg == "--csv") opt.csv = true;
+    else sim::usage();
+  }
+  if (opt.panels.empty()) opt.panels = {1, 2, 4, 8, 16, 32};
+  if (opt.rate <= 0 || opt.seconds <= 0 || opt.bitrate == 0 || opt.txQueue == 0) sim::usage();
+
+  if (opt.csv) {
+    printf("panels,presses,refused,merged,undelivered,collisions,controller_refused,frames,"
+           "bus_load,latency_p50_ms,latency_p99_ms,latency_max_ms,diverged\n");
+  } else {
+    printf("%.0f s, %.2f presses/s per panel, %.0f%% held, %lu bps, controller %.1f ms, TX queue %lu\n\n",
+           opt.seconds, opt.rate, opt.hold * 100, (unsigned long)opt.bitrate, opt.controllerDelayMs,
+           (unsigned long)opt.txQueue);
+    printf("panels  presses  dropped (refused/merged/lost)  collisions  bus load"
+           "  latency p50 / p99 / max ms  diverged\n");
+  }
+
+  for (int n : opt.panels) {
+    if (n <= 0) continue;
+    sim::Simulation simulation(opt, n);
+    sim::Result r = simulation.run();
+    if (opt.csv) {
+      printf("%d,%u,%u,%u,%u,%u,%u,%llu,%.4f,%.3f,%.3f,%.3f,%d\n", r.panels, r.presses, r.refused, r.merged,
+             r.undelivered, r.collisions, r.controllerRefused, (unsigned long long)r.frames, r.busLoad,
+             r.p50Ms, r.p99Ms, r.maxMs, r.diverged);
+    } else {
+      printf("%6d  %7u  %7u (%u/%u/%u)%*s  %10u  %7.2f%%  %8.2f / %6.2f / %6.2f  %8d\n", r.panels, r.presses,
+             r.refused + r.merged + r.undelivered, r.refused, r.merged, r.undelivered, 12, "", r.collisions,
+             r.busLoad * 100, r.p50Ms, r.p99Ms, r.maxMs, r.diverged);
+    }
+  }
+  return 0;
+}
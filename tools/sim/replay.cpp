@@ -0,0 +1,342 @@
+// ============================================================================
+// CAN Log Replay
+// ============================================================================
+// Feeds a candump capture through the firmware's own receive path on the
+// host: onCanRx(), registered as the RX callback, and everything behind it
+// (handleWifiConfigMessage(), handleConfigMessage(), the LED update, ...).
+// The whole firmware is compiled into this program with the shims in
+// tools/sim/host; setup() runs as on boot and loop() wherever the firmware
+// would wake it.
+//
+//   g++ -std=gnu++11 -O2 -DDEBUG=0 -Ihost -I../../src replay.cpp -o replay
+//   ./replay trailer.log                  # as fast as possible
+//   ./replay trailer.log --realtime       # at the recorded pace
+//   ./replay trailer.log --json > run.json
+//
+// Accepts `candump -l` files ("(1700000000.123456) can0 01B#FF00...") and
+// `candump -ta` output ("(1700000000.123456)  can0  01B   [8]  FF 00 ...").
+//
+// Virtual time follows the capture timestamps in both modes, so timeouts
+// and deferred work (WiFi transfer timeout, config commit, scheduler
+// callbacks) fire where they would have. --realtime only adds wall-clock
+// pacing.
+//
+// Reported:
+//   - frames per second through onCanRx() (handler time only)
+//   - per-ID frame count and handling cost (average and worst case)
+//   - frames the panel sent in response
+//   - LED divergence: after every LED state frame, the backlight pins are
+//     compared with what the frames say they should show. The expectation
+//     is rebuilt here from the raw frames, independently of the firmware's
+//     LED cache.
+//
+// Costs are host CPU time, useful to compare handler changes against each
+// other on the same machine, not as device numbers. Build with DEBUG=0:
+// with DEBUG=1 most of the time goes into formatting debug output.
+
+#include "../../src/main.cpp"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace replay {
+
+  struct Frame {
+    int64_t timeUs;                 // Capture timestamp
+    twai_message_t msg;
+  };
+
+  struct IdStats {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+  };
+
+  struct Divergence {
+    int64_t timeUs;
+    uint32_t identifier;
+    uint8_t expectedMask;
+    uint8_t actualMask;
+  };
+
+  const int64_t BOOT_SETTLE_US = 1000000;     // First frame arrives this long after setup()
+  const int64_t DRAIN_US = 3000000;           // Let deferred work finish after the last frame
+  const size_t MAX_DIVERGENCES_LISTED = 10;
+
+  static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  /**
+   * Parse one candump line (-l or -ta format). Returns false for anything
+   * else, including CAN FD and error frames.
+   */
+  bool parseLine(const char *line, Frame &frame) {
+    double seconds = 0;
+    char iface[32];
+    int used = 0;
+    if (sscanf(line, " (%lf) %31s %n", &seconds, iface, &used) < 2) {
+      return false;
+    }
+    frame.timeUs = (int64_t)(seconds * 1e6 + 0.5);
+    const char *p = line + used;
+
+    memset(&frame.msg, 0, sizeof(frame.msg));
+    char idText[16];
+    int idLen = 0;
+    while (hexValue(p[idLen]) >= 0 && idLen < (int)sizeof(idText) - 1) {
+      idText[idLen] = p[idLen];
+      idLen++;
+    }
+    idText[idLen] = '\0';
+    if (idLen == 0) {
+      return false;
+    }
+    frame.msg.identifier = (uint32_t)strtoul(idText, NULL, 16);
+    frame.msg.extd = idLen > 3;
+    p += idLen;
+
+    if (*p == '#') {
+      // -l format: ID#DATA or ID#R
+      p++;
+      if (*p == '#') return false;            // CAN FD
+      if (*p == 'R') {
+        frame.msg.rtr = 1;
+        return true;
+      }
+      uint8_t n = 0;
+      while (n < 8 && hexValue(p[0]) >= 0 && hexValue(p[1]) >= 0) {
+        frame.msg.data[n++] = (uint8_t)(hexValue(p[0]) << 4 | hexValue(p[1]));
+        p += 2;
+      }
+      frame.msg.data_length_code = n;
+      return true;
+    }
+
+    // -ta format: ID   [DLC]  B0 B1 ...
+    unsigned dlc = 0;
+    if (sscanf(p, " [%u]%n", &dlc, &used) < 1 || dlc > 8) {
+      return false;
+    }
+    p += used;
+    frame.msg.data_length_code = (uint8_t)dlc;
+    if (strstr(p, "remote request") != NULL) {
+      frame.msg.rtr = 1;
+      return true;
+    }
+    for (unsigned i = 0; i < dlc; i++) {
+      unsigned byteValue;
+      if (sscanf(p, " %2x%n", &byteValue, &used) < 1) {
+        return false;
+      }
+      frame.msg.data[i] = (uint8_t)byteValue;
+      p += used;
+    }
+    return true;
+  }
+
+  /**
+   * Legacy 11-bit ID of a frame, as the firmware's handlers see it.
+   * In J1939 builds, Proprietary B frames carry it in the group extension.
+   */
+  bool legacyId(const twai_message_t &msg, uint32_t &id) {
+#if J1939_MODE
+    if (!msg.extd || ((msg.identifier >> 16) & 0xFF) != 0xFF) return false;
+    id = (msg.identifier >> 8) & 0xFF;
+    return true;
+#else
+    if (msg.extd) return false;
+    id = msg.identifier;
+    return true;
+#endif
+  }
+
+  uint8_t ledPinMask() {
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < board::BUTTONS; i++) {
+      if (host::pinLevel[ledPins[i]] == HIGH) mask |= 1 << i;
+    }
+    return mask;
+  }
+
+  uint8_t expectedLedMask(const uint8_t expected[config::MAX_PAGES][config::NUM_BUTTONS]) {
+    const config::PanelConfig cfg = config::get();
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < board::BUTTONS; i++) {
+      uint8_t slot = cfg.buttonDevice[i];
+      if (!(slot & config::BUTTON_SCENE_FLAG) && expected[activePage][slot] > 0) mask |= 1 << i;
+    }
+    return mask;
+  }
+
+  static void usage() {
+    fprintf(stderr,
+            "usage: replay CAPTURE [--realtime] [--node A1B2C3] [--bitrate bps] [--verbose] [--json]\n");
+    exit(2);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  bool realtime = false;
+  bool json = false;
+  uint32_t bitrate = CAN_DEFAULT_BITRATE;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--realtime") realtime = true;
+    else if (arg == "--json") json = true;
+    else if (arg == "--verbose") host::serialEcho = true;
+    else if (arg == "--node" && i + 1 < argc) host::hostName = std::string("esp32-") + argv[++i];
+    else if (arg == "--bitrate" && i + 1 < argc) bitrate = (uint32_t)atol(argv[++i]);
+    else if (arg[0] != '-' && path == NULL) path = argv[i];
+    else replay::usage();
+  }
+  if (path == NULL) replay::usage();
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  std::vector<replay::Frame> frames;
+  uint32_t skipped = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    replay::Frame frame;
+    if (replay::parseLine(line, frame)) {
+      frames.push_back(frame);
+    } else if (line[0] != '\n') {
+      skipped++;
+    }
+  }
+  fclose(f);
+  if (frames.empty()) {
+    fprintf(stderr, "%s: no CAN frames found\n", path);
+    return 1;
+  }
+
+  // Boot like a panel that already knows its bitrate (no listen-only probe)
+  host::nvsPut("can", "bitrate", &bitrate, sizeof(bitrate));
+  // loop() only runs when the firmware would be woken, not every scan
+  // period, so the scan SLA (key 22) would fire on every quiet stretch
+  uint16_t scanSlaOff = 0;
+  host::nvsPut("config", "scanSla", &scanSlaOff, sizeof(scanSlaOff));
+  host::onLoopNotified = loop;
+  setup();
+  loop();
+  host::sent.clear();
+
+  std::map<uint32_t, replay::IdStats> perId;     // Key: raw identifier | extended flag in bit 31
+  uint8_t expected[config::MAX_PAGES][config::NUM_BUTTONS] = {};
+  std::vector<replay::Divergence> divergences;
+  uint32_t ledFrames = 0;
+  uint64_t handlerNs = 0;
+
+  int64_t firstUs = frames.front().timeUs;
+  int64_t baseUs = host::nowUs + replay::BOOT_SETTLE_US;
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < frames.size(); i++) {
+    const replay::Frame &frame = frames[i];
+    int64_t offsetUs = frame.timeUs - firstUs;
+    host::advanceTo(baseUs + offsetUs);
+    if (realtime) {
+      std::this_thread::sleep_until(wallStart + std::chrono::microseconds(offsetUs));
+    }
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    host::deliver(frame.msg);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    host::dispatchLoopNotification();
+
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    handlerNs += ns;
+    replay::IdStats &stats = perId[frame.msg.identifier | (frame.msg.extd ? 0x80000000u : 0)];
+    stats.count++;
+    stats.totalNs += ns;
+    if (ns > stats.maxNs) stats.maxNs = ns;
+
+    // Expected backlights, from the frame itself
+    const config::PanelConfig cfg = config::get();
+    uint32_t id;
+    if (replay::legacyId(frame.msg, id) && id >= cfg.canIdLedState && id < cfg.canIdLedState + cfg.pageCount &&
+        frame.msg.data_length_code >= 8) {
+      memcpy(expected[id - cfg.canIdLedState], frame.msg.data, config::NUM_BUTTONS);
+      ledFrames++;
+      uint8_t want = replay::expectedLedMask(expected);
+      uint8_t have = replay::ledPinMask();
+      if (want != have) {
+        replay::Divergence d = {frame.timeUs, frame.msg.identifier, want, have};
+        divergences.push_back(d);
+      }
+    }
+  }
+  host::advanceTo(host::nowUs + replay::DRAIN_US);
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+  std::map<uint32_t, uint32_t> sentPerId;
+  for (size_t i = 0; i < host::sent.size(); i++) {
+    sentPerId[host::sent[i].identifier | (host::sent[i].extd ? 0x80000000u : 0)]++;
+  }
+
+  double capturedS = (frames.back().timeUs - firstUs) / 1e6;
+  double framesPerS = handlerNs > 0 ? frames.size() * 1e9 / handlerNs : 0;
+
+  if (json) {
+    printf("{\n  \"capture\": \"%s\",\n  \"frames\": %lu,\n  \"skipped_lines\": %u,\n", path,
+           (unsigned long)frames.size(), skipped);
+    printf("  \"capture_seconds\": %.3f,\n  \"wall_seconds\": %.3f,\n  \"handler_frames_per_second\": %.0f,\n",
+           capturedS, wallS, framesPerS);
+    printf("  \"ids\": [");
+    const char *sep = "";
+    for (std::map<uint32_t, replay::IdStats>::iterator it = perId.begin(); it != perId.end(); ++it) {
+      printf("%s\n    {\"id\": %lu, \"extended\": %s, \"frames\": %llu, \"avg_ns\": %llu, \"max_ns\": %llu}", sep,
+             (unsigned long)(it->first & 0x1FFFFFFF), (it->first & 0x80000000u) ? "true" : "false",
+             (unsigned long long)it->second.count, (unsigned long long)(it->second.totalNs / it->second.count),
+             (unsigned long long)it->second.maxNs);
+      sep = ",";
+    }
+    printf("\n  ],\n  \"sent\": [");
+    sep = "";
+    for (std::map<uint32_t, uint32_t>::iterator it = sentPerId.begin(); it != sentPerId.end(); ++it) {
+      printf("%s\n    {\"id\": %lu, \"extended\": %s, \"frames\": %u}", sep,
+             (unsigned long)(it->first & 0x1FFFFFFF), (it->first & 0x80000000u) ? "true" : "false", it->second);
+      sep = ",";
+    }
+    printf("\n  ],\n  \"led_frames\": %u,\n  \"led_divergences\": %lu\n}\n", ledFrames,
+           (unsigned long)divergences.size());
+    return divergences.empty() ? 0 : 3;
+  }
+
+  printf("%s: %lu frames over %.1f s", path, (unsigned long)frames.size(), capturedS);
+  if (skipped > 0) printf(" (%u lines skipped)", skipped);
+  printf(", replayed in %.2f s\n", wallS);
+  printf("Handler throughput: %.0f frames/s (time inside onCanRx only)\n\n", framesPerS);
+
+  printf("      ID    frames    avg ns    max ns\n");
+  for (std::map<uint32_t, replay::IdStats>::iterator it = perId.begin(); it != perId.end(); ++it) {
+    bool ext = (it->first & 0x80000000u) != 0;
+    printf(ext ? "%08lX" : "   0x%03lX", (unsigned long)(it->first & 0x1FFFFFFF));
+    printf("  %8llu  %8llu  %8llu\n", (unsigned long long)it->second.count,
+           (unsigned long long)(it->second.totalNs / it->second.count), (unsigned long long)it->second.maxNs);
+  }
+
+  printf("\nPanel sent %lu frames", (unsigned long)host::sent.size());
+  for (std::map<uint32_t, uint32_t>::iterator it = sentPerId.begin(); it != sentPerId.end(); ++it) {
+    printf(it == sentPerId.begin() ? ": " : ", ");
+    printf("0x%lX x%u", (unsigned long)(it->first & 0x1FFFFFFF), it->second);
+  }
+  printf("\nLED divergence: %lu of %u LED state frames\n", (unsigned long)divergences.size(), ledFrames);
+  for (size_t i = 0; i < divergences.size() && i < replay::MAX_DIVERGENCES_LISTED; i++) {
+    const replay::Divergence &d = divergences[i];
+    printf("  (%.6f) 0x%03lX: expected LEDs 0x%02X, pins show 0x%02X\n", d.timeUs / 1e6,
+           (unsigned long)d.identifier, d.expectedMask, d.actualMask);
+  }
+  return divergences.empty() ? 0 : 3;
+}